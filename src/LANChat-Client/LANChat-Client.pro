@@ -10,10 +10,38 @@ CONFIG += c++17
 # RESOURCES += resources.qrc
 
 SOURCES += \
+    base64codec.cpp \
+    blobcache.cpp \
+    chattimeline.cpp \
+    chunkpipeline.cpp \
+    framecodec.cpp \
+    heartbeat.cpp \
+    imagesniffer.cpp \
+    incomingfile.cpp \
     main.cpp \
+    outboundscheduler.cpp \
+    outbox.cpp \
+    serverdiscovery.cpp \
+    thumbnailcache.cpp \
+    thumbnailloader.cpp \
+    transferjournal.cpp \
     widget.cpp
 
 HEADERS += \
+    base64codec.h \
+    blobcache.h \
+    chattimeline.h \
+    chunkpipeline.h \
+    framecodec.h \
+    heartbeat.h \
+    imagesniffer.h \
+    incomingfile.h \
+    outboundscheduler.h \
+    outbox.h \
+    serverdiscovery.h \
+    thumbnailcache.h \
+    thumbnailloader.h \
+    transferjournal.h \
     widget.h
 
 FORMS += \
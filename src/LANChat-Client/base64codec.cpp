@@ -0,0 +1,438 @@
+#include "base64codec.h"
+#include <atomic>
+#include <cstring>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define BASE64_HAVE_X86_SIMD
+#define BASE64_TARGET(arch) __attribute__((target(arch)))
+#endif
+
+namespace {
+
+const char EncodeTable[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// 0-63 为有效字符，Skip 为空白字符，Pad 为 '='，Invalid 为非法字符
+enum : quint8 {
+    Invalid = 0xff,
+    Skip = 0xfe,
+    Pad = 0xfd
+};
+
+struct DecodeTable {
+    quint8 values[256];
+
+    constexpr DecodeTable() : values()
+    {
+        for (int i = 0; i < 256; ++i) values[i] = Invalid;
+        for (int i = 0; i < 64; ++i) values[quint8(EncodeTable[i])] = quint8(i);
+        values[quint8(' ')] = Skip;
+        values[quint8('\t')] = Skip;
+        values[quint8('\n')] = Skip;
+        values[quint8('\r')] = Skip;
+        values[quint8('\f')] = Skip;
+        values[quint8('\v')] = Skip;
+        values[quint8('=')] = Pad;
+    }
+};
+
+constexpr DecodeTable Decode;
+
+// ---------- 标量实现 ----------
+
+qsizetype encodeScalar(const uchar *in, qsizetype size, char *out)
+{
+    char *start = out;
+    qsizetype i = 0;
+    for (; i + 3 <= size; i += 3) {
+        quint32 v = quint32(in[i]) << 16 | quint32(in[i + 1]) << 8 | in[i + 2];
+        *out++ = EncodeTable[(v >> 18) & 0x3f];
+        *out++ = EncodeTable[(v >> 12) & 0x3f];
+        *out++ = EncodeTable[(v >> 6) & 0x3f];
+        *out++ = EncodeTable[v & 0x3f];
+    }
+    if (i < size) {
+        quint32 v = quint32(in[i]) << 16;
+        if (i + 1 < size) v |= quint32(in[i + 1]) << 8;
+        *out++ = EncodeTable[(v >> 18) & 0x3f];
+        *out++ = EncodeTable[(v >> 12) & 0x3f];
+        *out++ = (i + 1 < size) ? EncodeTable[(v >> 6) & 0x3f] : '=';
+        *out++ = '=';
+    }
+    return out - start;
+}
+
+// 解码状态：跨越 SIMD 块和标量片段保留未凑满 4 个字符的部分
+struct DecodeState {
+    quint32 accum = 0;
+    int count = 0;       // accum 中的 6 位组数量
+    bool padded = false; // 已遇到 '='，之后只允许空白和 '='
+};
+
+// 标量解码 [pos, end)，当 stopWhenAligned 为 true 时，在跨过 minPos 且
+// 状态对齐到 4 字符边界后返回，把剩余部分交还给 SIMD 路径
+bool decodeScalar(const uchar *in, qsizetype &pos, qsizetype end, uchar *&out,
+                  DecodeState &state, qsizetype minPos = 0, bool stopWhenAligned = false)
+{
+    while (pos < end) {
+        if (state.count == 0 && !state.padded) {
+            if (stopWhenAligned && pos >= minPos) return true;
+            // 快速路径：连续 4 个有效字符一次解出 3 字节
+            if (end - pos >= 4) {
+                quint8 a = Decode.values[in[pos]];
+                quint8 b = Decode.values[in[pos + 1]];
+                quint8 c = Decode.values[in[pos + 2]];
+                quint8 d = Decode.values[in[pos + 3]];
+                if ((a | b | c | d) < 64) {
+                    quint32 v = quint32(a) << 18 | quint32(b) << 12 | quint32(c) << 6 | d;
+                    *out++ = uchar(v >> 16);
+                    *out++ = uchar(v >> 8);
+                    *out++ = uchar(v);
+                    pos += 4;
+                    continue;
+                }
+            }
+        }
+
+        quint8 v = Decode.values[in[pos++]];
+        if (v < 64) {
+            if (state.padded) return false;
+            state.accum = state.accum << 6 | v;
+            if (++state.count == 4) {
+                *out++ = uchar(state.accum >> 16);
+                *out++ = uchar(state.accum >> 8);
+                *out++ = uchar(state.accum);
+                state.accum = 0;
+                state.count = 0;
+            }
+        } else if (v == Skip) {
+            continue;
+        } else if (v == Pad) {
+            state.padded = true;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+// 处理末尾不足 4 个字符的部分（缺少 '=' 时同样接受）
+bool finishDecode(uchar *&out, DecodeState &state)
+{
+    switch (state.count) {
+    case 0:
+        return true;
+    case 2:
+        *out++ = uchar(state.accum >> 4);
+        return true;
+    case 3:
+        *out++ = uchar(state.accum >> 10);
+        *out++ = uchar(state.accum >> 2);
+        return true;
+    default:
+        return false;
+    }
+}
+
+#ifdef BASE64_HAVE_X86_SIMD
+
+// ---------- SSE4.1 实现（16 字符 <-> 12 字节） ----------
+// 算法参考 Wojciech Muła / Daniel Lemire 的向量化 Base64
+
+BASE64_TARGET("sse4.1")
+inline __m128i encodeLookupSse(__m128i indices)
+{
+    __m128i result = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+    __m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+    result = _mm_or_si128(result, _mm_and_si128(less, _mm_set1_epi8(13)));
+    const __m128i shiftLut = _mm_setr_epi8(
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    result = _mm_shuffle_epi8(shiftLut, result);
+    return _mm_add_epi8(result, indices);
+}
+
+BASE64_TARGET("sse4.1")
+inline __m128i encodeSplitSse(__m128i in)
+{
+    in = _mm_shuffle_epi8(in, _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10));
+    const __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+    const __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+    const __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+    const __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+    return _mm_or_si128(t1, t3);
+}
+
+BASE64_TARGET("sse4.1")
+qsizetype encodeSse(const uchar *in, qsizetype size, char *out)
+{
+    char *start = out;
+    qsizetype i = 0;
+    // 每次读取 16 字节、使用其中 12 字节，保证不越界读取
+    for (; i + 16 <= size; i += 12) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out), encodeLookupSse(encodeSplitSse(v)));
+        out += 16;
+    }
+    out += encodeScalar(in + i, size - i, out);
+    return out - start;
+}
+
+// 校验并把 16 个字符转换为 6 位值；含非字母表字符（空白、'='、非法）时返回 false
+BASE64_TARGET("sse4.1")
+inline bool decodeLookupSse(__m128i &in)
+{
+    const __m128i lutLo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                        0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+    const __m128i lutHi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m128i lutRoll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71,
+                                          0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i mask2F = _mm_set1_epi8(0x2f);
+
+    const __m128i hiNibbles = _mm_and_si128(_mm_srli_epi32(in, 4), mask2F);
+    const __m128i loNibbles = _mm_and_si128(in, mask2F);
+    const __m128i lo = _mm_shuffle_epi8(lutLo, loNibbles);
+    const __m128i eq2F = _mm_cmpeq_epi8(in, mask2F);
+    const __m128i hi = _mm_shuffle_epi8(lutHi, hiNibbles);
+    if (!_mm_testz_si128(lo, hi)) return false;
+
+    const __m128i roll = _mm_shuffle_epi8(lutRoll, _mm_add_epi8(eq2F, hiNibbles));
+    in = _mm_add_epi8(in, roll);
+    return true;
+}
+
+BASE64_TARGET("sse4.1")
+inline __m128i decodePackSse(__m128i values)
+{
+    const __m128i mergeAbBc = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+    const __m128i merged = _mm_madd_epi16(mergeAbBc, _mm_set1_epi32(0x00011000));
+    return _mm_shuffle_epi8(merged, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12,
+                                                  -1, -1, -1, -1));
+}
+
+BASE64_TARGET("sse4.1")
+qsizetype decodeSse(const uchar *in, qsizetype size, uchar *out)
+{
+    uchar *start = out;
+    DecodeState state;
+    qsizetype pos = 0;
+
+    // 输出每次写 16 字节、前进 12 字节；剩余输入不少于 32 时输出缓冲区一定有余量
+    while (size - pos >= 32) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + pos));
+        if (decodeLookupSse(v)) {
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out), decodePackSse(v));
+            out += 12;
+            pos += 16;
+            continue;
+        }
+        // 块内有空白或 '='：用标量处理这一段，对齐后回到向量路径
+        if (!decodeScalar(in, pos, size, out, state, pos + 16, true)) return -1;
+        if (state.padded) break;
+    }
+
+    if (!decodeScalar(in, pos, size, out, state)) return -1;
+    if (!finishDecode(out, state)) return -1;
+    return out - start;
+}
+
+// ---------- AVX2 实现（32 字符 <-> 24 字节） ----------
+
+BASE64_TARGET("avx2")
+qsizetype encodeAvx2(const uchar *in, qsizetype size, char *out)
+{
+    char *start = out;
+    qsizetype i = 0;
+
+    const __m256i shuffle = _mm256_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+                                             1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+    const __m256i shiftLut = _mm256_setr_epi8(
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+
+    // 两个 128 位通道各处理 12 字节，第二次读取从 +12 开始，共需 28 字节
+    for (; i + 28 <= size; i += 24) {
+        __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+        __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i + 12));
+        __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+
+        v = _mm256_shuffle_epi8(v, shuffle);
+        const __m256i t0 = _mm256_and_si256(v, _mm256_set1_epi32(0x0fc0fc00));
+        const __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+        const __m256i t2 = _mm256_and_si256(v, _mm256_set1_epi32(0x003f03f0));
+        const __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+        const __m256i indices = _mm256_or_si256(t1, t3);
+
+        __m256i result = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+        const __m256i less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+        result = _mm256_or_si256(result, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+        result = _mm256_add_epi8(_mm256_shuffle_epi8(shiftLut, result), indices);
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out), result);
+        out += 32;
+    }
+    out += encodeScalar(in + i, size - i, out);
+    return out - start;
+}
+
+BASE64_TARGET("avx2")
+qsizetype decodeAvx2(const uchar *in, qsizetype size, uchar *out)
+{
+    uchar *start = out;
+    DecodeState state;
+    qsizetype pos = 0;
+
+    const __m256i lutLo = _mm256_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                           0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a,
+                                           0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                           0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+    const __m256i lutHi = _mm256_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                           0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+                                           0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                           0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m256i lutRoll = _mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71,
+                                             0, 0, 0, 0, 0, 0, 0, 0,
+                                             0, 16, 19, 4, -65, -65, -71, -71,
+                                             0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i mask2F = _mm256_set1_epi8(0x2f);
+    const __m256i packShuffle = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                                                 2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    const __m256i packPermute = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, -1, -1);
+
+    // 输出每次写 32 字节、前进 24 字节；剩余输入不少于 64 时输出缓冲区一定有余量
+    while (size - pos >= 64) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(in + pos));
+
+        const __m256i hiNibbles = _mm256_and_si256(_mm256_srli_epi32(v, 4), mask2F);
+        const __m256i loNibbles = _mm256_and_si256(v, mask2F);
+        const __m256i lo = _mm256_shuffle_epi8(lutLo, loNibbles);
+        const __m256i eq2F = _mm256_cmpeq_epi8(v, mask2F);
+        const __m256i hi = _mm256_shuffle_epi8(lutHi, hiNibbles);
+
+        if (_mm256_testz_si256(lo, hi)) {
+            const __m256i roll = _mm256_shuffle_epi8(lutRoll, _mm256_add_epi8(eq2F, hiNibbles));
+            v = _mm256_add_epi8(v, roll);
+            const __m256i mergeAbBc = _mm256_maddubs_epi16(v, _mm256_set1_epi32(0x01400140));
+            __m256i merged = _mm256_madd_epi16(mergeAbBc, _mm256_set1_epi32(0x00011000));
+            merged = _mm256_shuffle_epi8(merged, packShuffle);
+            merged = _mm256_permutevar8x32_epi32(merged, packPermute);
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(out), merged);
+            out += 24;
+            pos += 32;
+            continue;
+        }
+        // 块内有空白或 '='：用标量处理这一段，对齐后回到向量路径
+        if (!decodeScalar(in, pos, size, out, state, pos + 32, true)) return -1;
+        if (state.padded) break;
+    }
+
+    // 剩余部分交给 SSE 路径的块处理不划算，直接标量收尾
+    if (!decodeScalar(in, pos, size, out, state)) return -1;
+    if (!finishDecode(out, state)) return -1;
+    return out - start;
+}
+
+#endif // BASE64_HAVE_X86_SIMD
+
+qsizetype decodeScalarAll(const uchar *in, qsizetype size, uchar *out)
+{
+    uchar *start = out;
+    DecodeState state;
+    qsizetype pos = 0;
+    if (!decodeScalar(in, pos, size, out, state)) return -1;
+    if (!finishDecode(out, state)) return -1;
+    return out - start;
+}
+
+Base64Codec::Implementation detectImplementation()
+{
+#ifdef BASE64_HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return Base64Codec::Avx2;
+    if (__builtin_cpu_supports("sse4.1")) return Base64Codec::Sse41;
+#endif
+    return Base64Codec::Scalar;
+}
+
+Base64Codec::Implementation supportedImplementation()
+{
+    static const Base64Codec::Implementation detected = detectImplementation();
+    return detected;
+}
+
+std::atomic<int> currentImplementation{-1};
+
+} // namespace
+
+Base64Codec::Implementation Base64Codec::implementation()
+{
+    int impl = currentImplementation.load(std::memory_order_relaxed);
+    if (impl < 0) {
+        impl = supportedImplementation();
+        currentImplementation.store(impl, std::memory_order_relaxed);
+    }
+    return Implementation(impl);
+}
+
+void Base64Codec::setImplementation(Implementation impl)
+{
+    // 不支持的指令集退回到检测到的最佳实现之下
+    if (impl > supportedImplementation()) impl = supportedImplementation();
+    currentImplementation.store(impl, std::memory_order_relaxed);
+}
+
+const char *Base64Codec::implementationName(Implementation impl)
+{
+    switch (impl) {
+    case Avx2: return "AVX2";
+    case Sse41: return "SSE4.1";
+    default: return "Scalar";
+    }
+}
+
+qsizetype Base64Codec::encode(const char *in, qsizetype size, char *out)
+{
+    const uchar *data = reinterpret_cast<const uchar *>(in);
+    switch (implementation()) {
+#ifdef BASE64_HAVE_X86_SIMD
+    case Avx2: return encodeAvx2(data, size, out);
+    case Sse41: return encodeSse(data, size, out);
+#endif
+    default: return encodeScalar(data, size, out);
+    }
+}
+
+qsizetype Base64Codec::decode(const char *in, qsizetype size, char *out)
+{
+    const uchar *data = reinterpret_cast<const uchar *>(in);
+    uchar *dest = reinterpret_cast<uchar *>(out);
+    switch (implementation()) {
+#ifdef BASE64_HAVE_X86_SIMD
+    case Avx2: return decodeAvx2(data, size, dest);
+    case Sse41: return decodeSse(data, size, dest);
+#endif
+    default: return decodeScalarAll(data, size, dest);
+    }
+}
+
+QByteArray Base64Codec::encode(QByteArrayView data)
+{
+    QByteArray result(encodedLength(data.size()), Qt::Uninitialized);
+    qsizetype written = encode(data.data(), data.size(), result.data());
+    result.resize(written);
+    return result;
+}
+
+QByteArray Base64Codec::decode(QByteArrayView base64, bool *ok)
+{
+    QByteArray result(maxDecodedLength(base64.size()), Qt::Uninitialized);
+    qsizetype written = decode(base64.data(), base64.size(), result.data());
+    if (ok) *ok = written >= 0;
+    if (written < 0) return QByteArray();
+    result.resize(written);
+    return result;
+}
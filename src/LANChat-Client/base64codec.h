@@ -0,0 +1,37 @@
+#ifndef BASE64CODEC_H
+#define BASE64CODEC_H
+
+#include <QByteArray>
+#include <QByteArrayView>
+
+// JSON 协议中 file_chunk / file_base64 负载使用的 Base64 编解码
+// x86 上运行时选择 AVX2 或 SSE4.1 实现，其他平台使用标量实现
+// 解码时在同一遍扫描中跳过空白字符，直接写入目标缓冲区
+class Base64Codec
+{
+public:
+    enum Implementation {
+        Scalar,
+        Sse41,
+        Avx2
+    };
+
+    static qsizetype encodedLength(qsizetype size) { return (size + 2) / 3 * 4; }
+    static qsizetype maxDecodedLength(qsizetype size) { return size / 4 * 3 + 3; }
+
+    // 编码 size 字节到 out（至少 encodedLength(size) 字节），返回写入的字节数
+    static qsizetype encode(const char *in, qsizetype size, char *out);
+    // 解码到 out（至少 maxDecodedLength(size) 字节），跳过空白字符，
+    // 允许缺少末尾的 '='；输入非法时返回 -1
+    static qsizetype decode(const char *in, qsizetype size, char *out);
+
+    static QByteArray encode(QByteArrayView data);
+    static QByteArray decode(QByteArrayView base64, bool *ok = nullptr);
+
+    // 当前使用的实现，可以强制指定（用于基准测试），不支持的实现会退回标量
+    static Implementation implementation();
+    static void setImplementation(Implementation impl);
+    static const char *implementationName(Implementation impl);
+};
+
+#endif // BASE64CODEC_H
@@ -0,0 +1,19 @@
+# base64bench.pro
+# Base64 编解码基准：Qt 自带实现（含正则清理空白）与 Base64Codec 各实现对比
+QT       += core
+QT       -= gui
+
+CONFIG += c++17 console release
+CONFIG -= app_bundle
+
+INCLUDEPATH += $$PWD/../..
+
+SOURCES += \
+    ../../base64codec.cpp \
+    main.cpp
+
+HEADERS += \
+    ../../base64codec.h
+
+TARGET = base64bench
+TEMPLATE = app
@@ -0,0 +1,104 @@
+#include "base64codec.h"
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QRandomGenerator>
+#include <QRegularExpression>
+#include <QString>
+#include <cstdio>
+
+// 对比客户端原先的 Base64 路径与 Base64Codec：
+//   Qt      - toBase64 + 去换行 / 正则去空白 + fromBase64
+//   Codec   - Base64Codec 的标量、SSE4.1、AVX2 实现
+// 分别测试单个 50KB 分块（file_chunk）和 50MB 整个文件（file_base64）
+
+namespace {
+
+QByteArray randomData(qsizetype size)
+{
+    QByteArray data(size, Qt::Uninitialized);
+    QRandomGenerator generator(12345);
+    for (qsizetype i = 0; i < size; ++i) data[i] = char(generator.bounded(256));
+    return data;
+}
+
+double throughput(qsizetype bytes, int rounds, qint64 nsecs)
+{
+    return double(bytes) * rounds / (1024.0 * 1024.0) / (double(nsecs) / 1e9);
+}
+
+void report(const char *name, qsizetype bytes, int rounds, qint64 encodeNs, qint64 decodeNs)
+{
+    std::printf("  %-8s encode %8.1f MB/s   decode %8.1f MB/s\n", name,
+                throughput(bytes, rounds, encodeNs), throughput(bytes, rounds, decodeNs));
+}
+
+void benchQt(const QByteArray &data, int rounds)
+{
+    QElapsedTimer timer;
+    QString encoded;
+    timer.start();
+    for (int i = 0; i < rounds; ++i) {
+        encoded = QString::fromLatin1(data.toBase64());
+        encoded = encoded.replace("\n", "").replace("\r", "");
+    }
+    qint64 encodeNs = timer.nsecsElapsed();
+
+    QByteArray decoded;
+    timer.restart();
+    for (int i = 0; i < rounds; ++i) {
+        QString cleaned = encoded;
+        cleaned = cleaned.replace(QRegularExpression("\\s+"), "");
+        decoded = QByteArray::fromBase64(cleaned.toUtf8());
+    }
+    qint64 decodeNs = timer.nsecsElapsed();
+
+    if (decoded != data) std::printf("  Qt 解码结果不一致\n");
+    report("Qt", data.size(), rounds, encodeNs, decodeNs);
+}
+
+void benchCodec(Base64Codec::Implementation impl, const QByteArray &data, int rounds)
+{
+    Base64Codec::setImplementation(impl);
+    if (Base64Codec::implementation() != impl) {
+        std::printf("  %-8s 当前 CPU 不支持，跳过\n", Base64Codec::implementationName(impl));
+        return;
+    }
+
+    QElapsedTimer timer;
+    QString encoded;
+    timer.start();
+    for (int i = 0; i < rounds; ++i) {
+        encoded = QString::fromLatin1(Base64Codec::encode(data));
+    }
+    qint64 encodeNs = timer.nsecsElapsed();
+
+    QByteArray decoded;
+    bool ok = false;
+    timer.restart();
+    for (int i = 0; i < rounds; ++i) {
+        decoded = Base64Codec::decode(encoded.toLatin1(), &ok);
+    }
+    qint64 decodeNs = timer.nsecsElapsed();
+
+    if (!ok || decoded != data) std::printf("  %s 解码结果不一致\n", Base64Codec::implementationName(impl));
+    report(Base64Codec::implementationName(impl), data.size(), rounds, encodeNs, decodeNs);
+}
+
+void runCase(const char *title, qsizetype size, int rounds)
+{
+    std::printf("%s (%lld 字节 x %d 次)\n", title, static_cast<long long>(size), rounds);
+    QByteArray data = randomData(size);
+    benchQt(data, rounds);
+    benchCodec(Base64Codec::Scalar, data, rounds);
+    benchCodec(Base64Codec::Sse41, data, rounds);
+    benchCodec(Base64Codec::Avx2, data, rounds);
+}
+
+} // namespace
+
+int main()
+{
+    runCase("file_chunk 分块", 50 * 1024, 2000);
+    runCase("file_base64 整个文件", 50 * 1024 * 1024, 3);
+    return 0;
+}
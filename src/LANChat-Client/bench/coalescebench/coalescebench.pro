@@ -0,0 +1,21 @@
+# coalescebench.pro
+# 发送合并基准：每条消息的套接字写入次数和交给系统的次数（约等于 send 系统调用）
+QT       += core network
+QT       -= gui
+
+CONFIG += c++17 console release
+CONFIG -= app_bundle
+
+INCLUDEPATH += $$PWD/../..
+
+SOURCES += \
+    ../../framecodec.cpp \
+    ../../outboundscheduler.cpp \
+    main.cpp
+
+HEADERS += \
+    ../../framecodec.h \
+    ../../outboundscheduler.h
+
+TARGET = coalescebench
+TEMPLATE = app
@@ -0,0 +1,113 @@
+#include "framecodec.h"
+#include "outboundscheduler.h"
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <cstdio>
+
+// 在本机的一对 TCP 连接上发送聊天消息大小的帧，比较三种写法：
+//   逐条flush - 每条消息 write + flush，每条都立即进入 send 系统调用
+//   逐帧写入  - 合并之前的发送调度：每帧一次 QTcpSocket::write，由 Qt 缓冲到下一轮事件循环
+//   合并写入  - 现在的发送调度：同一轮事件循环入队的帧合并成一次 write
+// 每轮事件循环入队 burst 条消息，统计每条消息的 write 调用次数和 bytesWritten 次数
+// （每次 bytesWritten 对应 Qt 的一次 send 系统调用），以及每条消息的耗时
+
+namespace {
+
+enum Mode {
+    FlushEach,
+    PerFrame,
+    Coalesced
+};
+
+const char *modeName(Mode mode)
+{
+    switch (mode) {
+    case FlushEach: return "逐条flush";
+    case PerFrame: return "逐帧写入";
+    case Coalesced: return "合并写入";
+    }
+    return "";
+}
+
+QByteArray chatFrame()
+{
+    QJsonObject message;
+    message["type"] = "text";
+    message["sender"] = "bench";
+    message["content"] = "今天下午三点开会，别忘了带上周的报表";
+    message["timestamp"] = "2024-01-01 15:00:00";
+    return FrameEncoder::encode(MessageFrame, 0, QJsonDocument(message).toJson(QJsonDocument::Compact));
+}
+
+void run(Mode mode, int burst, int total)
+{
+    QTcpServer server;
+    QTcpSocket client;
+    if (!server.listen(QHostAddress::LocalHost, 0)) {
+        std::printf("  无法监听本机端口\n");
+        return;
+    }
+    client.connectToHost(QHostAddress::LocalHost, server.serverPort());
+    if (!client.waitForConnected(3000) || !server.waitForNewConnection(3000)) {
+        std::printf("  无法建立本机连接\n");
+        return;
+    }
+    QTcpSocket *peer = server.nextPendingConnection();
+
+    qint64 received = 0;
+    QObject::connect(peer, &QTcpSocket::readyRead, [&]() { received += peer->readAll().size(); });
+    quint64 flushes = 0;
+    QObject::connect(&client, &QTcpSocket::bytesWritten, [&]() { flushes++; });
+
+    OutboundScheduler scheduler(&client);
+    scheduler.setCoalescing(mode == Coalesced);
+
+    const QByteArray frame = chatFrame();
+    const qint64 expected = qint64(frame.size()) * total;
+    quint64 writes = 0;
+
+    QElapsedTimer timer;
+    timer.start();
+    for (int queued = 0; queued < total; queued += burst) {
+        for (int i = 0; i < burst; ++i) {
+            if (mode == FlushEach) {
+                client.write(frame);
+                client.flush();
+                writes++;
+            } else {
+                scheduler.enqueue(OutboundScheduler::Interactive, frame);
+            }
+        }
+        QCoreApplication::processEvents();  // 一轮事件循环
+    }
+    while (received < expected) {
+        QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents, 10);
+    }
+    qint64 nsecs = timer.nsecsElapsed();
+    if (mode != FlushEach) writes = scheduler.writeCount();
+
+    std::printf("  %-10s write %6.3f 次/条   send %6.3f 次/条   %7.2f us/条\n", modeName(mode),
+                double(writes) / total, double(flushes) / total, double(nsecs) / 1000.0 / total);
+    delete peer;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    const int total = 20000;
+    for (int burst : {1, 10, 100}) {
+        std::printf("每轮事件循环 %d 条消息（共 %d 条，每帧 %lld 字节）\n", burst, total,
+                    static_cast<long long>(chatFrame().size()));
+        run(FlushEach, burst, total);
+        run(PerFrame, burst, total);
+        run(Coalesced, burst, total);
+    }
+    return 0;
+}
@@ -0,0 +1,220 @@
+#include "blobcache.h"
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QDebug>
+#include <algorithm>
+#include <filesystem>
+#include <system_error>
+
+BlobCache::BlobCache(qint64 maxBytes)
+    : directory(QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/blobs")
+    , maxBytes(maxBytes)
+    , usedBytes(0)
+{
+    QDir().mkpath(directory);
+}
+
+QString BlobCache::blobPath(const QString &sha256) const
+{
+    return directory + "/" + sha256;
+}
+
+void BlobCache::load()
+{
+    QFile file(directory + "/index.json");
+    if (!file.open(QIODevice::ReadOnly)) return;
+
+    const QJsonArray array = QJsonDocument::fromJson(file.readAll()).array();
+    for (const QJsonValue &value : array) {
+        QJsonObject obj = value.toObject();
+        Entry entry;
+        entry.sha256 = obj["sha256"].toString();
+        entry.size = obj["size"].toVariant().toLongLong();
+        entry.lastUsed = QDateTime::fromMSecsSinceEpoch(obj["last_used"].toVariant().toLongLong());
+        entry.savedPath = obj["saved_path"].toString();
+        // 缓存文件被手动删除时丢弃条目
+        if (entry.sha256.isEmpty() || QFileInfo(blobPath(entry.sha256)).size() != entry.size) continue;
+        entries.insert(entry.sha256, entry);
+        usedBytes += entry.size;
+    }
+    evict();
+}
+
+void BlobCache::save() const
+{
+    QJsonArray array;
+    for (const Entry &entry : entries) {
+        QJsonObject obj;
+        obj["sha256"] = entry.sha256;
+        obj["size"] = entry.size;
+        obj["last_used"] = entry.lastUsed.toMSecsSinceEpoch();
+        obj["saved_path"] = entry.savedPath;
+        array.append(obj);
+    }
+
+    QSaveFile file(directory + "/index.json");
+    if (!file.open(QIODevice::WriteOnly)) return;
+    file.write(QJsonDocument(array).toJson(QJsonDocument::Compact));
+    if (!file.commit()) {
+        qDebug() << "保存文件缓存索引失败:" << file.errorString();
+    }
+}
+
+void BlobCache::setMaxBytes(qint64 bytes)
+{
+    maxBytes = bytes;
+    if (usedBytes > maxBytes) {
+        evict();
+        save();
+    }
+}
+
+bool BlobCache::insert(const QString &sha256, const QString &filePath)
+{
+    if (sha256.isEmpty()) return false;
+
+    QFileInfo info(filePath);
+    auto it = entries.find(sha256);
+    if (it != entries.end()) {
+        it->lastUsed = QDateTime::currentDateTime();
+        it->savedPath = info.absoluteFilePath();
+        save();
+        return true;
+    }
+    if (info.size() > maxBytes) return false;
+
+    QString path = blobPath(sha256);
+    QFile::remove(path);
+    if (!linkOrCopy(filePath, path)) {
+        qDebug() << "加入文件缓存失败:" << filePath;
+        return false;
+    }
+
+    Entry entry;
+    entry.sha256 = sha256;
+    entry.size = info.size();
+    entry.lastUsed = QDateTime::currentDateTime();
+    entry.savedPath = info.absoluteFilePath();
+    entries.insert(sha256, entry);
+    usedBytes += entry.size;
+
+    evict();
+    save();
+    return true;
+}
+
+BlobCache::Lookup BlobCache::lookup(const QString &sha256) const
+{
+    Lookup result;
+    result.sha256 = sha256;
+    auto it = entries.constFind(sha256);
+    if (it == entries.constEnd()) return result;
+    result.size = it->size;
+    result.blobPath = blobPath(sha256);
+    result.savedPath = it->savedPath;
+    return result;
+}
+
+void BlobCache::verify(Lookup &lookup, bool checkBlob)
+{
+    // 硬链接与保存的文件共享内容，用户改动过保存的文件后缓存也随之失效，因此使用前校验
+    if (checkBlob && !lookup.blobPath.isEmpty()) {
+        lookup.blobIntact = QFileInfo(lookup.blobPath).size() == lookup.size &&
+                            hashFile(lookup.blobPath) == lookup.sha256;
+    }
+
+    if (lookup.savedPath.isEmpty()) return;
+    QFileInfo saved(lookup.savedPath);
+    if (!saved.exists() || saved.size() != lookup.size) return;
+    if (checkBlob && sameFile(lookup.blobPath, lookup.savedPath)) {
+        lookup.savedIntact = lookup.blobIntact;
+        return;
+    }
+    lookup.savedIntact = hashFile(lookup.savedPath) == lookup.sha256;
+}
+
+QString BlobCache::materialize(const Lookup &lookup, const QString &targetPath)
+{
+    auto it = entries.find(lookup.sha256);
+    if (lookup.blobPath.isEmpty() || it == entries.end()) return QString();
+
+    if (!lookup.blobIntact) {
+        qDebug() << "文件缓存内容已变化，丢弃:" << lookup.sha256;
+        remove(lookup.sha256);
+        save();
+        return QString();
+    }
+
+    QString result = lookup.savedIntact ? lookup.savedPath : QString();
+    if (result.isEmpty()) {
+        if (!linkOrCopy(lookup.blobPath, targetPath)) return QString();
+        result = targetPath;
+    }
+
+    it->lastUsed = QDateTime::currentDateTime();
+    it->savedPath = QFileInfo(result).absoluteFilePath();
+    save();
+    return result;
+}
+
+void BlobCache::remove(const QString &sha256)
+{
+    auto it = entries.find(sha256);
+    if (it == entries.end()) return;
+    usedBytes -= it->size;
+    QFile::remove(blobPath(sha256));
+    entries.erase(it);
+}
+
+// 从最久未使用的开始删除，直到总大小回到上限以内
+void BlobCache::evict()
+{
+    if (usedBytes <= maxBytes) return;
+
+    QList<Entry> byAge = entries.values();
+    std::sort(byAge.begin(), byAge.end(), [](const Entry &a, const Entry &b) {
+        return a.lastUsed < b.lastUsed;
+    });
+    for (const Entry &entry : std::as_const(byAge)) {
+        if (usedBytes <= maxBytes) break;
+        remove(entry.sha256);
+    }
+}
+
+// 同一文件系统上创建硬链接，失败（跨文件系统等）时复制
+bool BlobCache::linkOrCopy(const QString &from, const QString &to)
+{
+    std::error_code error;
+    std::filesystem::create_hard_link(std::filesystem::path(from.toStdU16String()),
+                                      std::filesystem::path(to.toStdU16String()), error);
+    if (!error) return true;
+    return QFile::copy(from, to);
+}
+
+bool BlobCache::sameFile(const QString &a, const QString &b)
+{
+    std::error_code error;
+    return std::filesystem::equivalent(std::filesystem::path(a.toStdU16String()),
+                                       std::filesystem::path(b.toStdU16String()), error) && !error;
+}
+
+QString BlobCache::hashFile(const QString &path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) return QString();
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    if (!hash.addData(&file)) return QString();
+    return QString::fromLatin1(hash.result().toHex());
+}
+
+QString BlobCache::hashData(QByteArrayView data)
+{
+    return QString::fromLatin1(QCryptographicHash::hash(data, QCryptographicHash::Sha256).toHex());
+}
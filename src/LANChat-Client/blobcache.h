@@ -0,0 +1,71 @@
+#ifndef BLOBCACHE_H
+#define BLOBCACHE_H
+
+#include <QString>
+#include <QHash>
+#include <QDateTime>
+#include <QByteArrayView>
+
+// 按内容寻址的本地文件缓存，保存在应用数据目录的 blobs/ 下，文件名为 SHA-256
+// 收到 file_offer 时如果缓存中已有同样内容，直接从缓存放到保存目录，不再传输
+// 缓存总大小超过上限时按最近使用时间淘汰；同一文件系统上使用硬链接，不占额外空间
+class BlobCache
+{
+public:
+    explicit BlobCache(qint64 maxBytes = DefaultMaxBytes);
+
+    void load();
+
+    bool contains(const QString &sha256) const { return entries.contains(sha256); }
+    qint64 totalBytes() const { return usedBytes; }
+    void setMaxBytes(qint64 bytes);
+
+    // 已保存的文件加入缓存，超过容量时按最近使用时间淘汰
+    bool insert(const QString &sha256, const QString &filePath);
+
+    // 条目的快照：在 GUI 线程用 lookup() 取出，在工作线程中用 verify() 校验内容，
+    // verify() 只读文件，不访问缓存本身
+    struct Lookup {
+        QString sha256;
+        qint64 size = 0;
+        QString blobPath;           // 为空表示缓存中没有这个内容
+        QString savedPath;          // 最近一次放到保存目录的位置
+        bool blobIntact = false;    // 以下两项由 verify() 填写
+        bool savedIntact = false;
+    };
+    Lookup lookup(const QString &sha256) const;
+    // 计算哈希校验：checkBlob 时校验缓存文件，保存的文件与缓存是同一个文件（硬链接）时不再计算第二次
+    static void verify(Lookup &lookup, bool checkBlob);
+
+    // 按 verify(lookup, true) 的结果把内容放到保存目录并返回路径：上次保存的文件仍然完好时直接复用，
+    // 否则在 saveDir 中新建（硬链接或复制）；缓存文件校验失败时删除该条目并返回空
+    QString materialize(const Lookup &lookup, const QString &targetPath);
+
+    // 十六进制 SHA-256，读取失败时返回空
+    static QString hashFile(const QString &path);
+    static QString hashData(QByteArrayView data);
+
+    static constexpr qint64 DefaultMaxBytes = 1024LL * 1024 * 1024;
+
+private:
+    struct Entry {
+        QString sha256;
+        qint64 size = 0;
+        QDateTime lastUsed;
+        QString savedPath;      // 最近一次放到保存目录的位置
+    };
+
+    QString blobPath(const QString &sha256) const;
+    void remove(const QString &sha256);
+    void evict();
+    void save() const;
+    static bool linkOrCopy(const QString &from, const QString &to);
+    static bool sameFile(const QString &a, const QString &b);
+
+    QString directory;
+    qint64 maxBytes;
+    qint64 usedBytes;
+    QHash<QString, Entry> entries;
+};
+
+#endif // BLOBCACHE_H
@@ -0,0 +1,906 @@
+#include "chattimeline.h"
+#include <QApplication>
+#include <QClipboard>
+#include <QContextMenuEvent>
+#include <QDataStream>
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QKeyEvent>
+#include <QMenu>
+#include <QMouseEvent>
+#include <QPainter>
+#include <QPainterPath>
+#include <QScrollBar>
+#include <QStandardPaths>
+#include <QTemporaryFile>
+#include <QTextLayout>
+#include <QtMath>
+#include <limits>
+
+// ---------------------------------------------------------------- 模型
+
+namespace {
+
+// QDataStream 不保存 devicePixelRatio，按显示尺寸恢复
+void restorePixelRatio(ChatEntry &entry)
+{
+    if (!entry.thumbnail.isNull() && entry.thumbnailSize.width() > 0) {
+        entry.thumbnail.setDevicePixelRatio(qreal(entry.thumbnail.width()) / entry.thumbnailSize.width());
+    }
+}
+
+QDataStream &operator<<(QDataStream &out, const ChatEntry &entry)
+{
+    out << qint32(entry.kind) << entry.sender << entry.text << entry.fileName << entry.filePath
+        << entry.fileSize << entry.thumbnail << entry.thumbnailSize << entry.thumbnailId << entry.time << entry.self << entry.isPrivate;
+    return out;
+}
+
+QDataStream &operator>>(QDataStream &in, ChatEntry &entry)
+{
+    qint32 kind = 0;
+    in >> kind >> entry.sender >> entry.text >> entry.fileName >> entry.filePath
+       >> entry.fileSize >> entry.thumbnail >> entry.thumbnailSize >> entry.thumbnailId >> entry.time >> entry.self >> entry.isPrivate;
+    entry.kind = ChatEntry::Kind(kind);
+    restorePixelRatio(entry);
+    return in;
+}
+
+} // namespace
+
+ChatTimelineModel::ChatTimelineModel(QObject *parent)
+    : QAbstractListModel(parent)
+    , spilledRows(0)
+    , residentLimit(DefaultMemoryRows)
+    , spill(nullptr)
+{
+}
+
+ChatTimelineModel::~ChatTimelineModel()
+{
+    delete spill;
+}
+
+int ChatTimelineModel::rowCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : spilledRows + recent.size();
+}
+
+QVariant ChatTimelineModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || index.row() >= rowCount()) return QVariant();
+    if (role != EntryRole && role != Qt::DisplayRole && role != Qt::ToolTipRole) return QVariant();
+    const ChatEntry *item = lookup(index.row());
+    if (!item) return QVariant();
+
+    switch (role) {
+    case EntryRole:
+        return QVariant::fromValue(*item);
+    case Qt::DisplayRole:
+        return item->kind == ChatEntry::File || item->kind == ChatEntry::Image ? item->fileName : item->text;
+    case Qt::ToolTipRole:
+        return item->filePath.isEmpty() ? QVariant() : QVariant(item->filePath);
+    default:
+        return QVariant();
+    }
+}
+
+ChatEntry ChatTimelineModel::entry(int row) const
+{
+    if (const ChatEntry *item = lookup(row)) return *item;
+    ChatEntry missing;
+    missing.kind = ChatEntry::System;
+    missing.text = "（无法读取较早的记录）";
+    return missing;
+}
+
+void ChatTimelineModel::append(const ChatEntry &entry)
+{
+    int row = rowCount();
+    beginInsertRows(QModelIndex(), row, row);
+    recent.append(entry);
+    if (entry.thumbnailId) pendingThumbnails.insert(entry.thumbnailId, row);
+    endInsertRows();
+
+    // 攒满一页再换出，避免每条消息都写一次盘
+    if (recent.size() >= residentLimit + PageRows) spillOldest();
+}
+
+void ChatTimelineModel::clear()
+{
+    beginResetModel();
+    recent.clear();
+    spilledRows = 0;
+    pageOffsets.clear();
+    pageCache.clear();
+    pendingThumbnails.clear();
+    lateThumbnails.clear();
+    delete spill;
+    spill = nullptr;
+    endResetModel();
+}
+
+void ChatTimelineModel::setMemoryRows(int rows)
+{
+    residentLimit = qMax(int(PageRows), rows);
+    while (recent.size() >= residentLimit + PageRows) {
+        int before = recent.size();
+        spillOldest();
+        if (recent.size() == before) break;   // 段文件不可用
+    }
+}
+
+bool ChatTimelineModel::setThumbnail(quint64 id, const QImage &image)
+{
+    auto it = pendingThumbnails.find(id);
+    if (it == pendingThumbnails.end()) return false;
+    const int row = it.value();
+    pendingThumbnails.erase(it);
+    if (row >= rowCount()) return false;
+
+    if (row < spilledRows) {
+        // 解码完成前已经换出：缩略图追加到段文件末尾，读回这一页时再放进去
+        if (!storeLateThumbnail(row, image)) return false;
+        for (auto &page : pageCache) {
+            if (page.first != row / PageRows || row % PageRows >= page.second.size()) continue;
+            ChatEntry &cached = page.second[row % PageRows];
+            cached.thumbnail = image;
+            cached.thumbnailId = 0;
+            if (!image.isNull()) cached.thumbnailSize = image.deviceIndependentSize().toSize();
+        }
+    } else {
+        ChatEntry &item = recent[row - spilledRows];
+        item.thumbnail = image;
+        item.thumbnailId = 0;
+        if (!image.isNull()) item.thumbnailSize = image.deviceIndependentSize().toSize();
+    }
+    const QModelIndex changed = index(row);
+    emit dataChanged(changed, changed, {EntryRole});
+    return true;
+}
+
+const ChatEntry *ChatTimelineModel::lookup(int row) const
+{
+    if (row < 0 || row >= rowCount()) return nullptr;
+    if (row >= spilledRows) return &recent.at(row - spilledRows);
+
+    const QList<ChatEntry> *page = loadPage(row / PageRows);
+    if (!page || row % PageRows >= page->size()) return nullptr;
+    return &page->at(row % PageRows);
+}
+
+const QList<ChatEntry> *ChatTimelineModel::loadPage(int page) const
+{
+    for (int i = 0; i < pageCache.size(); ++i) {
+        if (pageCache.at(i).first == page) {
+            if (i > 0) pageCache.move(i, 0);
+            return &pageCache.first().second;
+        }
+    }
+
+    if (!spill || page < 0 || page >= pageOffsets.size() || !spill->seek(pageOffsets.at(page))) {
+        return nullptr;
+    }
+    QDataStream in(spill);
+    in.setVersion(QDataStream::Qt_5_15);
+    qint32 count = 0;
+    in >> count;
+    QList<ChatEntry> entries;
+    entries.reserve(count);
+    for (qint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        ChatEntry item;
+        in >> item;
+        entries.append(item);
+    }
+    if (in.status() != QDataStream::Ok) {
+        qWarning() << "读取聊天记录段文件失败，页" << page;
+        return nullptr;
+    }
+
+    // 换出之后才解码完成的缩略图
+    for (qint32 i = 0; i < entries.size(); ++i) {
+        auto late = lateThumbnails.constFind(page * PageRows + i);
+        if (late == lateThumbnails.constEnd() || !spill->seek(late.value())) continue;
+        ChatEntry &item = entries[i];
+        qreal ratio = 1.0;
+        in >> item.thumbnail >> ratio;
+        item.thumbnailId = 0;
+        if (!item.thumbnail.isNull()) {
+            item.thumbnail.setDevicePixelRatio(ratio);
+            item.thumbnailSize = item.thumbnail.deviceIndependentSize().toSize();
+        }
+    }
+
+    pageCache.prepend(qMakePair(page, entries));
+    while (pageCache.size() > CachedPages) pageCache.removeLast();
+    return &pageCache.first().second;
+}
+
+bool ChatTimelineModel::openSpill()
+{
+    if (spill) return true;
+    QString dir = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
+    QDir().mkpath(dir);
+    spill = new QTemporaryFile(dir + "/scrollback-XXXXXX.seg");
+    if (!spill->open()) {
+        qWarning() << "无法创建聊天记录段文件:" << spill->errorString();
+        delete spill;
+        spill = nullptr;
+        return false;
+    }
+    return true;
+}
+
+void ChatTimelineModel::spillOldest()
+{
+    if (!openSpill()) return;   // 写不了盘时全部留在内存中
+
+    qint64 offset = spill->size();
+    if (!spill->seek(offset)) return;
+    QDataStream out(spill);
+    out.setVersion(QDataStream::Qt_5_15);
+    out << qint32(PageRows);
+    // 还在解码的缩略图保留请求号，完成后由 setThumbnail 追加到段文件
+    for (int i = 0; i < PageRows; ++i) out << recent.at(i);
+    if (out.status() != QDataStream::Ok || !spill->flush()) {
+        qWarning() << "写入聊天记录段文件失败:" << spill->errorString();
+        spill->resize(offset);
+        return;
+    }
+
+    // 行号不变，视图中的行高等缓存都仍然有效，不需要通知视图
+    pageOffsets.append(offset);
+    recent.erase(recent.begin(), recent.begin() + PageRows);
+    spilledRows += PageRows;
+}
+
+bool ChatTimelineModel::storeLateThumbnail(int row, const QImage &image)
+{
+    if (!spill) return false;
+    qint64 offset = spill->size();
+    if (!spill->seek(offset)) return false;
+    QDataStream out(spill);
+    out.setVersion(QDataStream::Qt_5_15);
+    out << image << image.devicePixelRatio();
+    if (out.status() != QDataStream::Ok || !spill->flush()) {
+        qWarning() << "写入聊天记录段文件失败:" << spill->errorString();
+        spill->resize(offset);
+        return false;
+    }
+    lateThumbnails.insert(row, offset);
+    return true;
+}
+
+// ---------------------------------------------------------------- 绘制
+
+namespace {
+
+const int RowMargin = 6;        // 行的上下留白
+const int SideMargin = 10;      // 气泡与视图左右边缘的距离
+const int PadX = 12;            // 气泡内边距
+const int PadY = 8;
+const int LineGap = 2;
+const int MaxMediaWidth = 300;  // 文件和图片气泡的最大宽度
+const int PlaceholderWidth = 160;   // 读不出图片尺寸时占位框的大小
+const int PlaceholderHeight = 120;
+
+QFont scaledFont(const QFont &base, qreal factor, bool bold = false)
+{
+    QFont font = base;
+    if (font.pointSizeF() > 0) {
+        font.setPointSizeF(font.pointSizeF() * factor);
+    } else {
+        font.setPixelSize(qMax(1, qRound(font.pixelSize() * factor)));
+    }
+    font.setBold(bold);
+    return font;
+}
+
+// 按宽度折行，返回排版后的尺寸；layout 留给调用方绘制
+QSizeF wrapText(QTextLayout &layout, qreal width)
+{
+    QTextOption option;
+    option.setWrapMode(QTextOption::WrapAtWordBoundaryOrAnywhere);
+    layout.setTextOption(option);
+    layout.beginLayout();
+    qreal height = 0;
+    qreal natural = 0;
+    for (;;) {
+        QTextLine line = layout.createLine();
+        if (!line.isValid()) break;
+        line.setLineWidth(width);
+        line.setPosition(QPointF(0, height));
+        height += line.height();
+        natural = qMax(natural, line.naturalTextWidth());
+    }
+    layout.endLayout();
+    return QSizeF(natural, height);
+}
+
+QString layoutText(const QString &text)
+{
+    QString copy = text;
+    return copy.replace(QLatin1Char('\n'), QChar::LineSeparator);
+}
+
+QColor textColor(const ChatEntry &entry)
+{
+    if (!entry.isPrivate) return QColor("#333");
+    return entry.kind == ChatEntry::Text && !entry.self ? QColor("#4CAF50") : QColor("#049e04");
+}
+
+QString fileIcon(const QString &fileName)
+{
+    QString fileExtension = QFileInfo(fileName).suffix().toLower();
+    if (fileExtension == "mp4" || fileExtension == "avi" || fileExtension == "mkv" ||
+        fileExtension == "mov" || fileExtension == "wmv") {
+        return "🎬";
+    } else if (fileExtension == "mp3" || fileExtension == "wav" || fileExtension == "flac" ||
+               fileExtension == "ogg") {
+        return "🎵";
+    } else if (fileExtension == "jpg" || fileExtension == "jpeg" || fileExtension == "png" ||
+               fileExtension == "bmp" || fileExtension == "gif") {
+        return "🖼️";
+    } else if (fileExtension == "pdf") {
+        return "📄";
+    } else if (fileExtension == "doc" || fileExtension == "docx") {
+        return "📝";
+    } else if (fileExtension == "zip" || fileExtension == "rar" || fileExtension == "7z") {
+        return "📦";
+    }
+    return "📎";
+}
+
+QString formatSize(qint64 bytes)
+{
+    const QStringList units = {"B", "KB", "MB", "GB", "TB"};
+    int unitIndex = 0;
+    double size = bytes;
+    while (size >= 1024 && unitIndex < units.size() - 1) {
+        size /= 1024;
+        unitIndex++;
+    }
+    return QString("%1 %2").arg(size, 0, 'f', 2).arg(units[unitIndex]);
+}
+
+QString footerText(const ChatEntry &entry)
+{
+    return entry.kind == ChatEntry::Image && !entry.self ? QString("接收时间: %1").arg(entry.time) : entry.time;
+}
+
+} // namespace
+
+// 一条记录的排版结果，sizeHint、paint 和 linkAt 共用
+struct ChatTimelineDelegate::Geometry {
+    int height = 0;
+    QRect bubble;       // 气泡，系统提示没有
+    QRect header;       // 他人消息上方的 [发送者]
+    QRect footer;       // 时间，自己的消息前面加 [我]
+    QRect content;      // 气泡内的内容区，系统提示为居中的文字
+    QRect image;        // 图片缩略图
+    QRect link;         // 可点击的文件名或"点击下载"
+    int lineHeights[4] = {0, 0, 0, 0};  // 文件气泡的各行高度
+};
+
+ChatTimelineDelegate::ChatTimelineDelegate(QObject *parent)
+    : QStyledItemDelegate(parent)
+{
+}
+
+ChatTimelineDelegate::Geometry ChatTimelineDelegate::layoutEntry(const QStyleOptionViewItem &option,
+                                                                 const ChatEntry &entry) const
+{
+    Geometry g;
+    const QRect r = option.rect;
+    const int width = qMax(r.width(), 2 * SideMargin + 2 * PadX + 40);
+    const QFont base = option.font;
+    const QFontMetrics smallFm(scaledFont(base, 0.85));
+    int y = r.top() + RowMargin;
+
+    if (entry.kind == ChatEntry::System) {
+        QTextLayout layout(layoutText("[系统]" + entry.text), scaledFont(base, 0.9));
+        QSizeF size = wrapText(layout, width * 0.8);
+        int w = qCeil(size.width());
+        g.content = QRect(r.left() + (width - w) / 2, y, w, qCeil(size.height()));
+        y += g.content.height();
+        g.footer = QRect(r.left() + SideMargin, y, width - 2 * SideMargin,
+                         QFontMetrics(scaledFont(base, 0.75)).height());
+        y += g.footer.height();
+        g.height = y + RowMargin - r.top();
+        return g;
+    }
+
+    if (!entry.self) {
+        g.header = QRect(r.left() + SideMargin, y, width - 2 * SideMargin, smallFm.height());
+        y += g.header.height() + LineGap;
+    }
+
+    const int maxInner = qMax(40, int(width * 0.7) - 2 * PadX);
+    const int mediaInner = qMin(maxInner, MaxMediaWidth - 2 * PadX);
+    QSize inner;
+
+    switch (entry.kind) {
+    case ChatEntry::Text: {
+        QTextLayout layout(layoutText(entry.text), base);
+        QSizeF size = wrapText(layout, maxInner);
+        inner = QSize(qMax(1, qCeil(size.width())), qCeil(size.height()));
+        break;
+    }
+    case ChatEntry::File: {
+        QFontMetrics iconFm(scaledFont(base, 1.4));
+        QFontMetrics nameFm(scaledFont(base, 1.0, true));
+        g.lineHeights[0] = iconFm.height();
+        g.lineHeights[1] = nameFm.height();
+        g.lineHeights[2] = smallFm.height();
+        g.lineHeights[3] = smallFm.height();
+        int w = qMax(nameFm.horizontalAdvance(entry.fileName),
+                     smallFm.horizontalAdvance("📏 大小: " + formatSize(entry.fileSize)));
+        inner = QSize(qMin(mediaInner, qMax(w, smallFm.horizontalAdvance("💾 点击下载"))),
+                      g.lineHeights[0] + g.lineHeights[1] + g.lineHeights[2] + g.lineHeights[3] + 3 * LineGap);
+        break;
+    }
+    case ChatEntry::Image: {
+        QSize thumb = entry.thumbnail.isNull() ? entry.thumbnailSize
+                                                 : entry.thumbnail.deviceIndependentSize().toSize();
+        if (thumb.isEmpty()) thumb = QSize(PlaceholderWidth, PlaceholderHeight);
+        if (thumb.width() > mediaInner) thumb = thumb.scaled(mediaInner, thumb.height(), Qt::KeepAspectRatio);
+        int w = qMax(thumb.width(), qMin(mediaInner, smallFm.horizontalAdvance("🖼️ " + entry.fileName)));
+        inner = QSize(w, thumb.height() + LineGap + 2 * smallFm.height());
+        g.image = QRect(QPoint(0, 0), thumb);
+        break;
+    }
+    case ChatEntry::System:
+        break;
+    }
+
+    const int bubbleWidth = inner.width() + 2 * PadX;
+    const int x = entry.self ? r.left() + width - SideMargin - bubbleWidth : r.left() + SideMargin;
+    g.bubble = QRect(x, y, bubbleWidth, inner.height() + 2 * PadY);
+    g.content = g.bubble.adjusted(PadX, PadY, -PadX, -PadY);
+
+    if (entry.kind == ChatEntry::File) {
+        int linkTop = g.content.top() + g.lineHeights[0] + g.lineHeights[1] + g.lineHeights[2] + 3 * LineGap;
+        g.link = QRect(g.content.left(), linkTop,
+                       qMin(g.content.width(), smallFm.horizontalAdvance("💾 点击下载")), g.lineHeights[3]);
+    } else if (entry.kind == ChatEntry::Image) {
+        g.image.moveTopLeft(g.content.topLeft());
+        g.link = QRect(g.content.left(), g.image.bottom() + 1 + LineGap, g.content.width(), smallFm.height());
+    }
+
+    y = g.bubble.bottom() + 1 + LineGap;
+    g.footer = QRect(r.left() + SideMargin, y, width - 2 * SideMargin, smallFm.height());
+    y += g.footer.height();
+    g.height = y + RowMargin - r.top();
+    return g;
+}
+
+QSize ChatTimelineDelegate::sizeHint(const QStyleOptionViewItem &option, const QModelIndex &index) const
+{
+    ChatEntry entry = index.data(ChatTimelineModel::EntryRole).value<ChatEntry>();
+    return QSize(option.rect.width(), layoutEntry(option, entry).height);
+}
+
+QUrl ChatTimelineDelegate::linkAt(const QStyleOptionViewItem &option, const QModelIndex &index,
+                                  const QPoint &pos) const
+{
+    ChatEntry entry = index.data(ChatTimelineModel::EntryRole).value<ChatEntry>();
+    if (entry.filePath.isEmpty()) return QUrl();
+    Geometry g = layoutEntry(option, entry);
+    if (g.link.contains(pos) || g.image.contains(pos)) return QUrl::fromLocalFile(entry.filePath);
+    return QUrl();
+}
+
+void ChatTimelineDelegate::paint(QPainter *painter, const QStyleOptionViewItem &option,
+                                 const QModelIndex &index) const
+{
+    ChatEntry entry = index.data(ChatTimelineModel::EntryRole).value<ChatEntry>();
+    Geometry g = layoutEntry(option, entry);
+    const QFont base = option.font;
+    const QFont small = scaledFont(base, 0.85);
+    const QColor color = textColor(entry);
+    const QColor linkColor("#007AFF");
+
+    painter->save();
+    painter->setRenderHint(QPainter::Antialiasing);
+    if (option.state & QStyle::State_Selected) {
+        painter->fillRect(option.rect, QColor(0, 0, 0, 12));
+    }
+
+    if (entry.kind == ChatEntry::System) {
+        QTextLayout layout(layoutText("[系统]" + entry.text), scaledFont(base, 0.9));
+        wrapText(layout, g.content.width() + 1);
+        painter->setPen(QColor("#888"));
+        layout.draw(painter, g.content.topLeft());
+        painter->setFont(scaledFont(base, 0.75));
+        painter->setPen(QColor("#aaa"));
+        painter->drawText(g.footer, Qt::AlignHCenter | Qt::AlignTop, entry.time);
+        painter->restore();
+        return;
+    }
+
+    if (!entry.self) {
+        painter->setFont(scaledFont(base, 0.85, true));
+        painter->setPen(color);
+        painter->drawText(g.header, Qt::AlignLeft | Qt::AlignVCenter, QString("[%1]").arg(entry.sender));
+    }
+
+    QPainterPath bubble;
+    bubble.addRoundedRect(QRectF(g.bubble), 12, 12);
+    painter->fillPath(bubble, entry.self ? QColor("#E3F2FD") : QColor("#F0F0F0"));
+
+    switch (entry.kind) {
+    case ChatEntry::Text: {
+        QTextLayout layout(layoutText(entry.text), base);
+        wrapText(layout, g.content.width() + 1);
+        painter->setPen(color);
+        layout.draw(painter, g.content.topLeft());
+        break;
+    }
+    case ChatEntry::File: {
+        QRect line(g.content.left(), g.content.top(), g.content.width(), g.lineHeights[0]);
+        painter->setPen(color);
+        painter->setFont(scaledFont(base, 1.4));
+        painter->drawText(line, Qt::AlignLeft | Qt::AlignVCenter, fileIcon(entry.fileName));
+
+        QFont nameFont = scaledFont(base, 1.0, true);
+        line.translate(0, g.lineHeights[0] + LineGap);
+        line.setHeight(g.lineHeights[1]);
+        painter->setFont(nameFont);
+        painter->drawText(line, Qt::AlignLeft | Qt::AlignVCenter,
+                          QFontMetrics(nameFont).elidedText(entry.fileName, Qt::ElideMiddle, line.width()));
+
+        line.translate(0, g.lineHeights[1] + LineGap);
+        line.setHeight(g.lineHeights[2]);
+        painter->setFont(small);
+        painter->drawText(line, Qt::AlignLeft | Qt::AlignVCenter, "📏 大小: " + formatSize(entry.fileSize));
+
+        painter->setPen(linkColor);
+        painter->drawText(g.link, Qt::AlignLeft | Qt::AlignVCenter, "💾 点击下载");
+        break;
+    }
+    case ChatEntry::Image: {
+        if (!entry.thumbnail.isNull()) {
+            painter->drawImage(g.image, entry.thumbnail);
+        } else {
+            // 缩略图还在后台解码，或者解码失败
+            painter->fillRect(g.image, QColor("#E0E0E0"));
+            painter->setFont(small);
+            painter->setPen(QColor("#999"));
+            painter->drawText(g.image, Qt::AlignCenter, entry.thumbnailId ? "加载中..." : "无法预览");
+        }
+        painter->setFont(small);
+        painter->setPen(linkColor);
+        painter->drawText(g.link, Qt::AlignLeft | Qt::AlignVCenter,
+                          QFontMetrics(small).elidedText("🖼️ " + entry.fileName, Qt::ElideMiddle, g.link.width()));
+        QRect hint = g.link.translated(0, g.link.height());
+        painter->setPen(color);
+        painter->drawText(hint, Qt::AlignLeft | Qt::AlignVCenter, "💾 点击图片查看");
+        break;
+    }
+    case ChatEntry::System:
+        break;
+    }
+
+    painter->setFont(small);
+    QString time = footerText(entry);
+    if (entry.self) {
+        QFontMetrics fm(small);
+        int timeWidth = fm.horizontalAdvance(time);
+        painter->setPen(QColor("#999"));
+        painter->drawText(g.footer, Qt::AlignRight | Qt::AlignVCenter, time);
+        QFont bold = scaledFont(base, 0.85, true);
+        painter->setFont(bold);
+        painter->setPen(color);
+        painter->drawText(g.footer.adjusted(0, 0, -(timeWidth + fm.horizontalAdvance(' ')), 0),
+                          Qt::AlignRight | Qt::AlignVCenter, "[我]");
+    } else {
+        painter->setPen(QColor("#999"));
+        painter->drawText(g.footer, Qt::AlignLeft | Qt::AlignVCenter, time);
+    }
+    painter->restore();
+}
+
+// ---------------------------------------------------------------- 视图
+
+ChatTimelineView::ChatTimelineView(QWidget *parent)
+    : QAbstractScrollArea(parent)
+    , timelineModel(nullptr)
+    , delegate(new ChatTimelineDelegate(this))
+    , widthGeneration(1)
+    , measuredWidth(-1)
+    , totalHeight(0)
+    , stickToBottom(true)
+    , currentRow(-1)
+{
+    setFocusPolicy(Qt::StrongFocus);
+    setHorizontalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
+    viewport()->setMouseTracking(true);
+    viewport()->setBackgroundRole(QPalette::Base);
+    viewport()->setAutoFillBackground(true);
+    verticalScrollBar()->setSingleStep(20);
+    tree.append(0);
+}
+
+void ChatTimelineView::setModel(ChatTimelineModel *model)
+{
+    if (timelineModel) disconnect(timelineModel, nullptr, this, nullptr);
+    timelineModel = model;
+    if (model) {
+        connect(model, &QAbstractItemModel::rowsInserted, this, &ChatTimelineView::onRowsInserted);
+        connect(model, &QAbstractItemModel::rowsRemoved, this, &ChatTimelineView::rebuild);
+        connect(model, &QAbstractItemModel::rowsMoved, this, &ChatTimelineView::rebuild);
+        connect(model, &QAbstractItemModel::modelReset, this, &ChatTimelineView::rebuild);
+        connect(model, &QAbstractItemModel::layoutChanged, this, &ChatTimelineView::rebuild);
+        connect(model, &QAbstractItemModel::dataChanged, this,
+                [this](const QModelIndex &topLeft, const QModelIndex &bottomRight) {
+            // 内容变了的行在下次可见时重新测量
+            for (int row = topLeft.row(); row <= bottomRight.row() && row < measuredAt.size(); ++row) {
+                measuredAt[row] = 0;
+            }
+            viewport()->update();
+        });
+    }
+    rebuild();
+}
+
+void ChatTimelineView::scrollToBottom()
+{
+    stickToBottom = true;
+    updateScrollRange();
+}
+
+qint64 ChatTimelineView::offsetOf(int row) const
+{
+    qint64 sum = 0;
+    for (int i = row; i > 0; i -= i & -i) sum += tree[i];
+    return sum;
+}
+
+// 包含 y 的行；y 超出末尾时返回最后一行
+int ChatTimelineView::rowAt(qint64 y) const
+{
+    const int n = heights.size();
+    if (n == 0) return 0;
+    int pos = 0;
+    int step = 1;
+    while (step * 2 <= n) step *= 2;
+    for (; step > 0; step /= 2) {
+        if (pos + step <= n && tree[pos + step] <= y) {
+            pos += step;
+            y -= tree[pos];
+        }
+    }
+    return qMin(pos, n - 1);
+}
+
+void ChatTimelineView::addHeight(int row, int delta)
+{
+    for (int i = row + 1; i < tree.size(); i += i & -i) tree[i] += delta;
+    totalHeight += delta;
+}
+
+void ChatTimelineView::appendRow(int height)
+{
+    const int i = heights.size() + 1;
+    qint64 node = height;
+    for (int j = i - 1; j > i - (i & -i); j -= j & -j) node += tree[j];
+    tree.append(node);
+    heights.append(height);
+    measuredAt.append(widthGeneration);
+    totalHeight += height;
+}
+
+QStyleOptionViewItem ChatTimelineView::rowOption(int row, qint64 top) const
+{
+    QStyleOptionViewItem option;
+    option.initFrom(viewport());
+    option.font = font();
+    option.fontMetrics = QFontMetrics(option.font);
+    option.rect = QRect(0, int(top), viewport()->width(), heights.value(row));
+    return option;
+}
+
+int ChatTimelineView::measure(int row) const
+{
+    QSize size = delegate->sizeHint(rowOption(row, 0), timelineModel->index(row));
+    return qMax(1, size.height());
+}
+
+// 行高按当前宽度重新测量过时返回 false，否则测量并修正树状数组
+bool ChatTimelineView::ensureMeasured(int row)
+{
+    if (measuredAt[row] == widthGeneration) return false;
+    measuredAt[row] = widthGeneration;
+    int height = measure(row);
+    if (height == heights[row]) return false;
+    addHeight(row, height - heights[row]);
+    heights[row] = height;
+    return true;
+}
+
+void ChatTimelineView::measureVisibleRows()
+{
+    // 上面的行变高会把后面的行推出视口，最多重复几次直到稳定
+    for (int pass = 0; pass < 3 && !heights.isEmpty(); ++pass) {
+        const qint64 scroll = verticalScrollBar()->value();
+        const qint64 bottom = scroll + viewport()->height();
+        bool changed = false;
+        int row = rowAt(scroll);
+        qint64 top = offsetOf(row);
+        while (row < heights.size() && top < bottom) {
+            if (ensureMeasured(row)) changed = true;
+            top += heights[row];
+            ++row;
+        }
+        if (!changed) break;
+        updateScrollRange();
+    }
+}
+
+void ChatTimelineView::updateScrollRange()
+{
+    QScrollBar *bar = verticalScrollBar();
+    const int page = viewport()->height();
+    bar->setPageStep(page);
+    bar->setRange(0, int(qMin<qint64>(std::numeric_limits<int>::max(), qMax<qint64>(0, totalHeight - page))));
+    if (stickToBottom) bar->setValue(bar->maximum());
+    viewport()->update();
+}
+
+void ChatTimelineView::onRowsInserted(const QModelIndex &parent, int first, int last)
+{
+    if (parent.isValid()) return;
+    if (first != heights.size()) {
+        // 只在末尾追加时增量处理，其他位置插入时整体重建
+        rebuild();
+        return;
+    }
+    for (int row = first; row <= last; ++row) {
+        appendRow(measure(row));
+    }
+    updateScrollRange();
+}
+
+void ChatTimelineView::rebuild()
+{
+    tree.resize(1);
+    heights.clear();
+    measuredAt.clear();
+    totalHeight = 0;
+    currentRow = -1;
+    if (timelineModel) {
+        const int rows = timelineModel->rowCount();
+        tree.reserve(rows + 1);
+        heights.reserve(rows);
+        measuredAt.reserve(rows);
+        for (int row = 0; row < rows; ++row) appendRow(measure(row));
+    }
+    updateScrollRange();
+}
+
+void ChatTimelineView::paintEvent(QPaintEvent *event)
+{
+    if (!timelineModel || heights.isEmpty()) return;
+    measureVisibleRows();
+
+    QPainter painter(viewport());
+    const QRect area = event->rect();
+    const qint64 scroll = verticalScrollBar()->value();
+    int row = rowAt(scroll + area.top());
+    qint64 top = offsetOf(row) - scroll;
+    while (row < heights.size() && top <= area.bottom()) {
+        QStyleOptionViewItem option = rowOption(row, top);
+        if (row == currentRow) option.state |= QStyle::State_Selected;
+        delegate->paint(&painter, option, timelineModel->index(row));
+        top += heights[row];
+        ++row;
+    }
+}
+
+void ChatTimelineView::resizeEvent(QResizeEvent *event)
+{
+    QAbstractScrollArea::resizeEvent(event);
+    const int width = viewport()->width();
+    if (width != measuredWidth) {
+        measuredWidth = width;
+        // 所有行高都作废，先沿用旧值，可见时再测量
+        if (++widthGeneration == 0) widthGeneration = 1;
+        if (!heights.isEmpty()) {
+            int last = heights.size() - 1;
+            if (stickToBottom) ensureMeasured(last);
+        }
+    }
+    updateScrollRange();
+}
+
+void ChatTimelineView::scrollContentsBy(int, int)
+{
+    QScrollBar *bar = verticalScrollBar();
+    stickToBottom = bar->value() >= bar->maximum();
+    viewport()->update();
+}
+
+int ChatTimelineView::rowAtViewport(const QPoint &pos, qint64 *top) const
+{
+    if (!timelineModel || heights.isEmpty()) return -1;
+    const qint64 scroll = verticalScrollBar()->value();
+    const qint64 y = scroll + pos.y();
+    if (y < 0 || y >= totalHeight) return -1;
+    int row = rowAt(y);
+    if (top) *top = offsetOf(row) - scroll;
+    return row;
+}
+
+void ChatTimelineView::mouseMoveEvent(QMouseEvent *event)
+{
+    qint64 top = 0;
+    int row = rowAtViewport(event->position().toPoint(), &top);
+    bool overLink = row >= 0 &&
+        !delegate->linkAt(rowOption(row, top), timelineModel->index(row), event->position().toPoint()).isEmpty();
+    viewport()->setCursor(overLink ? Qt::PointingHandCursor : Qt::ArrowCursor);
+    QAbstractScrollArea::mouseMoveEvent(event);
+}
+
+void ChatTimelineView::mousePressEvent(QMouseEvent *event)
+{
+    int row = rowAtViewport(event->position().toPoint());
+    if (row != currentRow) {
+        currentRow = row;
+        viewport()->update();
+    }
+    QAbstractScrollArea::mousePressEvent(event);
+}
+
+void ChatTimelineView::mouseReleaseEvent(QMouseEvent *event)
+{
+    if (event->button() == Qt::LeftButton) {
+        qint64 top = 0;
+        int row = rowAtViewport(event->position().toPoint(), &top);
+        if (row >= 0) {
+            QUrl url = delegate->linkAt(rowOption(row, top), timelineModel->index(row), event->position().toPoint());
+            if (!url.isEmpty()) emit linkActivated(url);
+        }
+    }
+    QAbstractScrollArea::mouseReleaseEvent(event);
+}
+
+void ChatTimelineView::keyPressEvent(QKeyEvent *event)
+{
+    if (event->matches(QKeySequence::Copy)) {
+        copyRow(currentRow);
+        return;
+    }
+    if (event->key() == Qt::Key_Home) {
+        verticalScrollBar()->setValue(0);
+        return;
+    }
+    if (event->key() == Qt::Key_End) {
+        scrollToBottom();
+        return;
+    }
+    QAbstractScrollArea::keyPressEvent(event);
+}
+
+void ChatTimelineView::contextMenuEvent(QContextMenuEvent *event)
+{
+    int row = rowAtViewport(event->pos());
+    if (row < 0) return;
+    currentRow = row;
+    viewport()->update();
+
+    ChatEntry entry = timelineModel->entry(row);
+    QMenu menu(this);
+    menu.addAction("复制", this, [this, row]() { copyRow(row); });
+    if (!entry.filePath.isEmpty()) {
+        QUrl url = QUrl::fromLocalFile(entry.filePath);
+        menu.addAction("打开文件...", this, [this, url]() { emit linkActivated(url); });
+    }
+    menu.exec(event->globalPos());
+}
+
+void ChatTimelineView::copyRow(int row)
+{
+    if (!timelineModel || row < 0 || row >= timelineModel->rowCount()) return;
+    QApplication::clipboard()->setText(timelineModel->index(row).data(Qt::DisplayRole).toString());
+}
@@ -0,0 +1,173 @@
+#ifndef CHATTIMELINE_H
+#define CHATTIMELINE_H
+
+#include <QAbstractListModel>
+#include <QAbstractScrollArea>
+#include <QHash>
+#include <QStyledItemDelegate>
+#include <QImage>
+#include <QList>
+#include <QPair>
+#include <QUrl>
+#include <QVector>
+
+// 聊天记录的一条：文字、文件、图片或系统提示
+struct ChatEntry {
+    enum Kind {
+        Text,
+        File,
+        Image,
+        System
+    };
+    Kind kind = Text;
+    QString sender;
+    QString text;           // 文字消息或系统提示的内容
+    QString fileName;
+    QString filePath;       // 文件和图片：本地保存位置，点击时打开
+    qint64 fileSize = 0;
+    QImage thumbnail;       // 图片：已缩放到聊天窗口中显示的大小（带 devicePixelRatio），后台解码完成前为空
+    QSize thumbnailSize;    // 图片：缩略图的显示尺寸，解码完成前按此尺寸画占位框
+    quint64 thumbnailId = 0;    // 图片：正在后台解码的缩略图请求号，0 表示没有
+    QString time;
+    bool self = false;      // 自己发出的，显示在右侧
+    bool isPrivate = false; // 私聊，使用绿色
+};
+Q_DECLARE_METATYPE(ChatEntry)
+
+class QTemporaryFile;
+
+// 聊天记录模型，只在末尾追加。
+// 内存中只保留最近的 memoryRows() 条左右，更早的按 PageRows 条一页写入应用数据目录下的
+// 临时段文件，行号不变；视图滚动到这些行时再按页读回，最近读过的几页留在缓存中。
+class ChatTimelineModel : public QAbstractListModel
+{
+    Q_OBJECT
+
+public:
+    enum Roles {
+        EntryRole = Qt::UserRole + 1   // 整条 ChatEntry
+    };
+
+    static constexpr int DefaultMemoryRows = 500;
+    static constexpr int PageRows = 100;        // 每次换出和读回的条数
+    static constexpr int CachedPages = 4;       // 读回后留在内存中的页数
+
+    explicit ChatTimelineModel(QObject *parent = nullptr);
+    ~ChatTimelineModel() override;
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+
+    void append(const ChatEntry &entry);
+    void clear();
+    // 已换出的行会从段文件读回；读取失败时返回一条系统提示
+    ChatEntry entry(int row) const;
+
+    // 内存中至少保留的条数，不少于 PageRows
+    void setMemoryRows(int rows);
+    int memoryRows() const { return residentLimit; }
+    int spilledCount() const { return spilledRows; }
+
+    // 放入后台解码完成的缩略图（image 为空表示解码失败），该行已换出时写到段文件中；
+    // 请求号未知或写盘失败时返回 false
+    bool setThumbnail(quint64 id, const QImage &image);
+
+private:
+    const ChatEntry *lookup(int row) const;
+    const QList<ChatEntry> *loadPage(int page) const;
+    void spillOldest();
+    bool storeLateThumbnail(int row, const QImage &image);
+    bool openSpill();
+
+    QList<ChatEntry> recent;            // 行 [spilledRows, rowCount()) 的内容
+    int spilledRows;                    // 已写入段文件的行数，总是 PageRows 的整数倍
+    int residentLimit;
+    QTemporaryFile *spill;              // 第一次换出时创建，清空和析构时删除
+    QVector<qint64> pageOffsets;        // 第 i 页（行 i*PageRows 起）在段文件中的位置
+    mutable QList<QPair<int, QList<ChatEntry>>> pageCache;   // 最近读回的页，最近使用的在前
+    QHash<quint64, int> pendingThumbnails;  // 缩略图请求号 -> 行，包括已换出的行
+    QHash<int, qint64> lateThumbnails;      // 换出后才解码完成的行 -> 缩略图在段文件中的位置
+};
+
+// 按气泡样式绘制一条记录；尺寸只取决于记录内容和可用宽度
+class ChatTimelineDelegate : public QStyledItemDelegate
+{
+    Q_OBJECT
+
+public:
+    explicit ChatTimelineDelegate(QObject *parent = nullptr);
+
+    void paint(QPainter *painter, const QStyleOptionViewItem &option,
+               const QModelIndex &index) const override;
+    QSize sizeHint(const QStyleOptionViewItem &option, const QModelIndex &index) const override;
+
+    // pos 处的链接（文件和图片指向本地文件），没有时返回空 QUrl
+    QUrl linkAt(const QStyleOptionViewItem &option, const QModelIndex &index, const QPoint &pos) const;
+
+private:
+    struct Geometry;
+    Geometry layoutEntry(const QStyleOptionViewItem &option, const ChatEntry &entry) const;
+};
+
+// 虚拟化的聊天记录视图：只测量新行和可见行，只绘制可见行。
+// 行高缓存在树状数组中，追加、按偏移找行、修正一行的高度都是 O(log n)，
+// 所以追加和绘制的开销与记录条数基本无关。宽度变化后旧的行高先作为估计值，
+// 滚动到可见时再按新宽度重新测量。
+class ChatTimelineView : public QAbstractScrollArea
+{
+    Q_OBJECT
+
+public:
+    explicit ChatTimelineView(QWidget *parent = nullptr);
+
+    void setModel(ChatTimelineModel *model);
+    ChatTimelineModel *model() const { return timelineModel; }
+    ChatTimelineDelegate *itemDelegate() const { return delegate; }
+
+    void scrollToBottom();
+
+signals:
+    void linkActivated(const QUrl &url);
+
+protected:
+    void paintEvent(QPaintEvent *event) override;
+    void resizeEvent(QResizeEvent *event) override;
+    void scrollContentsBy(int dx, int dy) override;
+    void mouseMoveEvent(QMouseEvent *event) override;
+    void mousePressEvent(QMouseEvent *event) override;
+    void mouseReleaseEvent(QMouseEvent *event) override;
+    void keyPressEvent(QKeyEvent *event) override;
+    void contextMenuEvent(QContextMenuEvent *event) override;
+
+private slots:
+    void onRowsInserted(const QModelIndex &parent, int first, int last);
+    void rebuild();
+
+private:
+    // 树状数组：前缀和即行的顶端位置
+    qint64 offsetOf(int row) const;
+    int rowAt(qint64 y) const;
+    void addHeight(int row, int delta);
+    void appendRow(int height);
+
+    int measure(int row) const;
+    bool ensureMeasured(int row);
+    void measureVisibleRows();
+    void updateScrollRange();
+    QStyleOptionViewItem rowOption(int row, qint64 top) const;
+    int rowAtViewport(const QPoint &pos, qint64 *top = nullptr) const;
+    void copyRow(int row);
+
+    ChatTimelineModel *timelineModel;
+    ChatTimelineDelegate *delegate;
+    QVector<qint64> tree;           // 1 起始的树状数组
+    QVector<int> heights;
+    QVector<quint32> measuredAt;    // 测量时的宽度代数，与 widthGeneration 不同时需要重新测量
+    quint32 widthGeneration;
+    int measuredWidth;
+    qint64 totalHeight;
+    bool stickToBottom;             // 在底部时新消息和重新测量后保持在底部
+    int currentRow;                 // 最近点击的行，复制用
+};
+
+#endif // CHATTIMELINE_H
@@ -0,0 +1,271 @@
+#include "chunkpipeline.h"
+#include "base64codec.h"
+#include "framecodec.h"
+#include <QJsonDocument>
+#include <QMutexLocker>
+#include <QThread>
+
+ChunkPipeline::ChunkPipeline(const QString &filePath, qint64 fileSize, qint64 chunkSize, QObject *parent)
+    : QObject(parent)
+    , file(filePath)
+    , fileSize(fileSize)
+    , chunkSize(chunkSize)
+    , totalChunks(int((fileSize + chunkSize - 1) / chunkSize))
+    , binary(false)
+    , streamId(0)
+    , compression(CompressionOff)
+    , probedChunks(0)
+    , probeHits(0)
+    , nextToRead(0)
+    , nextToDeliver(0)
+    , cancelled(false)
+{
+    int threads = qMax(1, QThread::idealThreadCount());
+    readerPool.setMaxThreadCount(1);
+    encoderPool.setMaxThreadCount(threads);
+    // 每个编码线程保持两个分块在手，读取阶段不会让它们空等
+    maxAhead = threads * 2;
+}
+
+ChunkPipeline::~ChunkPipeline()
+{
+    cancel();
+    readerPool.waitForDone();
+    encoderPool.waitForDone();
+}
+
+bool ChunkPipeline::open()
+{
+    return file.open(QIODevice::ReadOnly);
+}
+
+void ChunkPipeline::setBinary(quint32 id)
+{
+    binary = true;
+    streamId = id;
+}
+
+void ChunkPipeline::setJsonHeader(const QJsonObject &header)
+{
+    binary = false;
+    jsonHeader = header;
+}
+
+void ChunkPipeline::setChunkIndices(const QList<int> &indices)
+{
+    chunkList = indices;
+}
+
+void ChunkPipeline::setCompression(bool enabled)
+{
+    compression = enabled ? CompressionProbing : CompressionOff;
+    probedChunks = 0;
+    probeHits = 0;
+}
+
+qint64 ChunkPipeline::chunkBytes(int index) const
+{
+    return qMin(chunkSize, fileSize - qint64(index) * chunkSize);
+}
+
+qint64 ChunkPipeline::byteCount() const
+{
+    if (chunkList.isEmpty()) return fileSize;
+    qint64 bytes = 0;
+    for (int index : chunkList) bytes += chunkBytes(index);
+    return bytes;
+}
+
+void ChunkPipeline::start()
+{
+    clock.start();
+    scheduleReads();
+}
+
+void ChunkPipeline::cancel()
+{
+    cancelled = true;
+    readerPool.clear();
+    encoderPool.clear();
+    ready.clear();
+}
+
+bool ChunkPipeline::hasNext() const
+{
+    return ready.contains(nextToDeliver);
+}
+
+bool ChunkPipeline::takeNext(EncodedChunk &chunk)
+{
+    auto it = ready.find(nextToDeliver);
+    if (it == ready.end()) return false;
+
+    chunk = std::move(it.value());
+    ready.erase(it);
+    nextToDeliver++;
+    {
+        QMutexLocker locker(&statsMutex);
+        counters.bytesDelivered += chunk.fileBytes;
+    }
+
+    // 交出一个分块后读取阶段可以再往前走一步
+    scheduleReads();
+    return true;
+}
+
+// 在 GUI 线程中按顺序把读取任务提交给单线程读取池
+void ChunkPipeline::scheduleReads()
+{
+    while (!cancelled && nextToRead < chunkCount() && nextToRead - nextToDeliver < maxAhead) {
+        int position = nextToRead++;
+        int index = chunkList.isEmpty() ? position : chunkList.at(position);
+        readerPool.start([this, position, index]() { readChunk(position, index); });
+    }
+}
+
+// 读取阶段（读取线程）：读出原始数据后交给编码线程池
+void ChunkPipeline::readChunk(int position, int index)
+{
+    if (cancelled) return;
+
+    QElapsedTimer timer;
+    timer.start();
+    qint64 size = chunkBytes(index);
+    // 顺序发送时 seek 不会移动位置，补发时跳到对应分块
+    QByteArray raw;
+    if (file.seek(qint64(index) * chunkSize)) raw = file.read(size);
+    qint64 readNsecs = timer.nsecsElapsed();
+
+    if (raw.size() != size) {
+        QMetaObject::invokeMethod(this, [this, index]() { onReadFailed(index); }, Qt::QueuedConnection);
+        return;
+    }
+
+    {
+        QMutexLocker locker(&statsMutex);
+        counters.bytesRead += raw.size();
+        counters.readNsecs += readNsecs;
+    }
+
+    encoderPool.start([this, position, index, raw]() {
+        if (cancelled) return;
+
+        QElapsedTimer timer;
+        timer.start();
+        QByteArray data = encodeChunk(index, raw);
+        qint64 encodeNsecs = timer.nsecsElapsed();
+        qint64 fileBytes = raw.size();
+
+        {
+            QMutexLocker locker(&statsMutex);
+            counters.bytesEncoded += fileBytes;
+            counters.encodeNsecs += encodeNsecs;
+        }
+
+        // 排序阶段在 GUI 线程中完成
+        QMetaObject::invokeMethod(this, [this, position, index, data, fileBytes]() {
+            onChunkEncoded(position, index, data, fileBytes);
+        }, Qt::QueuedConnection);
+    });
+}
+
+// 编码阶段（编码线程）：只读访问 jsonHeader，压缩探测结果通过原子变量共享
+QByteArray ChunkPipeline::encodeChunk(int index, const QByteArray &raw)
+{
+    if (binary) {
+        QByteArray packed = compressChunk(raw);
+        if (!packed.isEmpty()) {
+            return FrameEncoder::encodeChunk(streamId, quint32(index), packed, FrameFlagCompressed);
+        }
+        return FrameEncoder::encodeChunk(streamId, quint32(index), raw);
+    }
+
+    QJsonObject chunkJson = jsonHeader;
+    chunkJson["chunk_index"] = index;
+    chunkJson["chunk_data"] = QString::fromLatin1(Base64Codec::encode(raw));
+    chunkJson["chunk_size"] = QString::number(raw.size());
+    return QJsonDocument(chunkJson).toJson(QJsonDocument::Compact);
+}
+
+// 压缩一个分块，不值得压缩时返回空；每个分块单独判断，
+// 探测阶段结束后如果多数分块压不动（已压缩的格式），之后不再尝试
+QByteArray ChunkPipeline::compressChunk(const QByteArray &raw)
+{
+    if (compression == CompressionOff || raw.isEmpty()) return QByteArray();
+
+    QElapsedTimer timer;
+    timer.start();
+    QByteArray packed = qCompress(raw, CompressionLevel);
+    qint64 nsecs = timer.nsecsElapsed();
+    bool worthIt = packed.size() < raw.size() * MinCompressionRatio;
+
+    if (compression == CompressionProbing) {
+        if (worthIt) probeHits++;
+        if (++probedChunks >= CompressionProbeChunks) {
+            int expected = CompressionProbing;
+            compression.compare_exchange_strong(expected, probeHits * 2 >= probedChunks
+                                                              ? CompressionOn : CompressionOff);
+        }
+    }
+
+    QMutexLocker locker(&statsMutex);
+    counters.compressNsecs += nsecs;
+    if (!worthIt) return QByteArray();
+    counters.compressedChunks++;
+    counters.bytesSaved += raw.size() - packed.size();
+    return packed;
+}
+
+void ChunkPipeline::onChunkEncoded(int position, int index, const QByteArray &data, qint64 fileBytes)
+{
+    if (cancelled) return;
+
+    EncodedChunk chunk;
+    chunk.index = index;
+    chunk.data = data;
+    chunk.fileBytes = fileBytes;
+    ready.insert(position, chunk);
+
+    if (position == nextToDeliver) {
+        emit chunkReady();
+    }
+}
+
+void ChunkPipeline::onReadFailed(int index)
+{
+    if (cancelled) return;
+    cancel();
+    emit failed(QString("读取分块 %1 失败: %2").arg(index).arg(file.errorString()));
+}
+
+ChunkPipeline::Stats ChunkPipeline::stats() const
+{
+    QMutexLocker locker(&statsMutex);
+    Stats result = counters;
+    result.encodeThreads = encoderPool.maxThreadCount();
+    result.elapsedNsecs = clock.isValid() ? clock.nsecsElapsed() : 0;
+    return result;
+}
+
+// 各阶段吞吐量（MB/s）：读取和单线程编码按各自耗时计算，
+// 编码池按单线程速度乘以线程数估算上限，发送按墙钟时间计算
+QString ChunkPipeline::statsSummary() const
+{
+    Stats s = stats();
+    auto rate = [](qint64 bytes, qint64 nsecs) {
+        return nsecs > 0 ? double(bytes) / (1024.0 * 1024.0) / (double(nsecs) / 1e9) : 0.0;
+    };
+    double perThread = rate(s.bytesEncoded, s.encodeNsecs);
+    QString summary = QString("读取 %1 MB/s，编码 %2 MB/s/线程 x %3 线程，发送 %4 MB/s")
+        .arg(rate(s.bytesRead, s.readNsecs), 0, 'f', 1)
+        .arg(perThread, 0, 'f', 1)
+        .arg(s.encodeThreads)
+        .arg(rate(s.bytesDelivered, s.elapsedNsecs), 0, 'f', 1);
+    if (s.compressNsecs > 0) {
+        summary += QString("，压缩 %1 块，节省 %2 KB，压缩 CPU %3 ms")
+            .arg(s.compressedChunks)
+            .arg(s.bytesSaved / 1024)
+            .arg(double(s.compressNsecs) / 1e6, 0, 'f', 1);
+    }
+    return summary;
+}
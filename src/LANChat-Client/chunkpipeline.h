@@ -0,0 +1,130 @@
+#ifndef CHUNKPIPELINE_H
+#define CHUNKPIPELINE_H
+
+#include <QObject>
+#include <QFile>
+#include <QList>
+#include <QMap>
+#include <QMutex>
+#include <QThreadPool>
+#include <QJsonObject>
+#include <QElapsedTimer>
+#include <atomic>
+
+// 上传文件的分块编码流水线：
+//   读取阶段 - 单线程按顺序读取分块
+//   编码阶段 - 线程池并行做 Base64 + JSON 序列化（或二进制分块帧编码，可选压缩）
+//   排序阶段 - 在 GUI 线程按分块序号重新排好，交给 Widget 写入套接字
+// 读取和编码最多领先 maxAhead 个分块，由 takeNext() 释放名额
+class ChunkPipeline : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct EncodedChunk {
+        int index = 0;
+        QByteArray data;        // 二进制模式为完整帧，否则为一条 JSON 消息（不含换行）
+        qint64 fileBytes = 0;
+    };
+
+    // 各阶段的累计统计，吞吐量按文件字节计算
+    struct Stats {
+        qint64 bytesRead = 0;
+        qint64 readNsecs = 0;       // 读取线程耗时
+        qint64 bytesEncoded = 0;
+        qint64 encodeNsecs = 0;     // 所有编码线程耗时之和
+        int encodeThreads = 0;
+        qint64 bytesDelivered = 0;
+        qint64 elapsedNsecs = 0;    // 从开始到现在的墙钟时间
+        int compressedChunks = 0;   // 以压缩形式发送的分块数
+        qint64 bytesSaved = 0;      // 压缩节省的字节数
+        qint64 compressNsecs = 0;   // 所有编码线程压缩耗时之和（包括没有采用的结果）
+    };
+
+    // 压缩探测：前 CompressionProbeChunks 个分块中至少一半能压到 MinCompressionRatio 以下
+    // 才继续压缩，否则之后的分块直接发送原始数据
+    static constexpr int CompressionProbeChunks = 4;
+    static constexpr double MinCompressionRatio = 0.9;
+    static constexpr int CompressionLevel = 1;  // 优先速度，局域网上 CPU 比带宽更贵
+
+    ChunkPipeline(const QString &filePath, qint64 fileSize, qint64 chunkSize, QObject *parent = nullptr);
+    ~ChunkPipeline();
+
+    bool open();
+    QString errorString() const { return file.errorString(); }
+
+    // 二进制帧模式：分块编码为 FileChunk 帧
+    void setBinary(quint32 streamId);
+    // JSON 模式：每个分块在 header 的基础上加入 chunk_index / chunk_data / chunk_size
+    void setJsonHeader(const QJsonObject &header);
+    // 只发送指定的分块（按升序，用于补发缺失分块），默认发送全部
+    void setChunkIndices(const QList<int> &indices);
+    // 二进制帧模式下压缩分块（FrameFlagCompressed），先探测前几个分块是否值得
+    void setCompression(bool enabled);
+
+    void start();
+    void cancel();
+
+    // 取出下一个按序号排好的分块，尚未就绪时返回 false
+    bool takeNext(EncodedChunk &chunk);
+    bool hasNext() const;
+    bool atEnd() const { return nextToDeliver >= chunkCount(); }
+    // 本次要发送的分块数和文件字节数
+    int chunkCount() const { return chunkList.isEmpty() ? totalChunks : int(chunkList.size()); }
+    qint64 byteCount() const;
+    // 整个文件的分块数
+    int fileChunkCount() const { return totalChunks; }
+
+    Stats stats() const;
+    QString statsSummary() const;
+
+signals:
+    void chunkReady();                  // 下一个待发送的分块已就绪
+    void failed(const QString &reason); // 读取失败，传输应终止
+
+private slots:
+    void onChunkEncoded(int position, int index, const QByteArray &data, qint64 fileBytes);
+    void onReadFailed(int index);
+
+private:
+    void scheduleReads();
+    void readChunk(int position, int index);
+    qint64 chunkBytes(int index) const;
+    QByteArray encodeChunk(int index, const QByteArray &raw);
+    QByteArray compressChunk(const QByteArray &raw);
+
+    QFile file;                 // 只在读取线程中访问
+    qint64 fileSize;
+    qint64 chunkSize;
+    int totalChunks;
+    QList<int> chunkList;       // 为空时发送全部分块
+    int maxAhead;
+
+    bool binary;
+    quint32 streamId;
+    QJsonObject jsonHeader;
+
+    enum CompressionState {
+        CompressionOff,
+        CompressionProbing,
+        CompressionOn
+    };
+    std::atomic<int> compression;       // 编码线程共享的压缩状态
+    std::atomic<int> probedChunks;
+    std::atomic<int> probeHits;         // 探测中压缩有效的分块数
+
+    QThreadPool readerPool;     // 单线程，保证顺序读取
+    QThreadPool encoderPool;
+
+    // 以下均为在发送序列中的位置，不是分块序号
+    int nextToRead;             // 下一个提交给读取阶段的位置
+    int nextToDeliver;          // 下一个交给 takeNext() 的位置
+    QMap<int, EncodedChunk> ready;  // 已编码、等待排序输出的分块
+
+    std::atomic<bool> cancelled;
+    mutable QMutex statsMutex;
+    Stats counters;
+    QElapsedTimer clock;
+};
+
+#endif // CHUNKPIPELINE_H
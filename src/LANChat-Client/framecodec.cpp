@@ -0,0 +1,173 @@
+#include "framecodec.h"
+#include <QtAlgorithms>
+#include <QtEndian>
+#include <QDebug>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FRAMECODEC_HAVE_SSE2
+#endif
+
+FrameDecoder::FrameDecoder()
+    : readPos(0)
+    , scanPos(0)
+    , decodeMode(LineMode)
+    , decodeError(false)
+{
+}
+
+void FrameDecoder::append(const QByteArray &data)
+{
+    if (data.isEmpty() || decodeError) return;
+
+    // 先回收已经交给调用者的数据，之前返回的视图从这里开始失效
+    if (readPos > 0) {
+        if (readPos >= buffer.size()) {
+            buffer.clear();
+        } else {
+            buffer.remove(0, readPos);
+        }
+        scanPos -= readPos;
+        readPos = 0;
+    }
+
+    if (buffer.isEmpty()) {
+        buffer = data;  // 隐式共享，不拷贝
+        scanPos = 0;
+    } else {
+        buffer.append(data);
+    }
+
+    if (decodeMode == LineMode && buffer.size() > MaxFrameSize
+        && findNewline(buffer.constData() + scanPos, buffer.size() - scanPos) < 0) {
+        qWarning() << "接收帧超过" << MaxFrameSize << "字节仍未结束，丢弃缓冲区";
+        buffer.clear();
+        readPos = 0;
+        scanPos = 0;
+    }
+}
+
+bool FrameDecoder::nextFrame(Frame &frame)
+{
+    if (decodeMode == BinaryMode) {
+        return nextBinaryFrame(frame);
+    }
+
+    QByteArrayView line;
+    if (!nextLine(line)) return false;
+    frame.type = MessageFrame;
+    frame.flags = 0;
+    frame.streamId = 0;
+    frame.payload = line;
+    return true;
+}
+
+bool FrameDecoder::nextBinaryFrame(Frame &frame)
+{
+    if (decodeError || bufferedBytes() < HeaderSize) return false;
+
+    const uchar *header = reinterpret_cast<const uchar *>(buffer.constData() + readPos);
+    quint32 length = qFromBigEndian<quint32>(header + 8);
+    if (length > MaxFrameSize) {
+        qWarning() << "二进制帧长度异常:" << length << "，丢弃缓冲区";
+        buffer.clear();
+        readPos = 0;
+        scanPos = 0;
+        decodeError = true;
+        return false;
+    }
+    if (bufferedBytes() < HeaderSize + qsizetype(length)) return false;
+
+    frame.type = header[0];
+    frame.flags = header[1];
+    frame.streamId = qFromBigEndian<quint32>(header + 4);
+    frame.payload = QByteArrayView(buffer.constData() + readPos + HeaderSize, qsizetype(length));
+    readPos += HeaderSize + length;
+    scanPos = readPos;
+    return true;
+}
+
+bool FrameDecoder::nextLine(QByteArrayView &line)
+{
+    const char *data = buffer.constData();
+    qsizetype offset = findNewline(data + scanPos, buffer.size() - scanPos);
+    if (offset < 0) {
+        scanPos = buffer.size();
+        return false;
+    }
+
+    qsizetype end = scanPos + offset;
+    line = QByteArrayView(data + readPos, end - readPos);
+    readPos = end + 1;
+    scanPos = readPos;
+    return true;
+}
+
+void FrameDecoder::clear()
+{
+    buffer.clear();
+    readPos = 0;
+    scanPos = 0;
+    decodeMode = LineMode;
+    decodeError = false;
+}
+
+// 查找换行符：SSE2 每次比较 64 字节，剩余部分交给 memchr
+qsizetype FrameDecoder::findNewline(const char *data, qsizetype size)
+{
+    qsizetype i = 0;
+#ifdef FRAMECODEC_HAVE_SSE2
+    const __m128i newline = _mm_set1_epi8('\n');
+    for (; i + 64 <= size; i += 64) {
+        const __m128i *p = reinterpret_cast<const __m128i *>(data + i);
+        __m128i c0 = _mm_cmpeq_epi8(_mm_loadu_si128(p), newline);
+        __m128i c1 = _mm_cmpeq_epi8(_mm_loadu_si128(p + 1), newline);
+        __m128i c2 = _mm_cmpeq_epi8(_mm_loadu_si128(p + 2), newline);
+        __m128i c3 = _mm_cmpeq_epi8(_mm_loadu_si128(p + 3), newline);
+        __m128i any = _mm_or_si128(_mm_or_si128(c0, c1), _mm_or_si128(c2, c3));
+        if (_mm_movemask_epi8(any) == 0) continue;
+
+        quint64 mask = quint64(quint16(_mm_movemask_epi8(c0)))
+                       | quint64(quint16(_mm_movemask_epi8(c1))) << 16
+                       | quint64(quint16(_mm_movemask_epi8(c2))) << 32
+                       | quint64(quint16(_mm_movemask_epi8(c3))) << 48;
+        return i + qCountTrailingZeroBits(mask);
+    }
+#endif
+    if (i >= size) return -1;
+    const void *found = std::memchr(data + i, '\n', size_t(size - i));
+    return found ? static_cast<const char *>(found) - data : -1;
+}
+
+QByteArray FrameEncoder::encode(quint8 type, quint32 streamId, QByteArrayView payload, quint8 flags)
+{
+    QByteArray frame(FrameDecoder::HeaderSize + payload.size(), Qt::Uninitialized);
+    uchar *header = reinterpret_cast<uchar *>(frame.data());
+    header[0] = type;
+    header[1] = flags;
+    qToBigEndian<quint16>(0, header + 2);
+    qToBigEndian<quint32>(streamId, header + 4);
+    qToBigEndian<quint32>(quint32(payload.size()), header + 8);
+    if (!payload.isEmpty()) {
+        std::memcpy(header + FrameDecoder::HeaderSize, payload.data(), size_t(payload.size()));
+    }
+    return frame;
+}
+
+QByteArray FrameEncoder::encodeChunk(quint32 streamId, quint32 chunkIndex, QByteArrayView data,
+                                     quint8 flags)
+{
+    QByteArray frame(FrameDecoder::HeaderSize + 4 + data.size(), Qt::Uninitialized);
+    uchar *header = reinterpret_cast<uchar *>(frame.data());
+    header[0] = FileChunkFrame;
+    header[1] = flags;
+    qToBigEndian<quint16>(0, header + 2);
+    qToBigEndian<quint32>(streamId, header + 4);
+    qToBigEndian<quint32>(quint32(4 + data.size()), header + 8);
+    qToBigEndian<quint32>(chunkIndex, header + FrameDecoder::HeaderSize);
+    if (!data.isEmpty()) {
+        std::memcpy(header + FrameDecoder::HeaderSize + 4, data.data(), size_t(data.size()));
+    }
+    return frame;
+}
@@ -0,0 +1,93 @@
+#ifndef FRAMECODEC_H
+#define FRAMECODEC_H
+
+#include <QByteArray>
+#include <QByteArrayView>
+
+// 连接上的两种分帧方式：
+//   行模式   - 旧协议，每条消息是一行 JSON 或文本，以 '\n' 结尾
+//   二进制帧 - 登录时与服务器协商，12 字节定长头 + 原始负载
+//
+// 二进制帧头（网络字节序）:
+//   u8  type      帧类型，见 FrameType
+//   u8  flags     见 FrameFlag
+//   u16 reserved  保留，目前为 0
+//   u32 streamId  文件流 ID，消息帧为 0
+//   u32 length    负载长度
+enum FrameType : quint8 {
+    MessageFrame = 1,    // 负载为一条 JSON/文本消息（等价于旧协议的一行）
+    FileMetaFrame = 2,   // 负载为文件元数据 JSON，之后同一 streamId 的分块都属于该文件
+    FileChunkFrame = 3   // 负载为 u32 分块序号 + 原始文件数据
+};
+
+enum FrameFlag : quint8 {
+    // FileChunk 帧的数据经过压缩，格式同 qCompress()：u32 原始长度（大端）+ zlib 流
+    FrameFlagCompressed = 0x01
+};
+
+struct Frame {
+    quint8 type = MessageFrame;
+    quint8 flags = 0;
+    quint32 streamId = 0;
+    QByteArrayView payload;
+};
+
+// 增量帧解码器
+// 在多次 readyRead 之间保留不完整的帧，完整帧以指向内部缓冲区的
+// QByteArrayView 返回，不做额外拷贝
+class FrameDecoder
+{
+public:
+    enum Mode {
+        LineMode,
+        BinaryMode
+    };
+
+    FrameDecoder();
+
+    // 追加从套接字读到的数据
+    void append(const QByteArray &data);
+
+    // 取出下一帧，行模式下每一行（不含换行符）作为一个 MessageFrame 返回
+    // 返回的视图在下一次调用 append()/nextFrame()/clear() 之前有效
+    bool nextFrame(Frame &frame);
+
+    // 切换分帧方式，对缓冲区中尚未取出的数据立即生效
+    void setMode(Mode mode) { decodeMode = mode; }
+    Mode mode() const { return decodeMode; }
+
+    // 二进制帧长度异常：之后的数据无法再找到帧边界，调用者应断开连接
+    bool hasError() const { return decodeError; }
+
+    // 丢弃所有缓冲数据、清除错误并回到行模式（连接断开时调用）
+    void clear();
+
+    qsizetype bufferedBytes() const { return buffer.size() - readPos; }
+
+    // 单帧最大长度，超过后丢弃缓冲区（二进制模式下同时进入错误状态），防止对端异常导致内存无限增长
+    static constexpr qsizetype MaxFrameSize = 64 * 1024 * 1024;
+    static constexpr qsizetype HeaderSize = 12;
+
+private:
+    bool nextLine(QByteArrayView &line);
+    bool nextBinaryFrame(Frame &frame);
+    static qsizetype findNewline(const char *data, qsizetype size);
+
+    QByteArray buffer;
+    qsizetype readPos;   // 已交给调用者的数据末尾
+    qsizetype scanPos;   // 已扫描过且不含换行符的位置，避免重复扫描
+    Mode decodeMode;
+    bool decodeError;
+};
+
+// 二进制帧编码
+class FrameEncoder
+{
+public:
+    static QByteArray encode(quint8 type, quint32 streamId, QByteArrayView payload, quint8 flags = 0);
+    // 文件分块帧：负载为 u32 分块序号 + 数据，一次分配完成
+    static QByteArray encodeChunk(quint32 streamId, quint32 chunkIndex, QByteArrayView data,
+                                  quint8 flags = 0);
+};
+
+#endif // FRAMECODEC_H
@@ -0,0 +1,102 @@
+#include "heartbeat.h"
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QtGlobal>
+
+Heartbeat::Heartbeat(int intervalMsecs, QObject *parent)
+    : QObject(parent)
+    , intervalMsecs(qMax(intervalMsecs, 100))
+    , lastActivityMsecs(0)
+    , nextSeq(1)
+    , lastRtt(0)
+    , smoothedRtt(0)
+    , rttVariation(0)
+{
+    clock.start();
+    connect(&tickTimer, &QTimer::timeout, this, &Heartbeat::onTick);
+}
+
+void Heartbeat::setInterval(int intervalMsecs)
+{
+    this->intervalMsecs = qMax(intervalMsecs, 100);
+    if (tickTimer.isActive()) tickTimer.start(this->intervalMsecs);
+}
+
+void Heartbeat::start()
+{
+    outstanding.clear();
+    lastRtt = smoothedRtt = rttVariation = 0;
+    lastActivityMsecs = clock.elapsed();
+    tickTimer.start(intervalMsecs);
+    onTick();  // 立即测一次，不必等第一个间隔
+}
+
+void Heartbeat::stop()
+{
+    tickTimer.stop();
+    outstanding.clear();
+    lastRtt = smoothedRtt = rttVariation = 0;
+}
+
+void Heartbeat::noteActivity()
+{
+    lastActivityMsecs = clock.elapsed();
+}
+
+void Heartbeat::handlePong(quint32 seq)
+{
+    auto it = outstanding.find(seq);
+    if (it == outstanding.end()) return;  // 重连前发出的，或已经过期
+    qint64 rtt = clock.nsecsElapsed() / 1000 - it.value();
+    outstanding.erase(it);
+    noteActivity();
+
+    // RFC 6298：SRTT 增益 1/8，RTTVAR 增益 1/4
+    lastRtt = rtt;
+    if (smoothedRtt == 0) {
+        smoothedRtt = rtt;
+        rttVariation = rtt / 2;
+    } else {
+        rttVariation += (qAbs(smoothedRtt - rtt) - rttVariation) / 4;
+        smoothedRtt += (rtt - smoothedRtt) / 8;
+    }
+    emit rttUpdated(lastRtt, smoothedRtt, rttVariation);
+}
+
+QString Heartbeat::summary() const
+{
+    if (smoothedRtt == 0) return QString("往返时间: 测量中");
+    return QString("往返时间: %1 ms（平滑 %2 ms，抖动 %3 ms）")
+        .arg(double(lastRtt) / 1000.0, 0, 'f', 1)
+        .arg(double(smoothedRtt) / 1000.0, 0, 'f', 1)
+        .arg(double(rttVariation) / 1000.0, 0, 'f', 1);
+}
+
+void Heartbeat::onTick()
+{
+    qint64 silent = clock.elapsed() - lastActivityMsecs;
+    if (silent > qint64(intervalMsecs) * DeadIntervals) {
+        tickTimer.stop();
+        emit timedOut(silent);
+        return;
+    }
+
+    // 超过一个判定周期还没有回答的 ping 不会再用于测量
+    qint64 now = clock.nsecsElapsed() / 1000;
+    qint64 expiry = qint64(intervalMsecs) * DeadIntervals * 1000;
+    for (auto it = outstanding.begin(); it != outstanding.end();) {
+        if (now - it.value() > expiry) {
+            it = outstanding.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    quint32 seq = nextSeq++;
+    outstanding.insert(seq, now);
+    QJsonObject message;
+    message["type"] = "ping";
+    message["seq"] = qint64(seq);
+    message["interval"] = intervalMsecs;
+    emit ping(QJsonDocument(message).toJson(QJsonDocument::Compact));
+}
@@ -0,0 +1,61 @@
+#ifndef HEARTBEAT_H
+#define HEARTBEAT_H
+
+#include <QObject>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QHash>
+
+// 聊天连接的应用层心跳
+// 每隔 interval 发一次 ping（经 ping 信号交给调用方写出），服务器立即回 pong。
+// 由 pong 测量往返时间，按 RFC 6298 的方式平滑并估计抖动；
+// 连续 deadIntervals 个间隔没有收到任何数据时发出 timedOut，调用方断开重连。
+class Heartbeat : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit Heartbeat(int intervalMsecs = DefaultIntervalMsecs, QObject *parent = nullptr);
+
+    void setInterval(int intervalMsecs);
+    int interval() const { return intervalMsecs; }
+
+    // 登录完成、服务器声明支持心跳后开始；断开时停止并清空测量
+    void start();
+    void stop();
+    bool isActive() const { return tickTimer.isActive(); }
+
+    // 收到任何数据都说明连接还活着（文件数据很多时 pong 可能排在后面）
+    void noteActivity();
+    void handlePong(quint32 seq);
+
+    // 没有测量时为 0
+    qint64 lastRttUsecs() const { return lastRtt; }
+    qint64 smoothedRttUsecs() const { return smoothedRtt; }
+    qint64 jitterUsecs() const { return rttVariation; }
+    QString summary() const;
+
+    static constexpr int DefaultIntervalMsecs = 1000;
+    static constexpr int DeadIntervals = 3;
+
+signals:
+    void ping(const QByteArray &message);   // 需要写出的 ping 消息（JSON，不含换行）
+    void rttUpdated(qint64 rttUsecs, qint64 smoothedRttUsecs, qint64 jitterUsecs);
+    void timedOut(qint64 silentMsecs);
+
+private slots:
+    void onTick();
+
+private:
+    int intervalMsecs;
+    QTimer tickTimer;
+    QElapsedTimer clock;
+    qint64 lastActivityMsecs;
+    quint32 nextSeq;
+    QHash<quint32, qint64> outstanding;     // seq -> 发出时间（微秒）
+    qint64 lastRtt;
+    qint64 smoothedRtt;
+    qint64 rttVariation;
+};
+
+#endif // HEARTBEAT_H
@@ -0,0 +1,65 @@
+#include "imagesniffer.h"
+#include <QBuffer>
+#include <QFile>
+#include <QImageReader>
+#include <QList>
+#include <cstring>
+
+namespace {
+
+bool startsWith(QByteArrayView head, const char *magic, qsizetype size)
+{
+    return head.size() >= size && memcmp(head.data(), magic, size_t(size)) == 0;
+}
+
+} // namespace
+
+QByteArray ImageSniffer::sniffFormat(QByteArrayView head)
+{
+    if (startsWith(head, "\x89PNG\r\n\x1a\n", 8)) return "png";
+    if (startsWith(head, "\xff\xd8\xff", 3)) return "jpeg";
+    if (startsWith(head, "GIF87a", 6) || startsWith(head, "GIF89a", 6)) return "gif";
+    if (head.size() >= 12 && startsWith(head, "RIFF", 4) && memcmp(head.data() + 8, "WEBP", 4) == 0) {
+        return "webp";
+    }
+    if (startsWith(head, "II*\0", 4) || startsWith(head, "MM\0*", 4)) return "tiff";
+    // "BM" 只有两个字节，再要求文件头中的两个保留字段为 0
+    if (head.size() >= 14 && startsWith(head, "BM", 2) && memcmp(head.data() + 6, "\0\0\0\0", 4) == 0) {
+        return "bmp";
+    }
+    return QByteArray();
+}
+
+ImageSniffer::Info ImageSniffer::probe(QIODevice *device)
+{
+    Info info;
+    if (!device || !device->isOpen()) return info;
+
+    QByteArray format = sniffFormat(device->peek(HeadBytes));
+    // 没有对应插件（例如缺少 webp 插件）时按普通文件处理
+    static const QList<QByteArray> supported = QImageReader::supportedImageFormats();
+    if (format.isEmpty() || !supported.contains(format)) return info;
+
+    const qint64 pos = device->pos();
+    QImageReader reader(device, format);
+    reader.setDecideFormatFromContent(false);
+    info.format = format;
+    info.size = reader.size();
+    device->seek(pos);
+    return info;
+}
+
+ImageSniffer::Info ImageSniffer::probe(const QString &path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) return Info();
+    return probe(&file);
+}
+
+ImageSniffer::Info ImageSniffer::probe(const QByteArray &data)
+{
+    QBuffer buffer;
+    buffer.setData(data);   // 隐式共享，不复制数据
+    buffer.open(QIODevice::ReadOnly);
+    return probe(&buffer);
+}
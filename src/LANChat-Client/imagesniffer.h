@@ -0,0 +1,34 @@
+#ifndef IMAGESNIFFER_H
+#define IMAGESNIFFER_H
+
+#include <QByteArray>
+#include <QByteArrayView>
+#include <QSize>
+#include <QString>
+
+class QIODevice;
+
+// 按文件开头的魔数识别图片格式，再让对应的 QImageReader 只读文件头取得尺寸，不解码像素。
+// 用来判断收到或要发送的文件是不是图片；真正的解码只在生成缩略图时进行
+class ImageSniffer
+{
+public:
+    struct Info {
+        QByteArray format;      // QImageReader 的格式名，不是图片（或不支持）时为空
+        QSize size;             // 原始尺寸，文件头中没有时无效
+
+        bool isImage() const { return !format.isEmpty(); }
+    };
+
+    static constexpr int HeadBytes = 32;    // 识别格式需要的开头字节数
+
+    // 只看开头的字节：png / jpeg / gif / bmp / webp / tiff，不认识时返回空
+    static QByteArray sniffFormat(QByteArrayView head);
+
+    static Info probe(const QString &path);
+    static Info probe(const QByteArray &data);
+    // device 必须已打开且可随机访问，读取后位置不变
+    static Info probe(QIODevice *device);
+};
+
+#endif // IMAGESNIFFER_H
@@ -0,0 +1,154 @@
+#include "incomingfile.h"
+#include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
+#include <QRegularExpression>
+#include <QDebug>
+
+IncomingFile::IncomingFile(const QString &fileId, const QString &fileName, qint64 fileSize, int totalChunks,
+                           const QString &sender, const QString &targetUser)
+    : id(fileId)
+    , name(fileName)
+    , size(fileSize)
+    , totalChunks(totalChunks)
+    , from(sender)
+    , target(targetUser)
+    , stride(0)
+    , received(qMax(totalChunks, 0))
+    , receivedChunks(0)
+    , lastActivity(QDateTime::currentMSecsSinceEpoch())
+    , resendCount(0)
+{
+}
+
+IncomingFile::~IncomingFile()
+{
+    if (file.isOpen()) file.close();
+}
+
+bool IncomingFile::open(const QString &saveDir)
+{
+    // 临时文件与最终文件位于同一目录，重命名不会跨文件系统
+    QString safeId = QString(id).replace(QRegularExpression("[^A-Za-z0-9_-]"), "_");
+    QString baseName = QFileInfo(name).fileName();
+    file.setFileName(QDir(saveDir).filePath(QString(".%1.%2.part").arg(baseName, safeId)));
+
+    // 不使用 QFile 的写缓冲，分块直接写入系统
+    if (!file.open(QIODevice::ReadWrite | QIODevice::Truncate | QIODevice::Unbuffered)) {
+        qDebug() << "无法创建临时文件:" << file.fileName() << file.errorString();
+        return false;
+    }
+    if (size > 0 && !file.resize(size)) {
+        qDebug() << "预分配文件空间失败:" << file.fileName() << file.errorString();
+        file.close();
+        file.remove();
+        return false;
+    }
+    return true;
+}
+
+bool IncomingFile::resume(const QString &partPath, qint64 chunkSize, const QBitArray &receivedBits)
+{
+    file.setFileName(partPath);
+    if (!file.exists() || file.size() != size) {
+        qDebug() << "临时文件不存在或大小不符，无法续传:" << partPath;
+        return false;
+    }
+    if (!file.open(QIODevice::ReadWrite | QIODevice::Unbuffered)) {
+        qDebug() << "无法打开临时文件:" << partPath << file.errorString();
+        return false;
+    }
+
+    stride = chunkSize;
+    if (receivedBits.size() == totalChunks) received = receivedBits;
+    receivedChunks = int(received.count(true));
+    lastActivity = QDateTime::currentMSecsSinceEpoch();
+    return true;
+}
+
+// 分块在文件中的偏移：第 i 块位于 i * 分块大小
+// 旧协议的 file_chunk 不携带名义分块大小，用非最后一块的长度确定；
+// 先收到最后一块时用 (文件大小 - 最后一块长度) / (分块数 - 1) 推算
+qint64 IncomingFile::chunkOffset(int chunkIndex, qint64 dataSize, qint64 chunkSize)
+{
+    if (stride == 0) {
+        if (chunkSize > 0) {
+            stride = chunkSize;
+        } else if (chunkIndex < totalChunks - 1) {
+            stride = dataSize;
+        } else if (totalChunks > 1) {
+            stride = (size - dataSize) / (totalChunks - 1);
+        } else {
+            stride = dataSize;
+        }
+    }
+    return qint64(chunkIndex) * stride;
+}
+
+IncomingFile::WriteResult IncomingFile::writeChunk(int chunkIndex, QByteArrayView data, qint64 chunkSize)
+{
+    if (!file.isOpen() || chunkIndex < 0 || chunkIndex >= totalChunks) return WriteFailed;
+
+    // 补发或多条路径可能送来同一分块，只写第一次
+    if (received.testBit(chunkIndex)) return Duplicate;
+
+    qint64 offset = chunkOffset(chunkIndex, data.size(), chunkSize);
+    if (offset + data.size() > size) {
+        qDebug() << "分块超出文件范围:" << name << "分块" << chunkIndex;
+        return WriteFailed;
+    }
+
+    if (!file.seek(offset) || file.write(data.data(), data.size()) != data.size()) {
+        qDebug() << "写入分块失败:" << name << "分块" << chunkIndex << file.errorString();
+        return WriteFailed;
+    }
+
+    received.setBit(chunkIndex);
+    receivedChunks++;
+    lastActivity = QDateTime::currentMSecsSinceEpoch();
+    return Written;
+}
+
+QList<QPair<int, int>> IncomingFile::missingRanges(int limit) const
+{
+    QList<QPair<int, int>> ranges;
+    int end = (limit < 0 || limit > totalChunks) ? totalChunks : limit;
+    int start = -1;
+    for (int i = 0; i < end; ++i) {
+        if (!received.testBit(i)) {
+            if (start < 0) start = i;
+        } else if (start >= 0) {
+            ranges.append(qMakePair(start, i - start));
+            start = -1;
+        }
+    }
+    if (start >= 0) ranges.append(qMakePair(start, end - start));
+    return ranges;
+}
+
+qint64 IncomingFile::idleMsecs() const
+{
+    return QDateTime::currentMSecsSinceEpoch() - lastActivity;
+}
+
+void IncomingFile::noteResendRequested()
+{
+    resendCount++;
+    lastActivity = QDateTime::currentMSecsSinceEpoch();
+}
+
+bool IncomingFile::finish(const QString &finalPath)
+{
+    file.close();
+    if (!file.rename(finalPath)) {
+        qDebug() << "重命名临时文件失败:" << file.fileName() << "->" << finalPath << file.errorString();
+        return false;
+    }
+    return true;
+}
+
+void IncomingFile::abort()
+{
+    if (file.isOpen()) file.close();
+    file.remove();
+}
@@ -0,0 +1,85 @@
+#ifndef INCOMINGFILE_H
+#define INCOMINGFILE_H
+
+#include <QString>
+#include <QFile>
+#include <QByteArrayView>
+#include <QBitArray>
+#include <QList>
+#include <QPair>
+
+// 正在接收的文件
+// 分块按序号直接写入预分配的 .part 临时文件，完成后重命名为最终文件名，
+// 内存占用与文件大小无关。已收到的分块记录在位图中，重复分块被丢弃，
+// 缺失的分块以区间形式列出，用于请求发送方补发
+class IncomingFile
+{
+public:
+    enum WriteResult {
+        Written,
+        Duplicate,
+        WriteFailed
+    };
+
+    IncomingFile(const QString &fileId, const QString &fileName, qint64 fileSize, int totalChunks,
+                 const QString &sender, const QString &targetUser);
+    ~IncomingFile();
+
+    // 在 saveDir 中创建临时文件并预分配 fileSize 字节
+    bool open(const QString &saveDir);
+    // 断线或重启后继续接收：打开已有的临时文件（不截断），恢复分块大小和位图
+    bool resume(const QString &partPath, qint64 chunkSize, const QBitArray &receivedBits);
+
+    // 把分块写到它在文件中的位置
+    // chunkSize 为发送方的分块大小，未知时传 0，由非最后一块的长度推断
+    WriteResult writeChunk(int chunkIndex, QByteArrayView data, qint64 chunkSize = 0);
+
+    bool isComplete() const { return receivedChunks >= totalChunks; }
+    int chunksReceived() const { return receivedChunks; }
+    bool hasChunk(int chunkIndex) const { return received.testBit(chunkIndex); }
+    const QBitArray &receivedBitmap() const { return received; }
+    qint64 chunkSize() const { return stride; }
+
+    // 缺失的分块区间（起始序号, 数量），只统计 [0, limit) 范围，limit < 0 表示全部
+    QList<QPair<int, int>> missingRanges(int limit = -1) const;
+
+    // 距离上一次写入分块的毫秒数，用来判断发送是否已经停止
+    qint64 idleMsecs() const;
+    // 已经为这个文件请求补发的次数
+    int resendRequests() const { return resendCount; }
+    void noteResendRequested();
+    void resetResendRequests() { resendCount = 0; }
+
+    // 关闭临时文件并重命名为 finalPath，失败时返回 false
+    bool finish(const QString &finalPath);
+    // 放弃接收，删除临时文件
+    void abort();
+
+    QString fileId() const { return id; }
+    QString fileName() const { return name; }
+    qint64 fileSize() const { return size; }
+    int chunkCount() const { return totalChunks; }
+    QString sender() const { return from; }
+    QString targetUser() const { return target; }
+    QString partPath() const { return file.fileName(); }
+    QString errorString() const { return file.errorString(); }
+
+private:
+    qint64 chunkOffset(int chunkIndex, qint64 dataSize, qint64 chunkSize);
+
+    QString id;
+    QString name;
+    qint64 size;
+    int totalChunks;
+    QString from;
+    QString target;
+
+    QFile file;
+    qint64 stride;          // 分块大小，0 表示尚未确定
+    QBitArray received;     // 每个分块是否已写入
+    int receivedChunks;
+    qint64 lastActivity;    // 上一次写入或请求补发的时间（毫秒）
+    int resendCount;
+};
+
+#endif // INCOMINGFILE_H
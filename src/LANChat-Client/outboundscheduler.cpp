@@ -0,0 +1,191 @@
+#include "outboundscheduler.h"
+#include <QDebug>
+
+quint64 OutboundScheduler::nextId = 1;
+
+OutboundScheduler::OutboundScheduler(QTcpSocket *socket, qint64 bulkQuantum, QObject *parent)
+    : QObject(parent)
+    , socket(socket)
+    , bulkQuantum(bulkQuantum)
+    , bulkQueuedBytes(0)
+    , bytesQueued(0)
+    , coalesce(true)
+    , socketWrites(0)
+    , socketFlushes(0)
+{
+    clock.start();
+    connect(socket, &QTcpSocket::bytesWritten, this, &OutboundScheduler::onBytesWritten);
+
+    batchTimer.setSingleShot(true);
+    batchTimer.setInterval(0);
+    connect(&batchTimer, &QTimer::timeout, this, &OutboundScheduler::flushBatch);
+
+    // 小帧已经在这里合并，Nagle 算法只会让聊天消息多等一个往返（遇上延迟确认时更久）
+    auto setLowDelay = [this]() {
+        this->socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+    };
+    if (socket->state() == QAbstractSocket::ConnectedState) setLowDelay();
+    connect(socket, &QTcpSocket::connected, this, setLowDelay);
+}
+
+quint64 OutboundScheduler::enqueue(Lane lane, const QByteArray &frame)
+{
+    Pending pending;
+    pending.id = nextId++;
+    pending.lane = lane;
+    pending.data = frame;
+    pending.enqueuedUsecs = nowUsecs();
+    pending.endOffset = 0;
+
+    if (lane == Bulk) bulkQueuedBytes += frame.size();
+    laneStats[lane].queued++;
+    lanes[lane].enqueue(pending);
+    pump();
+    return pending.id;
+}
+
+// 交互帧总是先写（合并到本轮的 batch）；批量帧只在套接字积压低于 bulkQuantum 时写一帧，
+// 剩下的等下一次 bytesWritten
+void OutboundScheduler::pump()
+{
+    if (socket->state() != QAbstractSocket::ConnectedState) return;
+
+    while (true) {
+        if (!lanes[Interactive].isEmpty()) {
+            if (coalesce) {
+                appendToBatch(lanes[Interactive].dequeue());
+            } else {
+                writeFrame(lanes[Interactive].dequeue());
+            }
+        } else if (!lanes[Bulk].isEmpty() && socket->bytesToWrite() + batch.size() < bulkQuantum) {
+            flushBatch();  // 批量帧不能越过之前入队的交互帧
+            Pending frame = lanes[Bulk].dequeue();
+            bulkQueuedBytes -= frame.data.size();
+            writeFrame(frame);
+        } else {
+            break;
+        }
+    }
+
+    if (!batch.isEmpty() && !batchTimer.isActive()) batchTimer.start();
+}
+
+void OutboundScheduler::appendToBatch(Pending frame)
+{
+    batch += frame.data;
+    frame.endOffset = batch.size();
+    frame.data.clear();
+    batchFrames.append(frame);
+    if (batch.size() >= CoalesceBytes) flushBatch();
+}
+
+// 把本轮合并的交互帧一次写入套接字
+void OutboundScheduler::flushBatch()
+{
+    batchTimer.stop();
+    if (batch.isEmpty()) return;
+
+    if (socket->state() != QAbstractSocket::ConnectedState) {
+        // 连接已断开，调用方会 clear()
+        return;
+    }
+
+    socketWrites++;
+    qint64 written = socket->write(batch);
+    if (written < 0) {
+        qDebug() << "写入套接字失败:" << socket->errorString();
+        laneStats[Interactive].queued -= batchFrames.size();
+    } else {
+        for (Pending &frame : batchFrames) {
+            frame.endOffset += bytesQueued;
+            inSocket.enqueue(frame);
+        }
+        bytesQueued += written;
+    }
+    batch.truncate(0);  // 保留容量，下一轮复用
+    batchFrames.clear();
+}
+
+void OutboundScheduler::writeFrame(Pending frame)
+{
+    socketWrites++;
+    qint64 written = socket->write(frame.data);
+    if (written < 0) {
+        qDebug() << "写入套接字失败:" << socket->errorString();
+        laneStats[frame.lane].queued--;
+        return;
+    }
+    bytesQueued += written;
+    frame.endOffset = bytesQueued;
+    frame.data.clear();     // 数据已经拷贝进套接字缓冲区
+    inSocket.enqueue(frame);
+}
+
+void OutboundScheduler::onBytesWritten(qint64 bytes)
+{
+    Q_UNUSED(bytes);
+    socketFlushes++;
+
+    // 已离开套接字缓冲区的位置，不依赖信号携带的字节数累加
+    qint64 flushedOffset = bytesQueued - socket->bytesToWrite();
+    qint64 now = nowUsecs();
+    QList<quint64> sent;
+    while (!inSocket.isEmpty() && inSocket.head().endOffset <= flushedOffset) {
+        Pending frame = inSocket.dequeue();
+        LaneStats &stats = laneStats[frame.lane];
+        qint64 delay = now - frame.enqueuedUsecs;
+        stats.frames++;
+        stats.queued--;
+        stats.totalDelayUsecs += delay;
+        stats.maxDelayUsecs = qMax(stats.maxDelayUsecs, delay);
+        sent.append(frame.id);
+    }
+
+    pump();
+
+    for (quint64 id : std::as_const(sent)) emit frameSent(id);
+    emit flushed();
+}
+
+void OutboundScheduler::flushBulk()
+{
+    flushBatch();
+    while (!lanes[Bulk].isEmpty()) {
+        Pending frame = lanes[Bulk].dequeue();
+        bulkQueuedBytes -= frame.data.size();
+        writeFrame(frame);
+    }
+}
+
+void OutboundScheduler::setCoalescing(bool enabled)
+{
+    if (!enabled) flushBatch();
+    coalesce = enabled;
+}
+
+void OutboundScheduler::clear()
+{
+    for (auto &lane : lanes) lane.clear();
+    inSocket.clear();
+    batchTimer.stop();
+    batch.clear();
+    batchFrames.clear();
+    bulkQueuedBytes = 0;
+    bytesQueued = 0;
+    laneStats[Interactive].queued = 0;
+    laneStats[Bulk].queued = 0;
+}
+
+QString OutboundScheduler::statsSummary() const
+{
+    auto describe = [](const char *name, const LaneStats &stats) {
+        return QString("%1: %2 帧，平均排队 %3 ms，最长 %4 ms，排队中 %5")
+            .arg(name)
+            .arg(stats.frames)
+            .arg(stats.averageDelayMsecs(), 0, 'f', 2)
+            .arg(double(stats.maxDelayUsecs) / 1000.0, 0, 'f', 2)
+            .arg(stats.queued);
+    };
+    return describe("聊天", laneStats[Interactive]) + "\n" + describe("文件", laneStats[Bulk])
+           + QString("\n写入 %1 次，交给系统 %2 次").arg(socketWrites).arg(socketFlushes);
+}
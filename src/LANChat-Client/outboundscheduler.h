@@ -0,0 +1,108 @@
+#ifndef OUTBOUNDSCHEDULER_H
+#define OUTBOUNDSCHEDULER_H
+
+#include <QObject>
+#include <QQueue>
+#include <QElapsedTimer>
+#include <QTcpSocket>
+#include <QTimer>
+
+// 发送调度：聊天消息和文件数据分成两条队列
+//   交互队列 - 聊天、命令等小消息，同一轮事件循环内的帧合并成一次写入
+//   批量队列 - 文件分块，只在套接字缓冲区积压低于 bulkQuantum 时写入一帧
+// 因此任何交互消息前面最多只有 bulkQuantum + 一个分块帧的文件数据。
+// 合并由这里完成，套接字设置 TCP_NODELAY，小消息不再被 Nagle 算法推迟。
+// 每帧记录从入队到离开套接字缓冲区的时间，按队列统计排队延迟
+class OutboundScheduler : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Lane {
+        Interactive = 0,
+        Bulk = 1
+    };
+
+    struct LaneStats {
+        quint64 frames = 0;         // 已发出的帧数
+        qint64 bytes = 0;
+        qint64 totalDelayUsecs = 0;
+        qint64 maxDelayUsecs = 0;
+        int queued = 0;             // 仍在队列或套接字缓冲区中的帧数
+        double averageDelayMsecs() const
+        {
+            return frames ? double(totalDelayUsecs) / double(frames) / 1000.0 : 0.0;
+        }
+    };
+
+    // bulkQuantum: 套接字缓冲区中允许积压的文件数据，只传文件的连接可以设得更大
+    explicit OutboundScheduler(QTcpSocket *socket, qint64 bulkQuantum = DefaultBulkQuantum,
+                               QObject *parent = nullptr);
+
+    // 加入队列并尽快写出，返回帧 ID（所有调度器之间唯一），离开套接字缓冲区时通过 frameSent 通知
+    quint64 enqueue(Lane lane, const QByteArray &frame);
+
+    // 批量队列中尚未写入套接字的字节数，加上套接字缓冲区中的积压
+    qint64 bulkBacklog() const { return bulkQueuedBytes + socket->bytesToWrite(); }
+
+    // 立即把批量队列全部写入套接字，切换分帧方式之前调用，保证切换前后的字节顺序
+    void flushBulk();
+
+    // 断开连接时丢弃所有排队的数据
+    void clear();
+
+    // 是否合并交互帧，关闭时每帧单独写入套接字（用于基准测试）
+    void setCoalescing(bool enabled);
+    bool coalescing() const { return coalesce; }
+
+    quint64 writeCount() const { return socketWrites; }    // 调用 QTcpSocket::write 的次数
+    quint64 flushCount() const { return socketFlushes; }   // bytesWritten 次数，即数据交给系统的次数
+
+    LaneStats stats(Lane lane) const { return laneStats[lane]; }
+    QString statsSummary() const;
+
+    // 聊天连接上允许的文件数据积压，决定聊天消息最坏情况下的额外延迟
+    static constexpr qint64 DefaultBulkQuantum = 64 * 1024;
+    // 合并的交互帧达到这个大小时不等本轮结束，立即写入
+    static constexpr qint64 CoalesceBytes = 16 * 1024;
+
+signals:
+    void frameSent(quint64 id);     // 该帧已离开套接字缓冲区（交给系统）
+    void flushed();                 // 处理完一次 bytesWritten，批量队列可能有空位
+
+private slots:
+    void onBytesWritten(qint64 bytes);
+    void flushBatch();
+
+private:
+    struct Pending {
+        quint64 id;
+        Lane lane;
+        QByteArray data;
+        qint64 enqueuedUsecs;
+        qint64 endOffset;           // 写入套接字后在 bytesQueued 计数中的结束位置
+    };
+
+    void pump();
+    void writeFrame(Pending frame);
+    void appendToBatch(Pending frame);
+    qint64 nowUsecs() const { return clock.nsecsElapsed() / 1000; }
+
+    QTcpSocket *socket;
+    qint64 bulkQuantum;
+    QQueue<Pending> lanes[2];       // 尚未写入套接字的帧
+    QQueue<Pending> inSocket;       // 已写入套接字、尚未发出的帧，按写入顺序
+    qint64 bulkQueuedBytes;
+    qint64 bytesQueued;             // 写入套接字的总字节数
+    QByteArray batch;               // 本轮合并的交互帧，endOffset 暂时为在 batch 中的结束位置
+    QList<Pending> batchFrames;
+    QTimer batchTimer;              // 0 间隔，本轮事件循环结束时写出 batch
+    bool coalesce;
+    quint64 socketWrites;
+    quint64 socketFlushes;
+    static quint64 nextId;
+    LaneStats laneStats[2];
+    QElapsedTimer clock;
+};
+
+#endif // OUTBOUNDSCHEDULER_H
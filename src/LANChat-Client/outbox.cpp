@@ -0,0 +1,84 @@
+#include "outbox.h"
+#include <QDir>
+#include <QFile>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QDebug>
+
+Outbox::Outbox(QObject *parent)
+    : QObject(parent)
+{
+}
+
+QString Outbox::outboxPath() const
+{
+    QString dir = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
+    QDir().mkpath(dir);
+    return dir + "/outbox.json";
+}
+
+void Outbox::load()
+{
+    QFile file(outboxPath());
+    if (!file.open(QIODevice::ReadOnly)) return;
+
+    items.clear();
+    for (const QJsonValue &value : QJsonDocument::fromJson(file.readAll()).array()) {
+        QJsonObject obj = value.toObject();
+        Item item;
+        item.kind = obj["kind"].toString() == "file" ? Item::File : Item::Message;
+        item.message = obj["message"].toObject();
+        item.filePath = obj["file_path"].toString();
+        item.targetUser = obj["target"].toString();
+        item.queued = QDateTime::fromMSecsSinceEpoch(obj["queued"].toVariant().toLongLong());
+        if (item.kind == Item::File ? item.filePath.isEmpty() : item.message.isEmpty()) continue;
+        items.append(item);
+    }
+}
+
+bool Outbox::enqueue(const Item &item)
+{
+    if (items.size() >= MaxItems) return false;
+    items.append(item);
+    save();
+    return true;
+}
+
+QList<Outbox::Item> Outbox::takeAll()
+{
+    QList<Item> taken;
+    taken.swap(items);
+    if (!taken.isEmpty()) save();
+    return taken;
+}
+
+// 每次变化都立即写盘，消息很短，发件箱通常只有几条
+void Outbox::save()
+{
+    QJsonArray array;
+    for (const Item &item : std::as_const(items)) {
+        QJsonObject obj;
+        obj["kind"] = item.kind == Item::File ? "file" : "message";
+        if (item.kind == Item::File) {
+            obj["file_path"] = item.filePath;
+            obj["target"] = item.targetUser;
+        } else {
+            obj["message"] = item.message;
+        }
+        obj["queued"] = item.queued.toMSecsSinceEpoch();
+        array.append(obj);
+    }
+
+    // QSaveFile 先写临时文件再替换，写到一半崩溃也不会丢掉已排队的消息
+    QSaveFile file(outboxPath());
+    if (!file.open(QIODevice::WriteOnly)) {
+        qDebug() << "无法写入发件箱:" << file.errorString();
+        return;
+    }
+    file.write(QJsonDocument(array).toJson(QJsonDocument::Compact));
+    if (!file.commit()) {
+        qDebug() << "无法写入发件箱:" << file.errorString();
+    }
+}
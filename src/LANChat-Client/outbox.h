@@ -0,0 +1,49 @@
+#ifndef OUTBOX_H
+#define OUTBOX_H
+
+#include <QObject>
+#include <QList>
+#include <QJsonObject>
+#include <QDateTime>
+
+// 离线发件箱：未连接时发出的消息和文件按顺序保存在应用数据目录中，
+// 重连（或重启后连接）时由 Widget 一次取出，按原顺序发送
+class Outbox : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Item {
+        enum Kind {
+            Message = 0,    // message 为完整的 JSON 消息（text / private）
+            File = 1        // filePath 和 targetUser 描述一次 sendFile
+        };
+        Kind kind = Message;
+        QJsonObject message;
+        QString filePath;
+        QString targetUser;     // 私聊目标，群发时为空
+        QDateTime queued;
+    };
+
+    explicit Outbox(QObject *parent = nullptr);
+
+    void load();
+
+    // 加入队尾并立即写盘；超过 MaxItems 时返回 false
+    bool enqueue(const Item &item);
+    // 取出全部条目（按加入顺序）并清空
+    QList<Item> takeAll();
+
+    bool isEmpty() const { return items.isEmpty(); }
+    int size() const { return items.size(); }
+
+    static constexpr int MaxItems = 1000;
+
+private:
+    void save();
+    QString outboxPath() const;
+
+    QList<Item> items;
+};
+
+#endif // OUTBOX_H
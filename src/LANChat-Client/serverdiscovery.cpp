@@ -0,0 +1,81 @@
+#include "serverdiscovery.h"
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QNetworkDatagram>
+#include <QRandomGenerator>
+#include <QDebug>
+
+ServerDiscovery::ServerDiscovery(QObject *parent)
+    : QObject(parent)
+    , socket(new QUdpSocket(this))
+{
+    windowTimer.setSingleShot(true);
+    connect(&windowTimer, &QTimer::timeout, this, &ServerDiscovery::onWindowElapsed);
+    connect(socket, &QUdpSocket::readyRead, this, &ServerDiscovery::onReadyRead);
+}
+
+void ServerDiscovery::start(int windowMsecs)
+{
+    if (socket->state() != QAbstractSocket::BoundState
+        && !socket->bind(QHostAddress::AnyIPv4, 0)) {
+        qDebug() << "服务发现无法绑定端口:" << socket->errorString();
+        emit finished(QList<Server>());
+        return;
+    }
+
+    servers.clear();
+    nonce = QByteArray::number(QRandomGenerator::global()->generate64(), 16);
+    QJsonObject probe;
+    probe["type"] = "lanchat_discover";
+    probe["nonce"] = QString::fromLatin1(nonce);
+    QByteArray datagram = QJsonDocument(probe).toJson(QJsonDocument::Compact);
+
+    // 组播能跨越交换机的广播过滤，广播兼容不转发组播的网络，本机覆盖在同一台机器上运行的服务器
+    clock.start();
+    socket->writeDatagram(datagram, QHostAddress(QString::fromLatin1(DiscoveryGroup)), DiscoveryPort);
+    socket->writeDatagram(datagram, QHostAddress::Broadcast, DiscoveryPort);
+    socket->writeDatagram(datagram, QHostAddress::LocalHost, DiscoveryPort);
+    windowTimer.start(windowMsecs);
+}
+
+void ServerDiscovery::stop()
+{
+    windowTimer.stop();
+    servers.clear();
+}
+
+void ServerDiscovery::onReadyRead()
+{
+    while (socket->hasPendingDatagrams()) {
+        QNetworkDatagram datagram = socket->receiveDatagram();
+        if (!windowTimer.isActive()) continue;
+
+        QJsonObject reply = QJsonDocument::fromJson(datagram.data()).object();
+        if (reply["type"].toString() != "lanchat_server"
+            || reply["nonce"].toString().toLatin1() != nonce) {
+            continue;
+        }
+
+        Server server;
+        server.address = QHostAddress(datagram.senderAddress().toIPv4Address());
+        server.port = quint16(reply["port"].toInt());
+        server.name = reply["name"].toString();
+        server.users = reply["users"].toInt();
+        server.rttUsecs = clock.nsecsElapsed() / 1000;
+        if (server.port == 0) continue;
+
+        // 同一个服务器会分别回答组播、广播和本机探测，只保留最先到达的
+        bool seen = false;
+        for (const Server &known : std::as_const(servers)) {
+            if (known.address == server.address && known.port == server.port) seen = true;
+        }
+        if (!seen) servers.append(server);
+    }
+}
+
+void ServerDiscovery::onWindowElapsed()
+{
+    QList<Server> found = servers;
+    servers.clear();
+    emit finished(found);
+}
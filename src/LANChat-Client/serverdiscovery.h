@@ -0,0 +1,54 @@
+#ifndef SERVERDISCOVERY_H
+#define SERVERDISCOVERY_H
+
+#include <QObject>
+#include <QUdpSocket>
+#include <QHostAddress>
+#include <QElapsedTimer>
+#include <QTimer>
+#include <QList>
+
+// 局域网服务发现：向组播地址、广播地址和本机各发一次探测，
+// 收集窗口时间内回答的服务器，按往返时间排序后通过 finished 交给调用方
+// 协议见服务器的 Discovery.ts
+class ServerDiscovery : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Server {
+        QHostAddress address;
+        quint16 port = 0;
+        QString name;
+        int users = 0;
+        qint64 rttUsecs = 0;    // 从发出探测到收到回答
+    };
+
+    explicit ServerDiscovery(QObject *parent = nullptr);
+
+    // 发出探测，windowMsecs 后发出 finished；正在进行时重新开始
+    void start(int windowMsecs = DefaultWindowMsecs);
+    void stop();
+    bool isRunning() const { return windowTimer.isActive(); }
+
+    static constexpr quint16 DiscoveryPort = 8890;
+    static constexpr const char *DiscoveryGroup = "239.255.77.88";
+    // 局域网内的回答在几毫秒内到达，窗口只是给较慢的主机留出余量
+    static constexpr int DefaultWindowMsecs = 100;
+
+signals:
+    void finished(const QList<ServerDiscovery::Server> &servers);  // 往返时间从短到长
+
+private slots:
+    void onReadyRead();
+    void onWindowElapsed();
+
+private:
+    QUdpSocket *socket;
+    QTimer windowTimer;
+    QElapsedTimer clock;
+    QByteArray nonce;           // 本次探测的随机数，丢弃上一次探测迟到的回答
+    QList<Server> servers;      // 按到达顺序，也就是往返时间顺序
+};
+
+#endif // SERVERDISCOVERY_H
@@ -0,0 +1,120 @@
+#include "thumbnailcache.h"
+#include "blobcache.h"
+#include "imagesniffer.h"
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QImageReader>
+#include <QMutexLocker>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QDebug>
+#include <QtMath>
+
+ThumbnailCache::ThumbnailCache()
+    : memory(int(MemoryBytes / 1024))     // 代价按 KB 计
+    , directory(QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/thumbnails")
+{
+    QDir().mkpath(directory);
+    trimDisk();
+}
+
+QImage ThumbnailCache::thumbnail(const QString &path, int maxEdge, qreal dpr)
+{
+    const QString sha256 = contentHash(path);
+    if (sha256.isEmpty()) return decode(path, maxEdge, dpr);
+
+    const QString key = QString("%1_%2@%3").arg(sha256).arg(maxEdge).arg(qRound(dpr * 100));
+    {
+        QMutexLocker locker(&mutex);
+        if (QImage *cached = memory.object(key)) return *cached;
+    }
+
+    QImage image;
+    const QString cachedPath = diskPath(key);
+    if (image.load(cachedPath, "PNG")) {
+        image.setDevicePixelRatio(dpr);
+        // 更新修改时间，磁盘缓存按它淘汰
+        QFile touched(cachedPath);
+        if (touched.open(QIODevice::Append)) {
+            touched.setFileTime(QDateTime::currentDateTime(), QFileDevice::FileModificationTime);
+        }
+    } else {
+        image = decode(path, maxEdge, dpr);
+        if (image.isNull()) return image;
+        QSaveFile file(cachedPath);
+        if (!file.open(QIODevice::WriteOnly) || !image.save(&file, "PNG") || !file.commit()) {
+            qWarning() << "无法写入缩略图缓存:" << cachedPath;
+        }
+    }
+
+    QMutexLocker locker(&mutex);
+    memory.insert(key, new QImage(image), qMax(1, int(image.sizeInBytes() / 1024)));
+    return image;
+}
+
+QString ThumbnailCache::contentHash(const QString &path)
+{
+    QFileInfo info(path);
+    if (!info.exists()) return QString();
+    const qint64 modified = info.lastModified().toMSecsSinceEpoch();
+    {
+        QMutexLocker locker(&mutex);
+        auto it = hashes.constFind(path);
+        if (it != hashes.constEnd() && it->size == info.size() && it->modified == modified) return it->sha256;
+    }
+
+    // 只读不解码；在调用线程中计算，不持有锁
+    HashEntry entry;
+    entry.size = info.size();
+    entry.modified = modified;
+    entry.sha256 = BlobCache::hashFile(path);
+    if (entry.sha256.isEmpty()) return QString();
+
+    QMutexLocker locker(&mutex);
+    hashes.insert(path, entry);
+    return entry.sha256;
+}
+
+QString ThumbnailCache::diskPath(const QString &key) const
+{
+    return directory + "/" + key + ".png";
+}
+
+// 启动时按修改时间从旧到新删除，直到总大小回到上限以内
+void ThumbnailCache::trimDisk()
+{
+    QFileInfoList files = QDir(directory).entryInfoList({"*.png"}, QDir::Files, QDir::Time | QDir::Reversed);
+    qint64 total = 0;
+    for (const QFileInfo &file : files) total += file.size();
+    for (const QFileInfo &file : files) {
+        if (total <= DiskBytes) break;
+        total -= file.size();
+        QFile::remove(file.absoluteFilePath());
+    }
+}
+
+QImage ThumbnailCache::decode(const QString &path, int maxEdge, qreal dpr)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) return QImage();
+    ImageSniffer::Info info = ImageSniffer::probe(&file);
+    if (!info.isImage()) return QImage();
+
+    const int edge = qCeil(maxEdge * dpr);
+    QImageReader reader(&file, info.format);
+    reader.setDecideFormatFromContent(false);
+    QImage image;
+    if (info.size.isValid() && !info.size.isEmpty()) {
+        // 按缩小后的尺寸直接解码（JPEG 等格式只解码需要的分辨率）
+        reader.setScaledSize(info.size.scaled(edge, edge, Qt::KeepAspectRatio));
+        reader.setQuality(100);     // 缩放时用平滑插值
+        image = reader.read();
+    } else {
+        // 有的格式读不出文件头中的尺寸，完整解码后再缩放
+        image = reader.read();
+        if (!image.isNull()) image = image.scaled(edge, edge, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    }
+    if (!image.isNull()) image.setDevicePixelRatio(dpr);
+    return image;
+}
@@ -0,0 +1,45 @@
+#ifndef THUMBNAILCACHE_H
+#define THUMBNAILCACHE_H
+
+#include <QCache>
+#include <QHash>
+#include <QImage>
+#include <QMutex>
+#include <QSize>
+#include <QString>
+
+// 缩略图缓存，按图片内容的 SHA-256、最大边长和设备像素比寻址：
+//   内存 - 最近用过的缩略图（LRU，按像素字节计）
+//   磁盘 - 应用数据目录的 thumbnails/ 下的 PNG，重启后仍然有效，总大小超过上限时删除最旧的
+// 都没有时才按缩小后的尺寸解码原图并写回两级缓存。同一内容的图片（换了文件名或重复发送）
+// 共用一份缩略图。可以在多个线程中同时调用
+class ThumbnailCache
+{
+public:
+    static constexpr qint64 MemoryBytes = 32LL * 1024 * 1024;
+    static constexpr qint64 DiskBytes = 128LL * 1024 * 1024;
+
+    ThumbnailCache();
+
+    // 最大边长为 maxEdge（逻辑像素）的缩略图，图片按 dpr 倍的像素解码并设置 devicePixelRatio；
+    // 不是图片或解码失败时返回空
+    QImage thumbnail(const QString &path, int maxEdge, qreal dpr);
+
+private:
+    QString contentHash(const QString &path);
+    QString diskPath(const QString &key) const;
+    void trimDisk();
+    static QImage decode(const QString &path, int maxEdge, qreal dpr);
+
+    QMutex mutex;
+    QCache<QString, QImage> memory;     // 键 -> 缩略图
+    struct HashEntry {
+        qint64 size = 0;
+        qint64 modified = 0;
+        QString sha256;
+    };
+    QHash<QString, HashEntry> hashes;   // 路径 -> 内容哈希，文件大小和修改时间不变时不再重新计算
+    QString directory;
+};
+
+#endif // THUMBNAILCACHE_H
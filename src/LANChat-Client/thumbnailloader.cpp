@@ -0,0 +1,36 @@
+#include "thumbnailloader.h"
+#include <QThread>
+
+ThumbnailLoader::ThumbnailLoader(QObject *parent)
+    : QObject(parent)
+    , nextId(0)
+    , dpr(1.0)
+{
+    // 留一个核给编码流水线和 GUI
+    pool.setMaxThreadCount(qMax(1, QThread::idealThreadCount() / 2));
+}
+
+ThumbnailLoader::~ThumbnailLoader()
+{
+    pool.clear();
+    pool.waitForDone();
+}
+
+quint64 ThumbnailLoader::request(const QString &path)
+{
+    const quint64 id = ++nextId;
+    const qreal ratio = dpr;
+    pool.start([this, id, path, ratio]() {
+        QImage image = cache.thumbnail(path, MaxEdge, ratio);
+        QMetaObject::invokeMethod(this, [this, id, image]() {
+            emit thumbnailReady(id, image);
+        }, Qt::QueuedConnection);
+    });
+    return id;
+}
+
+QSize ThumbnailLoader::displaySize(const QSize &original)
+{
+    if (!original.isValid() || original.isEmpty()) return QSize();
+    return original.scaled(MaxEdge, MaxEdge, Qt::KeepAspectRatio);
+}
@@ -0,0 +1,42 @@
+#ifndef THUMBNAILLOADER_H
+#define THUMBNAILLOADER_H
+
+#include <QObject>
+#include <QImage>
+#include <QSize>
+#include <QThreadPool>
+#include "thumbnailcache.h"
+
+// 聊天窗口中的图片缩略图在线程池中生成：先查 ThumbnailCache，没有时按缩小后的尺寸解码，
+// 完成后在 GUI 线程发出 thumbnailReady，调用方按请求号放回聊天记录
+class ThumbnailLoader : public QObject
+{
+    Q_OBJECT
+
+public:
+    static constexpr int MaxEdge = 200;     // 缩略图的最大宽高
+
+    explicit ThumbnailLoader(QObject *parent = nullptr);
+    ~ThumbnailLoader();
+
+    // 提交解码请求，返回非 0 的请求号
+    quint64 request(const QString &path);
+
+    // 缩略图按 dpr 倍的像素生成，高分屏上不模糊
+    void setDevicePixelRatio(qreal ratio) { dpr = qMax<qreal>(1.0, ratio); }
+
+    // 缩略图的显示尺寸（逻辑像素），original 无效时返回无效 QSize
+    static QSize displaySize(const QSize &original);
+
+signals:
+    // 解码失败时 image 为空
+    void thumbnailReady(quint64 id, const QImage &image);
+
+private:
+    ThumbnailCache cache;       // 工作线程共用
+    QThreadPool pool;
+    quint64 nextId;
+    qreal dpr;
+};
+
+#endif // THUMBNAILLOADER_H
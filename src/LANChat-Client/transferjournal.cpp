@@ -0,0 +1,260 @@
+#include "transferjournal.h"
+#include <QDir>
+#include <QFile>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QDebug>
+#include <algorithm>
+
+namespace {
+
+QByteArray bitsToBytes(const QBitArray &bits)
+{
+    QByteArray bytes((bits.size() + 7) / 8, '\0');
+    for (qsizetype i = 0; i < bits.size(); ++i) {
+        if (bits.testBit(i)) bytes[i / 8] = char(bytes[i / 8] | (1 << (i % 8)));
+    }
+    return bytes;
+}
+
+QBitArray bytesToBits(const QByteArray &bytes, int size)
+{
+    QBitArray bits(size);
+    for (int i = 0; i < size && i / 8 < bytes.size(); ++i) {
+        if (bytes[i / 8] & (1 << (i % 8))) bits.setBit(i);
+    }
+    return bits;
+}
+
+} // namespace
+
+TransferJournal::TransferJournal(QObject *parent)
+    : QObject(parent)
+{
+    saveTimer.setSingleShot(true);
+    saveTimer.setInterval(1000);
+    connect(&saveTimer, &QTimer::timeout, this, &TransferJournal::save);
+}
+
+TransferJournal::~TransferJournal()
+{
+    if (saveTimer.isActive()) save();
+}
+
+QString TransferJournal::journalPath() const
+{
+    QString dir = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
+    QDir().mkpath(dir);
+    return dir + "/transfers.json";
+}
+
+void TransferJournal::load()
+{
+    QFile file(journalPath());
+    if (!file.open(QIODevice::ReadOnly)) return;
+
+    QJsonObject root = QJsonDocument::fromJson(file.readAll()).object();
+
+    for (const QJsonValue &value : root["outgoing"].toArray()) {
+        QJsonObject obj = value.toObject();
+        Outgoing entry;
+        entry.fileId = obj["file_id"].toString();
+        entry.filePath = obj["file_path"].toString();
+        entry.fileName = obj["file_name"].toString();
+        entry.targetUser = obj["target"].toString();
+        entry.fileSize = obj["file_size"].toVariant().toLongLong();
+        entry.modified = QDateTime::fromMSecsSinceEpoch(obj["modified"].toVariant().toLongLong());
+        entry.totalChunks = obj["total_chunks"].toInt();
+        entry.sentUpTo = obj["sent_up_to"].toInt();
+        entry.finished = obj["finished"].toBool();
+        entry.updated = QDateTime::fromMSecsSinceEpoch(obj["updated"].toVariant().toLongLong());
+        if (!entry.fileId.isEmpty()) outgoingEntries.insert(entry.fileId, entry);
+    }
+
+    for (const QJsonValue &value : root["incoming"].toArray()) {
+        QJsonObject obj = value.toObject();
+        Incoming entry;
+        entry.fileId = obj["file_id"].toString();
+        entry.sender = obj["sender"].toString();
+        entry.fileName = obj["file_name"].toString();
+        entry.targetUser = obj["target"].toString();
+        entry.partPath = obj["part_path"].toString();
+        entry.fileSize = obj["file_size"].toVariant().toLongLong();
+        entry.chunkSize = obj["chunk_size"].toVariant().toLongLong();
+        entry.totalChunks = obj["total_chunks"].toInt();
+        entry.received = bytesToBits(QByteArray::fromBase64(obj["received"].toString().toLatin1()),
+                                     entry.totalChunks);
+        entry.updated = QDateTime::fromMSecsSinceEpoch(obj["updated"].toVariant().toLongLong());
+        if (!entry.fileId.isEmpty()) incomingEntries.insert(entry.fileId, entry);
+    }
+
+    prune();
+}
+
+void TransferJournal::save()
+{
+    saveTimer.stop();
+
+    QJsonArray outgoingArray;
+    for (const Outgoing &entry : std::as_const(outgoingEntries)) {
+        QJsonObject obj;
+        obj["file_id"] = entry.fileId;
+        obj["file_path"] = entry.filePath;
+        obj["file_name"] = entry.fileName;
+        obj["target"] = entry.targetUser;
+        obj["file_size"] = entry.fileSize;
+        obj["modified"] = entry.modified.toMSecsSinceEpoch();
+        obj["total_chunks"] = entry.totalChunks;
+        obj["sent_up_to"] = entry.sentUpTo;
+        obj["finished"] = entry.finished;
+        obj["updated"] = entry.updated.toMSecsSinceEpoch();
+        outgoingArray.append(obj);
+    }
+
+    QJsonArray incomingArray;
+    for (const Incoming &entry : std::as_const(incomingEntries)) {
+        QJsonObject obj;
+        obj["file_id"] = entry.fileId;
+        obj["sender"] = entry.sender;
+        obj["file_name"] = entry.fileName;
+        obj["target"] = entry.targetUser;
+        obj["part_path"] = entry.partPath;
+        obj["file_size"] = entry.fileSize;
+        obj["chunk_size"] = entry.chunkSize;
+        obj["total_chunks"] = entry.totalChunks;
+        obj["received"] = QString::fromLatin1(bitsToBytes(entry.received).toBase64());
+        obj["updated"] = entry.updated.toMSecsSinceEpoch();
+        incomingArray.append(obj);
+    }
+
+    QJsonObject root;
+    root["outgoing"] = outgoingArray;
+    root["incoming"] = incomingArray;
+
+    // QSaveFile 先写临时文件再替换，写到一半崩溃也不会损坏原日志
+    QSaveFile file(journalPath());
+    if (!file.open(QIODevice::WriteOnly)) {
+        qDebug() << "无法写入传输日志:" << file.errorString();
+        return;
+    }
+    file.write(QJsonDocument(root).toJson(QJsonDocument::Compact));
+    if (!file.commit()) {
+        qDebug() << "保存传输日志失败:" << file.errorString();
+    }
+}
+
+void TransferJournal::scheduleSave()
+{
+    if (!saveTimer.isActive()) saveTimer.start();
+}
+
+void TransferJournal::putOutgoing(const Outgoing &entry)
+{
+    Outgoing copy = entry;
+    copy.updated = QDateTime::currentDateTime();
+    outgoingEntries.insert(copy.fileId, copy);
+    prune();
+    scheduleSave();
+}
+
+void TransferJournal::markSent(const QString &fileId, int sentUpTo)
+{
+    auto it = outgoingEntries.find(fileId);
+    if (it == outgoingEntries.end() || sentUpTo <= it->sentUpTo) return;
+    it->sentUpTo = sentUpTo;
+    it->updated = QDateTime::currentDateTime();
+    scheduleSave();
+}
+
+void TransferJournal::markFinished(const QString &fileId)
+{
+    auto it = outgoingEntries.find(fileId);
+    if (it == outgoingEntries.end()) return;
+    it->sentUpTo = it->totalChunks;
+    it->finished = true;
+    it->updated = QDateTime::currentDateTime();
+    scheduleSave();
+}
+
+const TransferJournal::Outgoing *TransferJournal::findOutgoing(const QString &fileId) const
+{
+    auto it = outgoingEntries.constFind(fileId);
+    return it == outgoingEntries.constEnd() ? nullptr : &it.value();
+}
+
+QList<TransferJournal::Outgoing> TransferJournal::unfinishedOutgoing() const
+{
+    QList<Outgoing> result;
+    for (const Outgoing &entry : outgoingEntries) {
+        if (!entry.finished) result.append(entry);
+    }
+    return result;
+}
+
+void TransferJournal::putIncoming(const Incoming &entry)
+{
+    Incoming copy = entry;
+    copy.updated = QDateTime::currentDateTime();
+    incomingEntries.insert(copy.fileId, copy);
+    scheduleSave();
+}
+
+void TransferJournal::updateReceived(const QString &fileId, const QBitArray &received)
+{
+    auto it = incomingEntries.find(fileId);
+    if (it == incomingEntries.end()) return;
+    it->received = received;
+    it->updated = QDateTime::currentDateTime();
+    scheduleSave();
+}
+
+void TransferJournal::removeIncoming(const QString &fileId)
+{
+    if (incomingEntries.remove(fileId)) scheduleSave();
+}
+
+const TransferJournal::Incoming *TransferJournal::findIncoming(const QString &fileId) const
+{
+    auto it = incomingEntries.constFind(fileId);
+    return it == incomingEntries.constEnd() ? nullptr : &it.value();
+}
+
+// 删除过期条目；发送记录超过上限时按更新时间淘汰最早的已完成条目
+void TransferJournal::prune()
+{
+    QDateTime expiry = QDateTime::currentDateTime().addDays(-ExpireDays);
+
+    for (auto it = incomingEntries.begin(); it != incomingEntries.end();) {
+        if (it->updated < expiry) {
+            QFile::remove(it->partPath);
+            it = incomingEntries.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    for (auto it = outgoingEntries.begin(); it != outgoingEntries.end();) {
+        if (it->updated < expiry) {
+            it = outgoingEntries.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    if (outgoingEntries.size() > MaxOutgoing) {
+        QList<Outgoing> finished;
+        for (const Outgoing &entry : std::as_const(outgoingEntries)) {
+            if (entry.finished) finished.append(entry);
+        }
+        std::sort(finished.begin(), finished.end(), [](const Outgoing &a, const Outgoing &b) {
+            return a.updated < b.updated;
+        });
+        for (const Outgoing &entry : std::as_const(finished)) {
+            if (outgoingEntries.size() <= MaxOutgoing) break;
+            outgoingEntries.remove(entry.fileId);
+        }
+    }
+}
@@ -0,0 +1,79 @@
+#ifndef TRANSFERJOURNAL_H
+#define TRANSFERJOURNAL_H
+
+#include <QObject>
+#include <QHash>
+#include <QBitArray>
+#include <QDateTime>
+#include <QTimer>
+
+// 文件传输日志，按 file_id 记录未完成的发送和接收，保存在应用数据目录中
+// 断线重连或客户端重启后，接收方据此继续写入 .part 文件并只请求缺失的分块，
+// 发送方据此从上次发出的位置继续，并响应补发请求
+class TransferJournal : public QObject
+{
+    Q_OBJECT
+
+public:
+    // 本端发送的文件
+    struct Outgoing {
+        QString fileId;
+        QString filePath;
+        QString fileName;
+        QString targetUser;
+        qint64 fileSize = 0;
+        QDateTime modified;     // 源文件修改时间，文件变化后不再续传
+        int totalChunks = 0;
+        int sentUpTo = 0;       // [0, sentUpTo) 的分块已发出
+        bool finished = false;
+        QDateTime updated;
+    };
+
+    // 本端正在接收的文件
+    struct Incoming {
+        QString fileId;
+        QString sender;
+        QString fileName;
+        QString targetUser;
+        QString partPath;
+        qint64 fileSize = 0;
+        qint64 chunkSize = 0;
+        int totalChunks = 0;
+        QBitArray received;
+        QDateTime updated;
+    };
+
+    explicit TransferJournal(QObject *parent = nullptr);
+    ~TransferJournal();
+
+    void load();
+    void save();
+
+    void putOutgoing(const Outgoing &entry);
+    void markSent(const QString &fileId, int sentUpTo);
+    void markFinished(const QString &fileId);
+    const Outgoing *findOutgoing(const QString &fileId) const;
+    QList<Outgoing> unfinishedOutgoing() const;
+
+    void putIncoming(const Incoming &entry);
+    void updateReceived(const QString &fileId, const QBitArray &received);
+    void removeIncoming(const QString &fileId);
+    const Incoming *findIncoming(const QString &fileId) const;
+    QList<Incoming> incoming() const { return incomingEntries.values(); }
+
+    // 发送记录上限：超过时淘汰最早的已完成条目
+    static constexpr int MaxOutgoing = 64;
+    // 条目保留天数，过期的接收条目连同 .part 文件一起删除
+    static constexpr int ExpireDays = 7;
+
+private:
+    void scheduleSave();
+    void prune();
+    QString journalPath() const;
+
+    QHash<QString, Outgoing> outgoingEntries;
+    QHash<QString, Incoming> incomingEntries;
+    QTimer saveTimer;   // 合并频繁的进度更新，最多每秒写一次磁盘
+};
+
+#endif // TRANSFERJOURNAL_H
@@ -1,14 +1,13 @@
 #include "widget.h"
 #include "ui_widget.h"
+#include "base64codec.h"
+#include "imagesniffer.h"
 #include <QMessageBox>
 #include <QDateTime>
 #include <QThread>
 #include <QHostAddress>
 #include <QInputDialog>
 #include <QSettings>
-#include <QScrollBar>
-#include <QTextCharFormat>
-#include <QTextCursor>
 #include <QDesktopServices>
 #include <QFileDialog>
 #include <QStandardPaths>
@@ -25,25 +24,51 @@
 #include <QHBoxLayout>
 #include <QCheckBox>
 #include <QPushButton>
+#include <QSpinBox>
 #include <QStyleFactory>
 #include <QFontDatabase>
-#include <QBuffer>
 #include <QImageReader>
 #include <QMimeDatabase>
+#include <QtEndian>
 #include <cmath>
+#include <memory>
 
 // 在构造函数中安装事件过滤器
 Widget::Widget(QWidget *parent)
     : QWidget(parent)
     , ui(new Ui::Widget)
+    , chatModel(new ChatTimelineModel(this))
+    , thumbnails(new ThumbnailLoader(this))
     , tcpSocket(new QTcpSocket(this))
+    , outbound(new OutboundScheduler(tcpSocket, OutboundScheduler::DefaultBulkQuantum, this))
+    , heartbeat(new Heartbeat(Heartbeat::DefaultIntervalMsecs, this))
+    , heartbeatLost(false)
+    , reconnectTimer(new QTimer(this))
+    , reconnectAttempts(0)
+    , connectGeneration(0)
+    , manualDisconnect(false)
+    , outbox(new Outbox(this))
+    , binaryFraming(false)
+    , chunkCompression(false)
+    , chunkDelivery(false)
+    , nextStreamId(1)
+    , bulkSocket(new QTcpSocket(this))
+    , bulkOutbound(new OutboundScheduler(bulkSocket, UPLOAD_WINDOW, this))
+    , bulkReady(false)
     , username("游客")
     , currentChatTarget("所有人")
     , isConnected(false)
     , serverAddress("127.0.0.1")
     , serverPort(8888)
+    , discovery(new ServerDiscovery(this))
     , isProcessingDownload(false)
-    , currentUpload(nullptr)
+    , transfersResumed(false)
+    , loginAcked(false)
+    , blobCache(nullptr)
+    , serverDedup(false)
+    , serverPeerToPeer(false)
+    , nextPeerStreamId(0)
+    , uploadCursor(0)
     , totalFileSize(0)
     , currentPrivateTarget("")
     , isHandlingDownload(false)
@@ -55,7 +80,7 @@ Widget::Widget(QWidget *parent)
 
     setupUI();
     setupConnections();
-    setupTextBrowserConnections();
+    setupTimelineConnections();
     setupDefaultValues();
     loadSettings();
 
@@ -65,10 +90,30 @@ Widget::Widget(QWidget *parent)
     connect(ui->userList, &QListWidget::customContextMenuRequested,
             this, &Widget::onUserListContextMenu);
 
-    // 定期清理 QTextBrowser 状态
-    QTimer *cleanTimer = new QTimer(this);
-    connect(cleanTimer, &QTimer::timeout, this, &Widget::cleanTextBrowser);
-    cleanTimer->start(5000);  // 每5秒清理一次
+    // 读取未完成传输的日志和离线发件箱，连接后继续
+    journal = new TransferJournal(this);
+    journal->load();
+    outbox->load();
+    reconnectTimer->setSingleShot(true);
+    connect(reconnectTimer, &QTimer::timeout, this, &Widget::connectToServer);
+
+    // 读取本地文件缓存索引
+    QSettings settings("MyChat", "P2PClient");
+    blobCache = new BlobCache(settings.value("Files/CacheMaxMB", int(BlobCache::DefaultMaxBytes >> 20)).toLongLong() << 20);
+    blobCache->load();
+    // 聊天记录在内存中保留的条数，更早的换出到磁盘
+    chatModel->setMemoryRows(settings.value("Chat/MemoryRows", ChatTimelineModel::DefaultMemoryRows).toInt());
+
+    // 定期检查停滞的文件接收
+    transferCheckTimer = new QTimer(this);
+    connect(transferCheckTimer, &QTimer::timeout, this, &Widget::checkIncomingFiles);
+    transferCheckTimer->start(RESEND_IDLE_MSECS / 2);
+    // 两条发送队列的排队延迟显示在连接状态的提示中
+    connect(transferCheckTimer, &QTimer::timeout, this, [this]() {
+        QString summary = heartbeat->summary() + "\n" + outbound->statsSummary();
+        if (bulkReady) summary += "\n文件连接 " + bulkOutbound->statsSummary();
+        ui->statusLabel->setToolTip(summary);
+    });
 
     QTimer::singleShot(100, this, &Widget::startAutoConnect);
 }
@@ -235,7 +280,7 @@ void Widget::startPrivateChat(const QString &targetUser)
 // 发送私聊消息
 void Widget::sendPrivateMessage(const QString &message, const QString &targetUser)
 {
-    if (!isConnected || targetUser.isEmpty() || message.isEmpty()) return;
+    if (targetUser.isEmpty() || message.isEmpty()) return;
 
     QJsonObject msgJson;
     msgJson["type"] = "private";
@@ -243,10 +288,7 @@ void Widget::sendPrivateMessage(const QString &message, const QString &targetUse
     msgJson["target"] = targetUser;
     msgJson["content"] = message;
     msgJson["timestamp"] = QDateTime::currentDateTime().toString("yyyy-MM-dd hh:mm:ss");
-
-    QJsonDocument doc(msgJson);
-    QString jsonString = doc.toJson(QJsonDocument::Compact);
-    tcpSocket->write(jsonString.toUtf8() + "\n");
+    deliverMessage(msgJson);
 
     // 在本地显示私聊消息
     // QString displayMsg = QString("[私聊] %1").arg(message);
@@ -271,21 +313,14 @@ bool Widget::eventFilter(QObject *obj, QEvent *event)
     return QWidget::eventFilter(obj, event);
 }
 
-void Widget::setupTextBrowserConnections()
+void Widget::setupTimelineConnections()
 {
     // 只连接一次，避免重复处理
-    disconnect(ui->chatText, &QTextBrowser::anchorClicked, this, nullptr);
-    connect(ui->chatText, &QTextBrowser::anchorClicked, this, &Widget::handleDownloadRequest);
-}
-void Widget::cleanTextBrowser()
-{
-    // 清理 QTextBrowser 的缓存和状态
-    ui->chatText->clearFocus();
-    ui->chatText->document()->clearUndoRedoStacks();
-    ui->chatText->document()->setModified(false);
-
-    // 重新设置文本交互标志
-    ui->chatText->setTextInteractionFlags(Qt::TextSelectableByMouse | Qt::LinksAccessibleByMouse);
+    disconnect(ui->chatText, &ChatTimelineView::linkActivated, this, nullptr);
+    connect(ui->chatText, &ChatTimelineView::linkActivated, this, &Widget::handleDownloadRequest);
+    connect(thumbnails, &ThumbnailLoader::thumbnailReady, chatModel, &ChatTimelineModel::setThumbnail,
+            Qt::UniqueConnection);
+    thumbnails->setDevicePixelRatio(ui->chatText->devicePixelRatioF());
 }
 
 void Widget::handleDownloadRequest(const QUrl &url)
@@ -359,23 +394,20 @@ void Widget::handleDownloadRequest(const QUrl &url)
 
 Widget::~Widget()
 {
-    // 清理上传队列
-    for (auto transfer : pendingUploads) {
-        if (transfer->file) {
-            transfer->file->close();
-            delete transfer->file;
-        }
+    // 等待进行中的哈希计算，之后的回调随本对象一起丢弃
+    hashPool.clear();
+    hashPool.waitForDone();
+    // 清理直连和上传队列
+    closePeerLinks();
+    for (auto transfer : activeUploads + pendingUploads) {
+        delete transfer->pipeline;
         delete transfer;
     }
+    activeUploads.clear();
     pendingUploads.clear();
-
-    if (currentUpload) {
-        if (currentUpload->file) {
-            currentUpload->file->close();
-            delete currentUpload->file;
-        }
-        delete currentUpload;
-    }
+    suspendIncomingFiles();
+    journal->save();
+    delete blobCache;
     saveSettings();
     delete ui;
 }
@@ -399,17 +431,42 @@ void Widget::setupConnections()
     connect(tcpSocket, &QTcpSocket::connected, this, &Widget::onSocketConnected);
     connect(tcpSocket, &QTcpSocket::disconnected, this, &Widget::onSocketDisconnected);
     connect(tcpSocket, &QTcpSocket::readyRead, this, &Widget::onSocketReadyRead);
+    connect(outbound, &OutboundScheduler::frameSent, this, &Widget::onUploadFrameSent);
+    connect(outbound, &OutboundScheduler::flushed, this, [this]() {
+        updateUploadProgress(0, 0);
+        pumpUploads();
+    });
+
+    // 文件连接
+    connect(bulkSocket, &QTcpSocket::connected, this, &Widget::onBulkConnected);
+    connect(bulkSocket, &QTcpSocket::disconnected, this, &Widget::onBulkDisconnected);
+    connect(bulkSocket, &QTcpSocket::readyRead, this, &Widget::onBulkReadyRead);
+    connect(bulkSocket, &QTcpSocket::errorOccurred, this, [this](QAbstractSocket::SocketError) {
+        // 连不上时文件数据继续走聊天连接
+        qDebug() << "文件连接错误:" << bulkSocket->errorString();
+    });
+    connect(bulkOutbound, &OutboundScheduler::frameSent, this, &Widget::onUploadFrameSent);
+    connect(bulkOutbound, &OutboundScheduler::flushed, this, [this]() {
+        updateUploadProgress(0, 0);
+        pumpUploads();
+    });
     connect(tcpSocket, QOverload<QAbstractSocket::SocketError>::of(&QTcpSocket::errorOccurred),
             this, &Widget::onSocketError);
+    connect(discovery, &ServerDiscovery::finished, this, &Widget::onServerDiscoveryFinished);
+
+    // 心跳
+    connect(heartbeat, &Heartbeat::ping, this, [this](const QByteArray &message) {
+        writeMessage(message);
+    });
+    connect(heartbeat, &Heartbeat::rttUpdated, this, [this](qint64, qint64 smoothedRtt, qint64) {
+        ui->statusLabel->setText(QString("已连接 %1 ms").arg(double(smoothedRtt) / 1000.0, 0, 'f', 1));
+    });
+    connect(heartbeat, &Heartbeat::timedOut, this, &Widget::onHeartbeatTimedOut);
 }
 void Widget::setupUI()
 {
-    // 设置控件属性
-    ui->chatText->setReadOnly(true);
-    ui->chatText->setAcceptRichText(true);
-    // 关键：禁用链接自动打开，完全由我们自己处理
-    ui->chatText->setOpenLinks(false);  // 禁用自动打开链接
-    ui->chatText->setOpenExternalLinks(false);  // 禁用外部链接
+    // 聊天记录：模型只追加，视图只测量和绘制可见的行
+    ui->chatText->setModel(chatModel);
 
     // 设置输入框提示
     ui->messageInput->setPlaceholderText("输入消息... (按Enter发送)");
@@ -450,11 +507,8 @@ void Widget::setupUI()
     font.setPointSize(10);
     ui->userList->setFont(font);
 
-    // 初始状态
+    // 初始状态（未连接时也可以发送，消息和文件进入发件箱）
     ui->disconnectButton->setEnabled(false);
-    ui->messageInput->setEnabled(false);
-    ui->sendButton->setEnabled(false);
-    ui->uploadButton->setEnabled(false);
 
     // 设置状态栏文本
     ui->statusLabel->setText("未连接");
@@ -520,61 +574,208 @@ void Widget::connectToServer()
         QMessageBox::information(this, "提示", "已经连接到服务器");
         return;
     }
+    reconnectTimer->stop();
+    manualDisconnect = false;
+    if (tcpSocket->state() != QAbstractSocket::UnconnectedState) tcpSocket->abort();
 
     // 显示连接状态
     ui->statusLabel->setText("正在连接...");
     ui->statusLabel->setStyleSheet("color: orange;");
     ui->connectButton->setEnabled(false);
 
-    // 连接服务器
+    // 连接服务器：保存的地址是快速路径，同时查找局域网中的服务器以防地址已经失效
+    deferredConnectError.clear();
     tcpSocket->connectToHost(serverAddress, serverPort);
+    discovery->start();
 
-    // 设置超时
-    QTimer::singleShot(5000, this, [this]() {
-        if (!isConnected) {
-            tcpSocket->abort();
-            ui->statusLabel->setText("连接超时");
-            ui->statusLabel->setStyleSheet("color: red;");
-            ui->connectButton->setEnabled(true);
-            QMessageBox::warning(this, "连接超时", "无法连接到服务器，请检查地址和端口");
+    // 设置超时（之后又发起了新的连接时忽略）
+    quint32 generation = ++connectGeneration;
+    QTimer::singleShot(5000, this, [this, generation]() {
+        if (generation != connectGeneration || isConnected || reconnectTimer->isActive()) return;
+        tcpSocket->abort();
+        if (reconnectAttempts > 0) {
+            scheduleReconnect();  // 自动重连中，不弹窗
+            return;
         }
+        ui->statusLabel->setText("连接超时");
+        ui->statusLabel->setStyleSheet("color: red;");
+        ui->connectButton->setEnabled(true);
+        QMessageBox::warning(this, "连接超时", "无法连接到服务器，请检查地址和端口");
     });
 }
+
+// 第 n 次重连在 [0, min(上限, 基数 * 2^n)) 内随机等待（全抖动）：
+// 服务器重启时几百个客户端的重连分散开，而不是在同一时刻一起到达
+void Widget::scheduleReconnect()
+{
+    int ceiling = RECONNECT_MAX_DELAY;
+    if (reconnectAttempts < 16) ceiling = qMin(RECONNECT_MAX_DELAY, RECONNECT_BASE_DELAY << reconnectAttempts);
+    int delay = QRandomGenerator::global()->bounded(ceiling);
+    reconnectAttempts++;
+    reconnectTimer->start(delay);
+
+    ui->statusLabel->setText(QString("%1 秒后重连").arg(double(delay) / 1000.0, 0, 'f', 1));
+    ui->statusLabel->setStyleSheet("color: orange;");
+    ui->connectButton->setEnabled(true);
+}
+// 查找结束时还没连上：保存的服务器也回答了就继续等它，否则改连往返时间最短的服务器
+void Widget::onServerDiscoveryFinished(const QList<ServerDiscovery::Server> &servers)
+{
+    if (isConnected || tcpSocket->state() == QAbstractSocket::ConnectedState) return;
+
+    QHostAddress saved(serverAddress);
+    for (const ServerDiscovery::Server &server : servers) {
+        if (server.port == serverPort && saved.isEqual(server.address, QHostAddress::ConvertV4MappedToIPv4)) {
+            if (!deferredConnectError.isEmpty()) reportConnectError(deferredConnectError);
+            return;
+        }
+    }
+
+    if (servers.isEmpty()) {
+        if (!deferredConnectError.isEmpty()) reportConnectError(deferredConnectError);
+        return;
+    }
+
+    const ServerDiscovery::Server &best = servers.first();
+    appendSystemMessage(QString("发现服务器 %1:%2（%3，往返 %4 ms），正在连接")
+                            .arg(best.address.toString())
+                            .arg(best.port)
+                            .arg(best.name)
+                            .arg(double(best.rttUsecs) / 1000.0, 0, 'f', 1));
+    serverAddress = best.address.toString();
+    serverPort = best.port;
+    ui->serverAddressInput->setText(serverAddress);
+    ui->serverPortInput->setText(QString::number(serverPort));
+    saveSettings();
+
+    deferredConnectError.clear();
+    tcpSocket->abort();
+    tcpSocket->connectToHost(serverAddress, serverPort);
+}
+
 void Widget::onSocketReadyRead()
 {
-    while (tcpSocket->bytesAvailable() > 0) {
-        QByteArray data = tcpSocket->readLine(); // 按行读取
+    heartbeat->noteActivity();
+    frameDecoder.append(tcpSocket->readAll());
+
+    Frame frame;
+    while (frameDecoder.nextFrame(frame)) { // 只处理完整的帧，不完整的部分留到下次
+        processFrame(frame);
+    }
+    if (frameDecoder.hasError()) {
+        // 二进制帧无法重新同步，断开连接；重连后未完成的传输按日志续传
+        appendSystemMessage("收到无法解析的数据，断开连接");
+        tcpSocket->abort();
+    }
+}
 
-        if (data.isEmpty()) continue;
+void Widget::processFrame(const Frame &frame)
+{
+    switch (frame.type) {
+    case MessageFrame: {
+        QByteArrayView line = frame.payload.trimmed();
+        if (line.isEmpty()) return;
 
-        // 检查是否是二进制数据
-        if (isBinaryData(data)) {
+        // 检查是否是二进制数据（只可能出现在行模式）
+        if (frameDecoder.mode() == FrameDecoder::LineMode && isBinaryData(line)) {
             qDebug() << "收到二进制数据，跳过显示";
-            continue; // 跳过二进制数据
+            return; // 跳过二进制数据
         }
 
-        QString message = QString::fromUtf8(data).trimmed();
-
-        // 尝试解析JSON消息
+        // 直接在接收缓冲区上解析JSON，不经过QString中转
         QJsonParseError parseError;
-        QJsonDocument jsonDoc = QJsonDocument::fromJson(message.toUtf8(), &parseError);
+        QJsonDocument jsonDoc = QJsonDocument::fromJson(
+            QByteArray::fromRawData(line.data(), line.size()), &parseError);
 
         if (parseError.error == QJsonParseError::NoError) {
             // 是JSON消息
             processJsonMessage(jsonDoc.object());
         } else {
             // 是普通文本消息
-            processTextMessage(message);
+            processTextMessage(QString::fromUtf8(line));
+        }
+        break;
+    }
+    case FileMetaFrame: {
+        QJsonObject meta = QJsonDocument::fromJson(
+            QByteArray::fromRawData(frame.payload.data(), frame.payload.size())).object();
+
+        IncomingStream stream;
+        stream.sender = meta["sender"].toString();
+        stream.fileId = meta["file_id"].toString();
+        stream.fileName = meta["file_name"].toString();
+        stream.fileSize = meta["file_size"].toVariant().toLongLong();
+        stream.totalChunks = meta["total_chunks"].toInt();
+        stream.chunkSize = meta["chunk_size"].toVariant().toLongLong();
+        stream.targetUser = meta["target"].toString();
+        stream.expectedChunks = meta["resend"].toBool() ? meta["resend_chunks"].toInt()
+                                                        : meta["chunk_count"].toInt(stream.totalChunks);
+        stream.chunksSeen = 0;
+        incomingStreams.insert(frame.streamId, stream);
+        break;
+    }
+    case FileChunkFrame: {
+        auto it = incomingStreams.constFind(frame.streamId);
+        if (it == incomingStreams.constEnd() || frame.payload.size() < 4) {
+            qDebug() << "收到未知文件流的分块:" << frame.streamId;
+            return;
+        }
+
+        // 复制一份：处理分块时文件可能完成，流会从表中删除
+        const IncomingStream stream = it.value();
+        const bool lastOfStream = ++incomingStreams[frame.streamId].chunksSeen >= stream.expectedChunks;
+        int chunkIndex = int(qFromBigEndian<quint32>(frame.payload.data()));
+        QByteArrayView data = frame.payload.sliced(4);
+        QByteArray unpacked;
+        bool usable = true;
+        if (frame.flags & FrameFlagCompressed) {
+            unpacked = qUncompress(reinterpret_cast<const uchar *>(data.data()), data.size());
+            if (unpacked.isEmpty()) {
+                qDebug() << "分块解压失败:" << stream.fileName << chunkIndex;
+                usable = false;  // 当作丢失，由补发请求补齐
+            }
+            data = unpacked;
+        }
+        if (usable) {
+            handleFileChunk(stream.sender, stream.fileId, stream.fileName, stream.fileSize,
+                            stream.totalChunks, stream.chunkSize, chunkIndex, data, stream.targetUser);
+        }
+
+        // 流发完了（补发流和续传流只有一部分分块，拥塞时跳过的分块不会再来），
+        // 或者文件已经完成、失败、不属于自己时不再保留；文件完成时同一文件的其他流由
+        // dropIncomingStreams 删除
+        if (lastOfStream || !incomingFiles.contains(stream.fileId)) {
+            incomingStreams.remove(frame.streamId);
         }
+        break;
+    }
+    default:
+        qDebug() << "未知帧类型:" << frame.type;
+    }
+}
+
+// 发送一条消息（JSON 或文本命令），按协商好的分帧方式编码
+quint64 Widget::writeMessage(const QByteArray &message, OutboundScheduler::Lane lane)
+{
+    if (binaryFraming) {
+        return writeToSocket(FrameEncoder::encode(MessageFrame, 0, message), lane);
+    } else {
+        return writeToSocket(message + "\n", lane);
     }
 }
 
+// 所有写入都经过发送调度，返回的帧 ID 在离开套接字缓冲区时由 frameSent 通知
+quint64 Widget::writeToSocket(const QByteArray &data, OutboundScheduler::Lane lane)
+{
+    return outbound->enqueue(lane, data);
+}
+
 // 检查是否是二进制数据
-bool Widget::isBinaryData(const QByteArray &data)
+bool Widget::isBinaryData(QByteArrayView data)
 {
     // 检查数据中非打印字符的比例
-    int nonPrintable = 0;
-    for (int i = 0; i < data.size(); ++i) {
+    qsizetype nonPrintable = 0;
+    for (qsizetype i = 0; i < data.size(); ++i) {
         unsigned char c = data.at(i);
         // 非打印字符（除空格、换行、制表符等）
         if (c < 32 && c != 9 && c != 10 && c != 13) {
@@ -592,6 +793,19 @@ bool Widget::isBinaryData(const QByteArray &data)
 void Widget::onSocketConnected()
 {
     isConnected = true;
+    reconnectAttempts = 0;
+    reconnectTimer->stop();
+    frameDecoder.clear();
+    binaryFraming = false;
+    serverDedup = false;
+    serverPeerToPeer = false;
+    chunkCompression = false;
+    chunkDelivery = false;
+    loginAcked = false;
+    incomingStreams.clear();
+    outbound->clear();
+    // 系统发送缓冲区过大时，文件数据会在缓冲区里排在聊天消息前面
+    tcpSocket->setSocketOption(QAbstractSocket::SendBufferSizeSocketOption, SEND_BUFFER_SIZE);
 
     // 更新UI状态
     ui->statusLabel->setText("已连接");
@@ -602,24 +816,29 @@ void Widget::onSocketConnected()
     ui->sendButton->setEnabled(true);
     ui->uploadButton->setEnabled(true);
 
-    // 发送登录消息
-    QString loginMsg = QString("LOGIN:%1").arg(username);
-    tcpSocket->write(loginMsg.toUtf8());
+    // 发送登录消息（始终使用行模式，服务器在 login_ack 中声明是否支持二进制帧）
+    QString loginMsg = QString("LOGIN:%1\n").arg(username);
+    writeToSocket(loginMsg.toUtf8());
 
     // 显示系统消息
     appendSystemMessage(QString("已连接到服务器 %1:%2").arg(serverAddress).arg(serverPort));
 
     // 延迟请求用户列表（等待服务器处理登录）
     QTimer::singleShot(100, this, &Widget::updateUserList);
+
+    // 旧服务器不发送 login_ack：等一会儿仍没有收到时按已登录处理，
+    // 发出离线时排队的消息并恢复未完成的传输（之后又重连时忽略）
+    const quint32 generation = connectGeneration;
+    QTimer::singleShot(LOGIN_ACK_TIMEOUT, this, [this, generation]() {
+        if (generation != connectGeneration || !isConnected || loginAcked) return;
+        qDebug() << "服务器没有回答 login_ack，按旧协议继续";
+        flushOutbox();
+        resumeTransfers();
+    });
 }
 
 void Widget::onUploadClicked()
 {
-    if (!isConnected) {
-        QMessageBox::warning(this, "上传失败", "未连接到服务器");
-        return;
-    }
-
     // 打开文件对话框
     QStringList filters;
     filters << "所有文件 (*.*)"
@@ -646,21 +865,53 @@ void Widget::onUploadClicked()
         return;
     }
 
-    sendFile(filePath);
+    bool isPrivate = currentChatTarget != "所有人" && currentChatTarget != username;
+    QString targetUser = isPrivate ? currentChatTarget : QString();
+
+    // 离线时放入发件箱，连接后按顺序发送
+    if (!isConnected) {
+        Outbox::Item item;
+        item.kind = Outbox::Item::File;
+        item.filePath = filePath;
+        item.targetUser = targetUser;
+        item.queued = QDateTime::currentDateTime();
+        if (!outbox->enqueue(item)) {
+            QMessageBox::warning(this, "上传失败", "未连接到服务器，发件箱已满");
+            return;
+        }
+        appendSystemMessage(QString("文件 %1 将在连接后发送").arg(fileInfo.fileName()));
+        return;
+    }
+
+    sendFile(filePath, targetUser);
 }
 
 void Widget::onSocketDisconnected()
 {
     isConnected = false;
+    heartbeat->stop();
+    frameDecoder.clear();
+    binaryFraming = false;
+    serverDedup = false;
+    pendingOffers.clear();  // 日志中的条目在重连后按续传处理
+    serverPeerToPeer = false;
+    chunkCompression = false;
+    chunkDelivery = false;
+    incomingStreams.clear();
+    cancelUpload();
+    closePeerLinks();       // 重连后经服务器续传
+    outbound->clear();
+    closeBulkChannel();
+    // 接收到一半的文件保留 .part 和日志，重连后继续
+    suspendIncomingFiles();
+    transfersResumed = false;
 
     // 更新UI状态
     ui->statusLabel->setText("未连接");
     ui->statusLabel->setStyleSheet("color: gray;");
     ui->connectButton->setEnabled(true);
     ui->disconnectButton->setEnabled(false);
-    ui->messageInput->setEnabled(false);
-    ui->sendButton->setEnabled(false);
-    ui->uploadButton->setEnabled(false);
+    // 离线时仍可发送，消息和文件进入发件箱
 
     // 清空用户列表
     ui->userList->clear();
@@ -674,11 +925,23 @@ void Widget::onSocketDisconnected()
     // 显示系统消息
     appendSystemMessage("与服务器的连接已断开");
 
-    // 尝试自动重连（可选）
-    if (ui->autoReconnectCheck->isChecked()) {
-        QTimer::singleShot(3000, this, &Widget::connectToServer);
+    // 尝试自动重连（可选）；心跳超时说明链路曾经中断，不论是否勾选都重连
+    bool reconnect = !manualDisconnect && (heartbeatLost || ui->autoReconnectCheck->isChecked());
+    heartbeatLost = false;
+    manualDisconnect = false;
+    if (reconnect) {
+        scheduleReconnect();
     }
 }
+
+// 几个心跳间隔没有收到任何数据：交换机重启等情况下 TCP 要很久才会报错，主动断开
+void Widget::onHeartbeatTimedOut(qint64 silentMsecs)
+{
+    if (!isConnected) return;
+    appendSystemMessage(QString("服务器 %1 秒无响应，正在重新连接").arg(double(silentMsecs) / 1000.0, 0, 'f', 1));
+    heartbeatLost = true;
+    tcpSocket->abort();  // 触发 onSocketDisconnected
+}
 void Widget::processImageMessage(const QByteArray &data)
 {
     QDataStream stream(data);
@@ -708,11 +971,8 @@ void Widget::processImageMessage(const QByteArray &data)
     QString fileName = QString::fromUtf8(fileNameBuffer, fileNameLength);
     delete[] fileNameBuffer;
 
-    // 加载图片
-    QImage image;
-    image.loadFromData(imageData);
-
-    if (!image.isNull()) {
+    // 只检查文件头，解码留给缩略图线程
+    if (ImageSniffer::probe(imageData).isImage()) {
         // 保存到本地
         QString saveDir = QStandardPaths::writableLocation(QStandardPaths::PicturesLocation) + "/LANChat/";
         QDir().mkpath(saveDir);
@@ -727,11 +987,15 @@ void Widget::processImageMessage(const QByteArray &data)
             savePath = saveDir + baseName + "_" + timestamp + "." + suffix;
         }
 
-        // 保存图片
-        image.save(savePath);
+        // 按收到的原始字节保存图片，不再解码后重新编码
+        QFile file(savePath);
+        if (!file.open(QIODevice::WriteOnly) || file.write(imageData) != imageData.size()) {
+            appendSystemMessage(QString("图片 %1 保存失败").arg(fileName));
+            return;
+        }
+        file.close();
 
-        // 调用更新后的函数，传递5个参数
-        appendImageMessage(senderName, image, fileName, savePath, senderName != username);
+        appendImageMessage(senderName, savePath, fileName, savePath, senderName != username);
     }
 }
 void Widget::processJsonMessage(const QJsonObject &jsonObj)
@@ -792,6 +1056,70 @@ void Widget::processJsonMessage(const QJsonObject &jsonObj)
             showNotification("私聊消息", QString("%1: %2").arg(sender).arg(content));
         }
     }
+    else if (type == "login_ack") {
+        loginAcked = true;
+        // 服务器支持二进制帧时请求切换，这一行之后本端发出的都是二进制帧
+        QJsonArray caps = jsonObj["caps"].toArray();
+        if (!binaryFraming && caps.contains(QJsonValue("binary_frames"))) {
+            QJsonObject modeJson;
+            modeJson["type"] = "frame_mode";
+            modeJson["mode"] = "binary";
+            // 还在排队的行模式分块必须先于切换消息写出
+            outbound->flushBulk();
+            modeJson["codecs"] = QJsonArray{"zlib"};  // 可以直接接收压缩的分块
+            modeJson["caps"] = QJsonArray{"dedup", "p2p"};   // 会回答 file_offer，接受直连
+            writeMessage(QJsonDocument(modeJson).toJson(QJsonDocument::Compact));
+            binaryFraming = true;
+        }
+        chunkCompression = jsonObj["codecs"].toArray().contains(QJsonValue("zlib"));
+        chunkDelivery = jsonObj["file_delivery"].toString() == "chunks";
+        serverDedup = binaryFraming && caps.contains(QJsonValue("dedup"));
+        serverPeerToPeer = binaryFraming && caps.contains(QJsonValue("p2p"));
+
+        // 服务器提供文件专用连接时，之后的上传都走那条连接
+        if (binaryFraming && caps.contains(QJsonValue("bulk_channel"))) {
+            openBulkChannel(quint16(jsonObj["bulk_port"].toInt()), jsonObj["bulk_token"].toString());
+        }
+
+        // 服务器会回答 ping 时开始心跳
+        if (caps.contains(QJsonValue("heartbeat"))) heartbeat->start();
+
+        // 登录完成，继续上次未完成的传输
+        resumeTransfers();
+    }
+    else if (type == "pong") {
+        heartbeat->handlePong(quint32(jsonObj["seq"].toInteger()));
+    }
+    else if (type == "file_offer") {
+        // 发送方询问我们是否已有相同内容的文件
+        handleFileOffer(jsonObj);
+    }
+    else if (type == "file_offer_result") {
+        handleFileOfferResult(jsonObj["file_id"].toString(), jsonObj["needed"].toBool(),
+                              jsonObj["haves"].toInt());
+    }
+    else if (type == "p2p_offer") {
+        // 私聊文件的发送方请求直连
+        acceptPeerOffer(jsonObj);
+    }
+    else if (type == "p2p_failed") {
+        // 接收方连不上我们（或服务器无法转交），还没开始直连传输时改由服务器转发
+        PeerLink *link = peerLinks.value(jsonObj["file_id"].toString());
+        if (link && link->sending && !link->outbound) {
+            fallbackToRelay(link, jsonObj["reason"].toString());
+        }
+    }
+    else if (type == "file_resend") {
+        // 接收方缺少分块，请求我们补发
+        resendFileRanges(jsonObj["file_id"].toString(), jsonObj["requester"].toString(),
+                         jsonObj["ranges"].toArray());
+    }
+    else if (type == "frame_mode") {
+        // 服务器确认切换，这一行之后收到的都是二进制帧
+        if (jsonObj["mode"].toString() == "binary") {
+            frameDecoder.setMode(FrameDecoder::BinaryMode);
+        }
+    }
     else if (type == "user_status") {
         // 处理用户状态变化
         QString user = jsonObj["username"].toString();
@@ -799,11 +1127,21 @@ void Widget::processJsonMessage(const QJsonObject &jsonObj)
 
         // 更新用户列表显示
         updateUserListWithStatus(user, online);
+
+        // 发送方重新上线，继续从它那里接收暂停的文件
+        if (online) resumeIncomingFrom(user);
     }
     else if (type == "user_list") {
         // 处理用户列表更新
         QJsonArray usersArray = jsonObj["users"].toArray();
         updateUserListFromJson(usersArray);
+
+        for (const QJsonValue &userValue : usersArray) {
+            QJsonObject userObj = userValue.toObject();
+            if (userObj["online"].toBool() && !userObj["isSelf"].toBool()) {
+                resumeIncomingFrom(userObj["username"].toString());
+            }
+        }
     }
     else if (type == "error") {
         // 处理错误消息
@@ -812,23 +1150,24 @@ void Widget::processJsonMessage(const QJsonObject &jsonObj)
     }
     else if (type == "file_base64" || type == "image_base64") {
         QString fileName = jsonObj["filename"].toString();
-        qint64 fileSize = jsonObj["filesize"].toString().toLongLong();
-        QString base64Data = jsonObj["filedata"].toString();
+        qint64 fileSize = jsonObj["filesize"].toVariant().toLongLong();
 
-        // 清理Base64数据：移除空格和换行符
-        base64Data = base64Data.replace(QRegularExpression("\\s+"), "");
-
-        // 验证Base64数据长度
-        if (base64Data.length() % 4 != 0) {
-            qDebug() << "Base64数据长度错误，尝试补全";
-            int padding = 4 - (base64Data.length() % 4);
-            base64Data += QString(padding, '=');
+        // 同一个文件只保存一次：按 file_id 去重；没有声明只发分块的旧服务器在分块之后
+        // 还会再发一份不带 file_id 的重组副本，按发送者、文件名和大小认出它
+        QString fileId = jsonObj["file_id"].toString();
+        if (fileId.isEmpty() && !chunkDelivery) {
+            fileId = QString("%1/%2/%3").arg(sender, fileName).arg(fileSize);
+        }
+        if (!fileId.isEmpty() && recentCompletedFiles.contains(fileId)) {
+            qDebug() << "丢弃重复的文件:" << fileName;
+            return;
         }
 
-        // 解码Base64数据
-        QByteArray fileData = QByteArray::fromBase64(base64Data.toUtf8());
+        // 解码Base64数据：空白字符在解码时跳过，缺少末尾 '=' 也能解码
+        bool decoded = false;
+        QByteArray fileData = Base64Codec::decode(jsonObj["filedata"].toString().toLatin1(), &decoded);
 
-        if (fileData.isEmpty()) {
+        if (!decoded || fileData.isEmpty()) {
             qDebug() << "Base64解码失败:" << fileName;
             appendSystemMessage(QString("文件 %1 解码失败").arg(fileName));
             return;
@@ -839,203 +1178,612 @@ void Widget::processJsonMessage(const QJsonObject &jsonObj)
             qDebug() << "文件大小不匹配，解码后:" << fileData.size() << "期望:" << fileSize;
         }
 
-        // 保存文件
-        QString savePath = saveBase64File(fileName, fileData, type == "image_base64");
-
-        if (!savePath.isEmpty()) {
-            QString currentTime = QDateTime::currentDateTime().toString("hh:mm:ss");
-
-            if (type == "image_base64") {
-                QImage image;
-                if (image.loadFromData(fileData)) {
-                    // 检查是否是私聊消息
-                    bool isPrivate = jsonObj.contains("target") &&
-                                     jsonObj["target"].toString() != "所有人" &&
-                                     jsonObj["target"].toString() != "";
-
-                    // 如果是私聊消息，设置当前聊天目标
-                    if (isPrivate) {
-                        QString target = jsonObj["target"].toString();
-                        if (target != username) {
-                            currentChatTarget = target;
+        // 在保存之前记下，哈希期间到达的重复副本直接丢弃
+        if (!fileId.isEmpty()) rememberCompletedFile(fileId);
+
+        // 哈希和已有副本的校验在线程池中进行；已经保存过相同内容时直接复用，不再堆积带时间戳的副本
+        auto sha256 = std::make_shared<QString>();
+        runInBackground([fileData, sha256]() { *sha256 = BlobCache::hashData(fileData); },
+                        [this, jsonObj, type, sender, fileName, fileData, sha256]() {
+            findSavedCopy(*sha256, [this, jsonObj, type, sender, fileName, fileData, sha256](const QString &existing) {
+                QString savePath = existing.isEmpty()
+                    ? saveBase64File(fileName, fileData, type == "image_base64", *sha256) : existing;
+
+                if (!savePath.isEmpty()) {
+                    QString currentTime = QDateTime::currentDateTime().toString("hh:mm:ss");
+
+                    if (type == "image_base64") {
+                        if (ImageSniffer::probe(fileData).isImage()) {
+                            // 检查是否是私聊消息
+                            bool isPrivate = jsonObj.contains("target") &&
+                                             jsonObj["target"].toString() != "所有人" &&
+                                             jsonObj["target"].toString() != "";
+
+                            // 如果是私聊消息，设置当前聊天目标
+                            if (isPrivate) {
+                                QString target = jsonObj["target"].toString();
+                                if (target != username) {
+                                    currentChatTarget = target;
+                                }
+                            }
+
+                            appendImageMessage(sender, savePath, fileName, savePath, sender == username);
+                        } else {
+                            // 如果图片加载失败，显示为普通文件
+                            appendFileMessage(sender, fileName, fileData.size(), savePath, sender == username);
+                        }
+                    } else {
+                        // 检查是否是私聊消息
+                        bool isPrivate = jsonObj.contains("target") &&
+                                         jsonObj["target"].toString() != "所有人" &&
+                                         jsonObj["target"].toString() != "";
+
+                        // 如果是私聊消息，设置当前聊天目标
+                        if (isPrivate) {
+                            QString target = jsonObj["target"].toString();
+                            if (target != username) {
+                                currentChatTarget = target;
+                            }
                         }
-                    }
 
-                    appendImageMessage(sender, image, fileName, savePath, sender == username);
-                } else {
-                    // 如果图片加载失败，显示为普通文件
-                    appendFileMessage(sender, fileName, fileData.size(), savePath, sender == username);
-                }
-            } else {
-                // 检查是否是私聊消息
-                bool isPrivate = jsonObj.contains("target") &&
-                                 jsonObj["target"].toString() != "所有人" &&
-                                 jsonObj["target"].toString() != "";
-
-                // 如果是私聊消息，设置当前聊天目标
-                if (isPrivate) {
-                    QString target = jsonObj["target"].toString();
-                    if (target != username) {
-                        currentChatTarget = target;
+                        appendFileMessage(sender, fileName, fileData.size(), savePath, sender == username);
                     }
+                } else {
+                    appendSystemMessage(QString("无法保存文件: %1").arg(fileName));
                 }
-
-                appendFileMessage(sender, fileName, fileData.size(), savePath, sender == username);
-            }
-        } else {
-            appendSystemMessage(QString("无法保存文件: %1").arg(fileName));
-        }
+            });
+        });
     }
     // 在processJsonMessage函数中，修改file_chunk处理部分
     else if (type == "file_chunk") {
         QString fileId = jsonObj["file_id"].toString();
         QString fileName = jsonObj["file_name"].toString();
-        qint64 fileSize = jsonObj["file_size"].toString().toLongLong();
+        qint64 fileSize = jsonObj["file_size"].toVariant().toLongLong();
         int totalChunks = jsonObj["total_chunks"].toInt();
         int chunkIndex = jsonObj["chunk_index"].toInt();
-        QString chunkDataBase64 = jsonObj["chunk_data"].toString();
-        int chunkSize = jsonObj["chunk_size"].toString().toInt();
-
-        qDebug() << "收到文件分块:" << fileName
-                 << "分块" << chunkIndex + 1 << "/" << totalChunks
-                 << "大小:" << chunkSize << "字节";
 
-        // 清理Base64数据
-        chunkDataBase64 = chunkDataBase64.replace(QRegularExpression("\\s+"), "");
+        // 解码块数据（同一遍扫描中跳过空白字符）
+        bool decoded = false;
+        QByteArray chunkData = Base64Codec::decode(jsonObj["chunk_data"].toString().toLatin1(), &decoded);
 
-        // 解码块数据
-        QByteArray chunkData = QByteArray::fromBase64(chunkDataBase64.toUtf8());
-
-        if (chunkData.isEmpty()) {
+        if (!decoded || chunkData.isEmpty()) {
             qDebug() << "分块解码失败:" << fileName << "分块" << chunkIndex;
             return;
         }
 
-        // 检查文件是否已在接收中
-        if (!fileChunkBuffer.contains(fileId)) {
-            // 创建新的文件接收缓冲区
-            FileChunk newFile;
-            newFile.fileName = fileName;
-            newFile.fileId = fileId;
-            newFile.totalChunks = totalChunks;
-            newFile.chunkData = QByteArray();
-            newFile.chunkData.reserve(fileSize); // 预分配空间
+        // 旧协议不携带名义分块大小，由 IncomingFile 从分块长度推断
+        handleFileChunk(sender, fileId, fileName, fileSize, totalChunks, 0, chunkIndex,
+                        chunkData, jsonObj["target"].toString());
+    }
+}
 
-            // 如果是私聊，记录目标
-            if (jsonObj.contains("target")) {
-                newFile.targetUser = jsonObj["target"].toString();
+// 处理一个文件分块，JSON 的 file_chunk 和二进制的 FileChunk 帧都走这里
+void Widget::handleFileChunk(const QString &sender, const QString &fileId, const QString &fileName,
+                             qint64 fileSize, int totalChunks, qint64 chunkSize, int chunkIndex,
+                             QByteArrayView chunkData, const QString &targetUser)
+{
+    qDebug() << "收到文件分块:" << fileName
+             << "分块" << chunkIndex + 1 << "/" << totalChunks
+             << "大小:" << chunkData.size() << "字节";
+
+    // 私聊文件和补发的分块只属于目标用户
+    if (!targetUser.isEmpty() && targetUser != username) return;
+
+    // 检查文件是否已在接收中
+    IncomingFile *incoming = incomingFiles.value(fileId);
+    if (!incoming) {
+        // 已经完成的文件又收到分块（补发与原分块同时到达），直接丢弃
+        if (recentCompletedFiles.contains(fileId)) return;
+
+        // 日志中有这个文件时接着之前的 .part 写，否则创建临时文件，分块直接写入磁盘
+        incoming = restoreIncomingFile(fileId);
+        if (!incoming) {
+            incoming = new IncomingFile(fileId, fileName, fileSize, totalChunks, sender, targetUser);
+            if (!incoming->open(saveDirectory(false))) {
+                appendSystemMessage(QString("无法保存文件: %1").arg(fileName));
+                delete incoming;
+                return;
             }
+        }
+        incomingFiles.insert(fileId, incoming);
 
-            fileChunkBuffer[fileId] = newFile;
+        // 显示接收进度
+        ui->uploadProgressBar->setVisible(true);
+        ui->uploadProgressBar->setRange(0, totalChunks);
+        ui->uploadProgressBar->setValue(0);
+        ui->uploadStatusLabel->setText(QString("接收文件: %1").arg(fileName));
+    }
 
-            // 显示接收进度
-            ui->uploadProgressBar->setVisible(true);
-            ui->uploadProgressBar->setRange(0, totalChunks);
-            ui->uploadProgressBar->setValue(0);
-            ui->uploadStatusLabel->setText(QString("接收文件: %1").arg(fileName));
-        }
+    // 按序号写入块数据到它在文件中的位置，重复的分块不再写入
+    IncomingFile::WriteResult result = incoming->writeChunk(chunkIndex, chunkData, chunkSize);
+    if (result == IncomingFile::Duplicate) {
+        qDebug() << "丢弃重复分块:" << fileName << "分块" << chunkIndex;
+        return;
+    }
+    if (result == IncomingFile::WriteFailed) {
+        appendSystemMessage(QString("文件 %1 接收失败: %2").arg(fileName, incoming->errorString()));
+        incomingFiles.remove(fileId);
+        dropIncomingStreams(fileId);
+        journal->removeIncoming(fileId);
+        incoming->abort();
+        delete incoming;
+        return;
+    }
 
-        FileChunk &file = fileChunkBuffer[fileId];
+    // 记录进度，断线或重启后从这里继续
+    if (journal->findIncoming(fileId)) {
+        journal->updateReceived(fileId, incoming->receivedBitmap());
+    } else {
+        TransferJournal::Incoming entry;
+        entry.fileId = fileId;
+        entry.sender = sender;
+        entry.fileName = fileName;
+        entry.targetUser = targetUser;
+        entry.partPath = incoming->partPath();
+        entry.fileSize = fileSize;
+        entry.chunkSize = incoming->chunkSize();
+        entry.totalChunks = totalChunks;
+        entry.received = incoming->receivedBitmap();
+        journal->putIncoming(entry);
+    }
+
+    // 更新进度
+    int receivedChunks = incoming->chunksReceived();
+    ui->uploadProgressBar->setValue(receivedChunks);
+    ui->uploadStatusLabel->setText(QString("接收中: %1 (%2/%3)")
+                                       .arg(fileName)
+                                       .arg(receivedChunks)
+                                       .arg(totalChunks));
+
+    // 检查是否所有块都已接收
+    if (incoming->isComplete()) {
+        incomingFiles.remove(fileId);
+        dropIncomingStreams(fileId);
+        journal->removeIncoming(fileId);
+        rememberCompletedFile(fileId);
+        if (!chunkDelivery) rememberCompletedFile(QString("%1/%2/%3").arg(sender, fileName).arg(fileSize));
+        completeIncomingFile(incoming);
+        delete incoming;
+    } else if (chunkIndex == totalChunks - 1) {
+        // 发送方按顺序发送，收到最后一块时前面仍有空缺，说明中间的分块丢失了
+        requestMissingChunks(incoming, chunkIndex);
+    }
+}
 
-        // 存储块数据（追加到末尾）
-        file.chunkData.append(chunkData);
+// 记录已经保存的文件，之后迟到的分块或重复的整文件消息直接丢弃
+void Widget::rememberCompletedFile(const QString &key)
+{
+    recentCompletedFiles.append(key);
+    while (recentCompletedFiles.size() > MAX_RECENT_COMPLETED) recentCompletedFiles.removeFirst();
+}
 
-        // 更新进度
-        int receivedChunks = file.chunkData.size() / (fileSize / totalChunks + 1);
-        ui->uploadProgressBar->setValue(receivedChunks);
-        ui->uploadStatusLabel->setText(QString("接收中: %1 (%2/%3)")
-                                           .arg(fileName)
-                                           .arg(receivedChunks)
-                                           .arg(totalChunks));
+// 定期检查：长时间没有新分块的接收请求补发缺失部分，多次无果后放弃
+void Widget::checkIncomingFiles()
+{
+    const QList<IncomingFile *> files = incomingFiles.values();
+    for (IncomingFile *incoming : files) {
+        if (incoming->idleMsecs() < RESEND_IDLE_MSECS) continue;
+
+        if (incoming->resendRequests() >= MAX_RESEND_REQUESTS) {
+            // 发送方可能已经离线，暂停接收，等它重新上线后再请求
+            appendSystemMessage(QString("文件 %1 接收中断: 缺少 %2 个分块，发送方上线后继续")
+                                    .arg(incoming->fileName())
+                                    .arg(incoming->chunkCount() - incoming->chunksReceived()));
+            incomingFiles.remove(incoming->fileId());
+            dropIncomingStreams(incoming->fileId());
+            journal->updateReceived(incoming->fileId(), incoming->receivedBitmap());
+            delete incoming;
+            continue;
+        }
+        requestMissingChunks(incoming);
+    }
+}
 
-        // 检查是否所有块都已接收
-        if (chunkIndex == totalChunks - 1 || file.chunkData.size() >= fileSize) {
-            qDebug() << "文件接收完成:" << fileName
-                     << "大小:" << file.chunkData.size() << "字节";
+// 文件完成、失败或暂停时删除属于它的所有二进制流（原始传输和补发）
+void Widget::dropIncomingStreams(const QString &fileId)
+{
+    for (auto it = incomingStreams.begin(); it != incomingStreams.end();) {
+        if (it->fileId == fileId) {
+            it = incomingStreams.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
 
-            // 保存文件
-            QString savePath = saveBase64File(fileName, file.chunkData, false);
+// 向发送方请求补发 [0, limit) 中缺失的分块，只列出缺失的区间
+void Widget::requestMissingChunks(IncomingFile *incoming, int limit)
+{
+    QList<QPair<int, int>> ranges = incoming->missingRanges(limit);
+    if (ranges.isEmpty() || !isConnected) return;
+
+    QJsonArray rangesArray;
+    int missing = 0;
+    for (const auto &range : ranges) {
+        rangesArray.append(QJsonArray{range.first, range.second});
+        missing += range.second;
+    }
+
+    QJsonObject request;
+    request["type"] = "file_resend";
+    request["sender"] = username;
+    request["target"] = incoming->sender();
+    request["file_id"] = incoming->fileId();
+    request["ranges"] = rangesArray;
+    writeMessage(QJsonDocument(request).toJson(QJsonDocument::Compact));
+
+    incoming->noteResendRequested();
+    qDebug() << "请求补发:" << incoming->fileName() << "缺少" << missing << "个分块，"
+             << ranges.size() << "个区间";
+}
 
-            if (!savePath.isEmpty()) {
-                // 判断是否为图片
-                QImage image;
-                bool isImage = image.loadFromData(file.chunkData);
+// 收到 file_resend：从原文件只补发请求的区间，发给请求者一人
+void Widget::resendFileRanges(const QString &fileId, const QString &requester, const QJsonArray &ranges)
+{
+    const TransferJournal::Outgoing *sent = journal->findOutgoing(fileId);
+    if (!sent) {
+        qDebug() << "收到未知文件的补发请求:" << fileId << "来自" << requester;
+        return;
+    }
+    // 私聊文件只补发给原来的接收方
+    if (!sent->targetUser.isEmpty() && requester != sent->targetUser) {
+        qDebug() << "拒绝补发私聊文件:" << sent->fileName << "请求者" << requester;
+        return;
+    }
 
-                if (isImage) {
-                    appendImageMessage(sender, image, fileName, savePath, sender == username);
-                } else {
-                    appendFileMessage(sender, fileName, file.chunkData.size(), savePath, sender == username);
-                }
+    int totalChunks = sent->totalChunks;
+    QList<int> indices;
+    for (const QJsonValue &value : ranges) {
+        QJsonArray range = value.toArray();
+        int start = qMax(0, range.at(0).toInt());
+        int end = qMin(totalChunks, start + qMax(0, range.at(1).toInt()));
+        for (int i = start; i < end; ++i) {
+            if (indices.isEmpty() || i > indices.last()) indices.append(i);
+        }
+    }
+    if (indices.isEmpty()) return;
 
-                ui->uploadStatusLabel->setText(QString("已接收: %1").arg(fileName));
-            } else {
-                appendSystemMessage(QString("无法保存文件: %1").arg(fileName));
-            }
+    // 源文件已经变化时不能补发，否则接收方会拼出错误的文件
+    QFileInfo fileInfo(sent->filePath);
+    if (fileInfo.size() != sent->fileSize
+        || fileInfo.lastModified().toMSecsSinceEpoch() != sent->modified.toMSecsSinceEpoch()) {
+        qDebug() << "补发失败，源文件已变化:" << sent->filePath;
+        return;
+    }
 
-            // 清理缓冲区
-            fileChunkBuffer.remove(fileId);
+    qDebug() << "补发" << sent->fileName << indices.size() << "个分块给" << requester;
+    if (!queueUpload(sent->filePath, fileId, requester, indices, true)) {
+        qDebug() << "补发失败，无法打开文件:" << sent->filePath;
+        return;
+    }
+    ui->uploadProgressBar->setVisible(true);
+    startUploads();
+    pumpUploads();
+}
 
-            QTimer::singleShot(2000, this, [this]() {
-                ui->uploadProgressBar->setVisible(false);
-                ui->uploadStatusLabel->setText("就绪");
+// 所有分块都已写入：把临时文件重命名为最终文件并显示
+void Widget::completeIncomingFile(IncomingFile *incoming)
+{
+    QString fileName = incoming->fileName();
+    QString savePath = uniqueSavePath(saveDirectory(false), fileName);
+
+    qDebug() << "文件接收完成:" << fileName << "大小:" << incoming->fileSize() << "字节";
+
+    if (incoming->finish(savePath)) {
+        ui->uploadStatusLabel->setText(QString("已接收: %1").arg(fileName));
+
+        // 哈希在线程池中计算；保存目录中已有相同内容时不再保留一份带时间戳的副本
+        const QString sender = incoming->sender();
+        const qint64 fileSize = incoming->fileSize();
+        auto sha256 = std::make_shared<QString>();
+        runInBackground([savePath, sha256]() { *sha256 = BlobCache::hashFile(savePath); },
+                        [this, savePath, sha256, sender, fileName, fileSize]() {
+            findSavedCopy(*sha256, [this, savePath, sha256, sender, fileName, fileSize](const QString &existing) {
+                QString shownPath = savePath;
+                if (!existing.isEmpty() && existing != savePath) {
+                    QFile::remove(savePath);
+                    shownPath = existing;
+                }
+                blobCache->insert(*sha256, shownPath);
+                showReceivedFile(sender, fileName, fileSize, shownPath);
             });
-        }
+        });
+    } else {
+        incoming->abort();
+        appendSystemMessage(QString("无法保存文件: %1").arg(fileName));
     }
+
+    QTimer::singleShot(2000, this, [this]() {
+        ui->uploadProgressBar->setVisible(false);
+        ui->uploadStatusLabel->setText("就绪");
+    });
 }
-// 更新用户状态
-void Widget::updateUserListWithStatus(const QString &user, bool online)
+
+void Widget::showReceivedFile(const QString &sender, const QString &fileName, qint64 fileSize,
+                              const QString &savePath)
 {
-    for (int i = 0; i < ui->userList->count(); ++i) {
-        QListWidgetItem *item = ui->userList->item(i);
-        QString itemText = item->text();
+    // 判断是否为图片（只读文件头）
+    if (ImageSniffer::probe(savePath).isImage()) {
+        appendImageMessage(sender, savePath, fileName, savePath, sender == username);
+    } else {
+        appendFileMessage(sender, fileName, fileSize, savePath, sender == username);
+    }
+}
 
-        QString cleanName = itemText;
-        cleanName = cleanName.replace(" (我)", "");
-        cleanName = cleanName.replace(" [离线]", "");
-        cleanName = cleanName.replace(" 💬", "");
+// 缓存中有相同内容时直接放到保存目录并回答 file_have，否则回答 file_want
+void Widget::handleFileOffer(const QJsonObject &offer)
+{
+    QString sha256 = offer["sha256"].toString();
+    if (!blobCache->contains(sha256)) {
+        answerFileOffer(offer, QString());
+        return;
+    }
 
-        if (cleanName == user) {
-            // 更新显示
-            QString newText = cleanName;
+    // 使用缓存前在线程池中校验内容，校验完再回答
+    auto lookup = std::make_shared<BlobCache::Lookup>(blobCache->lookup(sha256));
+    const quint32 generation = connectGeneration;
+    runInBackground([lookup]() { BlobCache::verify(*lookup, true); },
+                    [this, offer, lookup, generation]() {
+        if (generation != connectGeneration) return;   // 已经重连，服务器不再等这个回答
+        QString fileName = offer["file_name"].toString();
+        bool isImage = getFileType(fileName) == Image;
+        answerFileOffer(offer, blobCache->materialize(*lookup, uniqueSavePath(saveDirectory(isImage), fileName)));
+    });
+}
 
-            // 如果是自己，添加标记
-            if (user == username) {
-                newText += " (我)";
-            }
+// savePath 为空时回答 file_want，否则内容已经从缓存放到 savePath，回答 file_have 并显示
+void Widget::answerFileOffer(const QJsonObject &offer, const QString &savePath)
+{
+    QString fileId = offer["file_id"].toString();
+    QString sender = offer["sender"].toString();
+    QString fileName = offer["file_name"].toString();
+    QString sha256 = offer["sha256"].toString();
+    qint64 fileSize = offer["file_size"].toVariant().toLongLong();
+
+    QJsonObject reply;
+    reply["type"] = savePath.isEmpty() ? "file_want" : "file_have";
+    reply["file_id"] = fileId;
+    reply["sender"] = username;
+    reply["target"] = sender;
+    writeMessage(QJsonDocument(reply).toJson(QJsonDocument::Compact));
+
+    if (savePath.isEmpty()) return;
+
+    qDebug() << "从本地缓存取得:" << fileName << sha256;
+    // 之后万一还有分块到达（例如服务器超时后按需要传输）直接丢弃
+    rememberCompletedFile(fileId);
+
+    showReceivedFile(sender, fileName, fileSize, savePath);
+    ui->uploadStatusLabel->setText(QString("已从缓存取得: %1").arg(fileName));
+}
 
-            // 更新在线状态
-            if (!online) {
-                newText += " [离线]";
-            }
+// 哈希算好后询问接收方；哈希失败时直接上传
+void Widget::offerUpload(const QString &fileId, const UploadRequest &upload, qint64 fileSize, const QString &sha256)
+{
+    if (sha256.isEmpty()) {
+        if (!beginUpload(fileId, upload)) {
+            appendSystemMessage(QString("无法打开文件: %1").arg(upload.fileName));
+        }
+        return;
+    }
 
-            // 保持私聊标记
-            if (itemText.contains(" 💬")) {
-                newText += " 💬";
-            }
+    pendingOffers.insert(fileId, upload);
 
-            item->setText(newText);
+    QJsonObject offer;
+    offer["type"] = "file_offer";
+    offer["sender"] = username;
+    offer["file_id"] = fileId;
+    offer["file_name"] = upload.fileName;
+    offer["file_size"] = fileSize;
+    offer["sha256"] = sha256;
+    if (!upload.targetUser.isEmpty()) {
+        offer["target"] = upload.targetUser;
+    }
+    writeMessage(QJsonDocument(offer).toJson(QJsonDocument::Compact));
+}
 
-            // 更新颜色
-            if (user == username) {
-                item->setForeground(Qt::green);
-            } else if (!online) {
-                item->setForeground(Qt::gray);
-            } else {
-                item->setForeground(Qt::black);
-            }
+// 在线程池中运行 work，完成后在 GUI 线程运行 done（与 ChunkPipeline 的编码线程相同的做法）
+void Widget::runInBackground(std::function<void()> work, std::function<void()> done)
+{
+    hashPool.start([this, work, done]() {
+        work();
+        QMetaObject::invokeMethod(this, done, Qt::QueuedConnection);
+    });
+}
 
-            break;
-        }
+void Widget::findSavedCopy(const QString &sha256, std::function<void(const QString &)> done)
+{
+    auto lookup = std::make_shared<BlobCache::Lookup>(blobCache->lookup(sha256));
+    if (sha256.isEmpty() || lookup->savedPath.isEmpty()) {
+        done(QString());
+        return;
     }
+    runInBackground([lookup]() { BlobCache::verify(*lookup, false); },
+                    [lookup, done]() { done(lookup->savedIntact ? lookup->savedPath : QString()); });
 }
-void Widget::updateUserListFromJson(const QJsonArray &usersArray)
+
+// 服务器汇总了接收方的回答：有人需要时才真正上传
+void Widget::handleFileOfferResult(const QString &fileId, bool needed, int haves)
 {
-    // 保存当前选择
-    QString selectedUser;
-    QListWidgetItem* selectedItem = ui->userList->currentItem();
-    if (selectedItem) {
-        selectedUser = selectedItem->text();
-        // 移除可能的私聊标记
+    auto it = pendingOffers.find(fileId);
+    if (it == pendingOffers.end()) return;
+    UploadRequest offer = it.value();
+    pendingOffers.erase(it);
+
+    if (!needed) {
+        journal->markFinished(fileId);
+        appendSystemMessage(QString("%1 个接收方已有文件 %2，无需传输").arg(haves).arg(offer.fileName));
+        if (activeUploads.isEmpty() && pendingUploads.isEmpty()) {
+            ui->uploadProgressBar->setVisible(false);
+        }
+        return;
+    }
+
+    if (!beginUpload(fileId, offer)) {
+        appendSystemMessage(QString("无法打开文件: %1").arg(offer.fileName));
+    }
+}
+
+// 暂停所有未完成的接收（连接断开或退出时调用）：关闭 .part 文件，进度留在日志中
+void Widget::suspendIncomingFiles()
+{
+    for (IncomingFile *incoming : std::as_const(incomingFiles)) {
+        qDebug() << "暂停接收:" << incoming->fileName()
+                 << incoming->chunksReceived() << "/" << incoming->chunkCount();
+        journal->updateReceived(incoming->fileId(), incoming->receivedBitmap());
+        delete incoming;
+    }
+    incomingFiles.clear();
+    journal->save();
+}
+
+// 按日志重新打开暂停的接收，.part 文件缺失或不匹配时删除日志条目
+IncomingFile *Widget::restoreIncomingFile(const QString &fileId)
+{
+    const TransferJournal::Incoming *entry = journal->findIncoming(fileId);
+    if (!entry) return nullptr;
+
+    IncomingFile *incoming = new IncomingFile(entry->fileId, entry->fileName, entry->fileSize,
+                                              entry->totalChunks, entry->sender, entry->targetUser);
+    if (!incoming->resume(entry->partPath, entry->chunkSize, entry->received)) {
+        journal->removeIncoming(fileId);
+        delete incoming;
+        return nullptr;
+    }
+    return incoming;
+}
+
+// 连接（重连）后恢复日志中未完成的传输
+void Widget::resumeTransfers()
+{
+    if (transfersResumed || !isConnected) return;
+    transfersResumed = true;
+
+    // 先发出离线时排队的消息和文件
+    flushOutbox();
+
+    // 接收：打开 .part 文件，向发送方请求缺失的区间
+    resumeIncomingFrom(QString());
+
+    // 发送：从上次发出的位置继续，接收方缺少的更早分块由 file_resend 补齐
+    bool queued = false;
+    for (const TransferJournal::Outgoing &entry : journal->unfinishedOutgoing()) {
+        bool active = pendingOffers.contains(entry.fileId) || peerLinks.contains(entry.fileId);
+        for (auto transfer : activeUploads + pendingUploads) {
+            if (transfer->fileId == entry.fileId) active = true;
+        }
+        if (active) continue;
+
+        QFileInfo fileInfo(entry.filePath);
+        if (!fileInfo.exists() || fileInfo.size() != entry.fileSize
+            || fileInfo.lastModified().toMSecsSinceEpoch() != entry.modified.toMSecsSinceEpoch()
+            || entry.sentUpTo >= entry.totalChunks) {
+            // 源文件已变化或已经发完，不再续传
+            journal->markFinished(entry.fileId);
+            continue;
+        }
+
+        QList<int> indices;
+        for (int i = entry.sentUpTo; i < entry.totalChunks; ++i) indices.append(i);
+        if (queueUpload(entry.filePath, entry.fileId, entry.targetUser, indices)) {
+            appendSystemMessage(QString("继续上传: %1 (%2/%3)")
+                                    .arg(entry.fileName)
+                                    .arg(entry.sentUpTo)
+                                    .arg(entry.totalChunks));
+            queued = true;
+        }
+    }
+
+    if (queued) {
+        ui->uploadProgressBar->setVisible(true);
+        startUploads();
+        pumpUploads();
+    }
+}
+
+// 恢复来自 sender 的未完成接收（sender 为空时恢复全部）并请求缺失的分块
+// 正在接收中的文件由 checkIncomingFiles() 负责，这里只处理已暂停的
+void Widget::resumeIncomingFrom(const QString &sender)
+{
+    if (!isConnected) return;
+
+    for (const TransferJournal::Incoming &entry : journal->incoming()) {
+        if (!sender.isEmpty() && entry.sender != sender) continue;
+        if (incomingFiles.contains(entry.fileId)) continue;
+
+        IncomingFile *incoming = restoreIncomingFile(entry.fileId);
+        if (!incoming) continue;
+
+        // 上次退出时所有分块已写入、但还没来得及重命名
+        if (incoming->isComplete()) {
+            journal->removeIncoming(entry.fileId);
+            completeIncomingFile(incoming);
+            delete incoming;
+            continue;
+        }
+
+        incomingFiles.insert(entry.fileId, incoming);
+        appendSystemMessage(QString("继续接收: %1 (%2/%3)")
+                                .arg(entry.fileName)
+                                .arg(incoming->chunksReceived())
+                                .arg(entry.totalChunks));
+        requestMissingChunks(incoming);
+    }
+}
+// 更新用户状态
+void Widget::updateUserListWithStatus(const QString &user, bool online)
+{
+    for (int i = 0; i < ui->userList->count(); ++i) {
+        QListWidgetItem *item = ui->userList->item(i);
+        QString itemText = item->text();
+
+        QString cleanName = itemText;
+        cleanName = cleanName.replace(" (我)", "");
+        cleanName = cleanName.replace(" [离线]", "");
+        cleanName = cleanName.replace(" 💬", "");
+
+        if (cleanName == user) {
+            // 更新显示
+            QString newText = cleanName;
+
+            // 如果是自己，添加标记
+            if (user == username) {
+                newText += " (我)";
+            }
+
+            // 更新在线状态
+            if (!online) {
+                newText += " [离线]";
+            }
+
+            // 保持私聊标记
+            if (itemText.contains(" 💬")) {
+                newText += " 💬";
+            }
+
+            item->setText(newText);
+
+            // 更新颜色
+            if (user == username) {
+                item->setForeground(Qt::green);
+            } else if (!online) {
+                item->setForeground(Qt::gray);
+            } else {
+                item->setForeground(Qt::black);
+            }
+
+            break;
+        }
+    }
+}
+void Widget::updateUserListFromJson(const QJsonArray &usersArray)
+{
+    // 保存当前选择
+    QString selectedUser;
+    QListWidgetItem* selectedItem = ui->userList->currentItem();
+    if (selectedItem) {
+        selectedUser = selectedItem->text();
+        // 移除可能的私聊标记
         selectedUser = selectedUser.replace(" 💬", "");
         selectedUser = selectedUser.replace(" (我)", "");
     }
@@ -1123,291 +1871,66 @@ void Widget::updatePrivateChatIndicator()
 }
 void Widget::appendMessage(const QString &sender, const QString &message, bool isSelf)
 {
-    QString time = getTimestamp();
-    QString html;
+    ChatEntry entry;
+    entry.kind = ChatEntry::Text;
+    entry.sender = sender;
+    entry.time = getTimestamp();
+    entry.self = isSelf;
 
     // 检查是否是私聊消息
-    bool isPrivate = message.contains("[私聊]");
-    QString displayMessage = message;
-
-    if (isPrivate) {
-        displayMessage = message.mid(4); // 移除"[私聊]"前缀
-    }
-
-    if (isSelf) {
-        // 自己发送的消息
-        QString bubbleColor = isPrivate ? "#049e04":"#333";
-
-        html = QString(
-                   "<br/>"
-                   "<div style='margin: 5px; text-align: right;'>"
-                   "<div style='display: inline-block; max-width: 70%%; text-align: left;'>"
-                   "<div style='color: %1; padding: 8px 12px; "
-                   "border-radius: 12px; border-bottom-right-radius: 4px; margin-left: auto; "
-                   "word-wrap: break-word;'>%2</div>"
-                   "<div style='color: #666; font-size: 10px; margin-top: 2px;'>"
-                   "<span style='color:%3; font-weight: bold;'>[我]</span> "
-                   "<span style='color: #999;'>%4</span>"
-                   "</div>"
-                   "</div>"
-                   "</div>")
-                   .arg( bubbleColor, displayMessage.toHtmlEscaped(), bubbleColor,time);
-    } else {
-        // 他人发送的消息
-        QString bubbleColor = isPrivate ? "#4CAF50" : "#333";
-
-        html = QString(
-                   "<br/>"
-                   "<div style='margin: 5px;'>"
-                   "<div style='color: #666; font-size: 10px;'>"
-                   "<span style='color: %1; font-weight: bold; margin-right: 5px;'>[%2]</span>"
-                   "</div>"
-                   "<div style='color: %1; "
-                   "padding: 8px 12px; border-radius: 12px; border-bottom-left-radius: 4px; "
-                   "display: inline-block; max-width: 70%%; margin-top: 2px; "
-                   "word-wrap: break-word;'>%3</div>"
-                   "<div style='color: #999; font-size: 9px; margin-top: 2px;'>%4</div>"
-                   "</div>")
-                   .arg(bubbleColor,
-                        sender,
-                        displayMessage.toHtmlEscaped(),
-                        time);
-    }
-
-    QTextCursor cursor(ui->chatText->document());
-    cursor.movePosition(QTextCursor::End);
-    cursor.insertHtml(html);
-
-    // 滚动到底部
-    QScrollBar *scrollbar = ui->chatText->verticalScrollBar();
-    scrollbar->setValue(scrollbar->maximum());
+    entry.isPrivate = message.contains("[私聊]");
+    entry.text = entry.isPrivate ? message.mid(4) : message;  // 移除"[私聊]"前缀
+
+    chatModel->append(entry);
+    ui->chatText->scrollToBottom();
 }
 // 自己发送的文件消息显示在右侧
 void Widget::appendFileMessage(const QString &sender, const QString &fileName, qint64 fileSize,
                                const QString &filePath, bool isSelf)
 {
-    QString sizeStr = formatFileSize(fileSize);
-    QString html;
-
-    QString fileIcon;
-    QString fileExtension = QFileInfo(fileName).suffix().toLower();
-
-    // 根据文件类型设置图标
-    if (fileExtension == "mp4" || fileExtension == "avi" || fileExtension == "mkv" ||
-        fileExtension == "mov" || fileExtension == "wmv") {
-        fileIcon = "🎬";
-    } else if (fileExtension == "mp3" || fileExtension == "wav" || fileExtension == "flac" ||
-               fileExtension == "ogg") {
-        fileIcon = "🎵";
-    } else if (fileExtension == "jpg" || fileExtension == "jpeg" || fileExtension == "png" ||
-               fileExtension == "bmp" || fileExtension == "gif") {
-        fileIcon = "🖼️";
-    } else if (fileExtension == "pdf") {
-        fileIcon = "📄";
-    } else if (fileExtension == "doc" || fileExtension == "docx") {
-        fileIcon = "📝";
-    } else if (fileExtension == "zip" || fileExtension == "rar" || fileExtension == "7z") {
-        fileIcon = "📦";
-    } else {
-        fileIcon = "📎";
-    }
-
+    ChatEntry entry;
+    entry.kind = ChatEntry::File;
+    entry.sender = sender;
+    entry.fileName = fileName;
+    entry.filePath = filePath;
+    entry.fileSize = fileSize;
+    entry.time = QDateTime::currentDateTime().toString("hh:mm:ss");
+    entry.self = isSelf;
     // 检查是否为私聊消息
-    bool isPrivate = currentChatTarget != "所有人" && currentChatTarget != username;
+    entry.isPrivate = currentChatTarget != "所有人" && currentChatTarget != username;
 
-    // 根据是否为私聊设置颜色
-    QString bubbleColor = isPrivate ? "#049e04" : "#333";
-    QString linkColor = "#007AFF"; // 链接颜色保持蓝色
-
-    // 创建文件URL链接
-    QString fileUrl = QUrl::fromLocalFile(filePath).toString();
-    QString downloadLink = QString("<a href='%1' style='color: %2; text-decoration: none;'>💾 点击下载</a>")
-                               .arg(fileUrl, linkColor);
-
-    QString currentTime = QDateTime::currentDateTime().toString("hh:mm:ss");
-
-    if (isSelf) {
-        // 自己发送的文件消息 - 显示在右侧
-        html = QString(
-                   "<br/>"
-                   "<div style='margin: 5px; text-align: right;'>"
-                   "<div style='display: inline-block; max-width: 70%%; text-align: left;'>"
-                   "<div style='color: %1; padding: 8px 12px; "
-                   "border-radius: 12px; border-bottom-right-radius: 4px; margin-left: auto; "
-                   "word-wrap: break-word; max-width: 300px;'>"
-                   "<div style='font-size: 16px; margin-bottom: 5px;'>%2</div>"
-                   "<div style='font-weight: bold; font-size: 12px;'>%3</div>"
-                   "<div style='font-size: 11px; opacity: 0.9; margin-top: 5px;'>"
-                   "📏 大小: %4<br>"
-                   "%5"
-                   "</div>"
-                   "</div>"
-                   "<div style='color: #666; font-size: 10px; margin-top: 2px;'>"
-                   "<span style='color:%1; font-weight: bold;'>[我]</span> "
-                   "<span style='color: #999;'>%6</span>"
-                   "</div>"
-                   "</div>"
-                   "</div>")
-                   .arg(bubbleColor,
-                        fileIcon,
-                        fileName.toHtmlEscaped(),
-                        sizeStr,
-                        downloadLink,
-                        currentTime);
-    } else {
-        // 他人发送的文件消息 - 显示在左侧
-        html = QString(
-                   "<br/>"
-                   "<div style='margin: 5px;'>"
-                   "<div style='color: #666; font-size: 10px;'>"
-                   "<span style='color: %1; font-weight: bold; margin-right: 5px;'>[%2]</span>"
-                   "</div>"
-                   "<div style='color: %1; padding: 8px 12px; "
-                   "border-radius: 12px; border-bottom-left-radius: 4px; "
-                   "display: inline-block; max-width: 300px; margin-top: 2px; "
-                   "word-wrap: break-word;'>"
-                   "<div style='font-size: 16px; margin-bottom: 5px;'>%3</div>"
-                   "<div style='font-weight: bold; font-size: 12px;'>%4</div>"
-                   "<div style='font-size: 11px; opacity: 0.9; margin-top: 5px;'>"
-                   "📏 大小: %5<br>"
-                   "%6"
-                   "</div>"
-                   "</div>"
-                   "<div style='color: #999; font-size: 9px; margin-top: 2px;'>%7</div>"
-                   "</div>")
-                   .arg(bubbleColor,
-                        sender,
-                        fileIcon,
-                        fileName.toHtmlEscaped(),
-                        sizeStr,
-                        downloadLink,
-                        currentTime);
-    }
-
-    QTextCursor cursor(ui->chatText->document());
-    cursor.movePosition(QTextCursor::End);
-    cursor.insertHtml(html);
-
-    QScrollBar *scrollbar = ui->chatText->verticalScrollBar();
-    scrollbar->setValue(scrollbar->maximum());
-}
-
-// 修改 appendImageMessage 函数，添加私聊颜色支持
-void Widget::appendImageMessage(const QString &sender, const QImage &image, const QString &fileName,
+    chatModel->append(entry);
+    ui->chatText->scrollToBottom();
+}
+
+void Widget::appendImageMessage(const QString &sender, const QString &imagePath, const QString &fileName,
                                 const QString &filePath, bool isSelf)
 {
-    // 缩放图片以适应聊天窗口
-    QImage scaledImage = image.scaled(200, 200, Qt::KeepAspectRatio, Qt::SmoothTransformation);
-
-    // 转换为Base64
-    QByteArray byteArray;
-    QBuffer buffer(&byteArray);
-    buffer.open(QIODevice::WriteOnly);
-    scaledImage.save(&buffer, "PNG");
-    QString base64Image = QString::fromLatin1(byteArray.toBase64().data());
-
-    QString currentTime = QDateTime::currentDateTime().toString("hh:mm:ss");
-    QString html;
-
+    ChatEntry entry;
+    entry.kind = ChatEntry::Image;
+    entry.sender = sender;
+    entry.fileName = fileName;
+    entry.filePath = filePath;
+    // 缩略图在后台解码，先按文件头中的尺寸显示占位框
+    entry.thumbnailSize = ThumbnailLoader::displaySize(ImageSniffer::probe(imagePath).size);
+    entry.thumbnailId = thumbnails->request(imagePath);
+    entry.time = QDateTime::currentDateTime().toString("hh:mm:ss");
+    entry.self = isSelf;
     // 检查是否为私聊消息
-    bool isPrivate = currentChatTarget != "所有人" && currentChatTarget != username;
+    entry.isPrivate = currentChatTarget != "所有人" && currentChatTarget != username;
 
-    // 根据是否为私聊设置颜色
-    QString bubbleColor = isPrivate ? "#049e04" : "#333";
-    QString linkColor = "#007AFF"; // 链接颜色保持蓝色
-
-    // 创建文件URL链接
-    QString fileUrl = QUrl::fromLocalFile(filePath).toString();
-    QString downloadLink = QString("<a href='%1' style='color: %2; text-decoration: none;'>%3</a>")
-                               .arg(fileUrl, linkColor, fileName.toHtmlEscaped());
-
-    if (isSelf) {
-        // 自己发送的图片消息 - 显示在右侧
-        html = QString(
-                   "<br/>"
-                   "<div style='margin: 10px; text-align: right;'>"
-                   "<div style='display: inline-block; max-width: 70%%; text-align: left;'>"
-                   "<div style='color: %1; padding: 8px; "
-                   "border-radius: 12px; border-bottom-right-radius: 4px; margin-left: auto; "
-                   "word-wrap: break-word; max-width: 300px;'>"
-                   "<a href='%2' style='text-decoration: none;'>"
-                   "<img src='data:image/png;base64,%3' "
-                   "style='max-width: 280px; border-radius: 5px; cursor: pointer; display: block;'/>"
-                   "</a>"
-                   "<div style='font-size: 10px; margin-top: 5px; opacity: 0.9; color: %1;'>"
-                   "🖼️ %4<br>"
-                   "💾 点击图片查看"
-                   "</div>"
-                   "</div>"
-                   "<div style='color: #666; font-size: 10px; margin-top: 2px;'>"
-                   "<span style='color:%1; font-weight: bold;'>[我]</span> "
-                   "<span style='color: #999;'>%5</span>"
-                   "</div>"
-                   "</div>"
-                   "</div>")
-                   .arg(bubbleColor,
-                        fileUrl,
-                        base64Image,
-                        downloadLink,
-                        currentTime);
-    } else {
-        // 他人发送的图片消息 - 显示在左侧
-        html = QString(
-                   "<br/>"
-                   "<div style='margin: 10px;'>"
-                   "<div style='color: #666; font-size: 10px;'>"
-                   "<span style='color: %1; font-weight: bold;'>[%2]</span> "
-                   "</div>"
-                   "<div style='color: %1; padding: 8px; "
-                   "border-radius: 12px; border-bottom-left-radius: 4px; "
-                   "display: inline-block; max-width: 300px; margin-top: 2px; margin-bottom: 5px;'>"
-                   "<a href='%3' style='text-decoration: none;'>"
-                   "<img src='data:image/png;base64,%4' "
-                   "style='max-width: 280px; border-radius: 5px; cursor: pointer; display: block;'/>"
-                   "</a>"
-                   "<div style='color: %1; font-size: 10px; margin-top: 5px;'>"
-                   "🖼️ %5<br>"
-                   "💾 点击图片查看"
-                   "</div>"
-                   "</div>"
-                   "<div style='color: #999; font-size: 9px;'>接收时间: %6</div>"
-                   "</div>")
-                   .arg(bubbleColor,
-                        sender,
-                        fileUrl,
-                        base64Image,
-                        downloadLink,
-                        currentTime);
-    }
-
-    QTextCursor cursor(ui->chatText->document());
-    cursor.movePosition(QTextCursor::End);
-    cursor.insertHtml(html);
-
-    QScrollBar *scrollbar = ui->chatText->verticalScrollBar();
-    scrollbar->setValue(scrollbar->maximum());
+    chatModel->append(entry);
+    ui->chatText->scrollToBottom();
 }
 void Widget::appendSystemMessage(const QString &message)
 {
-    QString html = QString(
-                       "<br/>"
-                       "<div style='text-align: center; margin: 10px;'>"
-                       "<span style='color: #888; font-size: 11px; "
-                       "padding: 5px 10px; border-radius: 10px; "
-                       "display: inline-block;'>"
-                       "[系统]%1<br>"
-                       "<span style='font-size: 9px; color: #aaa;'>%2</span>"
-                       "</span>"
-                       "</div>")
-                       .arg(message.toHtmlEscaped(), QDateTime::currentDateTime().toString("hh:mm:ss"));
-
-    QTextCursor cursor(ui->chatText->document());
-    cursor.movePosition(QTextCursor::End);
-    cursor.insertHtml(html);
-
-    // 滚动到底部
-    QScrollBar *scrollbar = ui->chatText->verticalScrollBar();
-    scrollbar->setValue(scrollbar->maximum());
+    ChatEntry entry;
+    entry.kind = ChatEntry::System;
+    entry.text = message;
+    entry.time = QDateTime::currentDateTime().toString("hh:mm:ss");
+
+    chatModel->append(entry);
+    ui->chatText->scrollToBottom();
 }
 void Widget::processTextMessage(const QString &message)
 {
@@ -1534,9 +2057,8 @@ void Widget::saveReceivedFile(const QByteArray &fileData, const QString &fileNam
 
         // 如果是图片，显示在聊天窗口（传递5个参数）
         if (fileType == Image) {
-            QImage image;
-            if (image.load(savePath)) {
-                appendImageMessage("系统", image, fileName, savePath, false);
+            if (ImageSniffer::probe(savePath).isImage()) {
+                appendImageMessage("系统", savePath, fileName, savePath, false);
             }
         } else if (fileType == Video) {
             // 注意：appendFileMessage 函数也需要更新为5个参数
@@ -1569,6 +2091,26 @@ Widget::FileType Widget::getFileType(const QString &filePath)
     }
 }
 
+// 图片、音视频、压缩包和 Office 文档本身已经压缩过，不再浪费 CPU 尝试
+bool Widget::isCompressibleFile(const QString &filePath)
+{
+    FileType type = getFileType(filePath);
+    if (type == Image || type == Video || type == Audio) return false;
+
+    static const QStringList packedTypes = {
+        "application/zip", "application/gzip", "application/x-7z-compressed",
+        "application/vnd.rar", "application/x-rar-compressed", "application/x-xz",
+        "application/x-bzip2", "application/zstd", "application/x-compressed-tar",
+        "application/pdf", "application/java-archive", "application/vnd.android.package-archive"
+    };
+    QMimeDatabase mimeDb;
+    QMimeType mimeType = mimeDb.mimeTypeForFile(filePath);
+    for (const QString &packed : packedTypes) {
+        if (mimeType.inherits(packed)) return false;
+    }
+    return true;
+}
+
 QString Widget::getFileTypeString(FileType type)
 {
     switch (type) {
@@ -1617,6 +2159,25 @@ void Widget::onSocketError(QAbstractSocket::SocketError error)
         errorMsg = tcpSocket->errorString();
     }
 
+    // 保存的地址连不上，但局域网查找还没结束，等查找结果再决定
+    if (!isConnected && discovery->isRunning()) {
+        deferredConnectError = errorMsg;
+        ui->statusLabel->setText("正在查找服务器...");
+        return;
+    }
+
+    reportConnectError(errorMsg);
+}
+
+void Widget::reportConnectError(const QString &errorMsg)
+{
+    deferredConnectError.clear();
+    if (reconnectAttempts > 0) {
+        // 自动重连失败，不弹窗，退避后再试
+        qDebug() << "重连失败:" << errorMsg;
+        scheduleReconnect();
+        return;
+    }
     ui->statusLabel->setText("连接错误");
     ui->statusLabel->setStyleSheet("color: red;");
     ui->connectButton->setEnabled(true);
@@ -1631,6 +2192,10 @@ void Widget::onDisconnectClicked()
 
 void Widget::disconnectFromServer()
 {
+    // 用户主动断开，停止自动重连
+    manualDisconnect = true;
+    reconnectTimer->stop();
+    reconnectAttempts = 0;
     if (tcpSocket->state() == QAbstractSocket::ConnectedState) {
         tcpSocket->disconnectFromHost();
     } else {
@@ -1651,14 +2216,9 @@ void Widget::onMessageReturnPressed()
     onSendClicked();
 }
 // 修改 sendFile 函数，添加私聊支持
-void Widget::sendFile(const QString &filePath)
+// 只负责建立上传任务并加入队列，实际发送由 pumpUploads() 在 bytesWritten 信号中推进
+void Widget::sendFile(const QString &filePath, const QString &targetUser)
 {
-    QFile file(filePath);
-    if (!file.open(QIODevice::ReadOnly)) {
-        QMessageBox::warning(this, "错误", "无法打开文件");
-        return;
-    }
-
     QFileInfo fileInfo(filePath);
     QString fileName = fileInfo.fileName();
     qint64 fileSize = fileInfo.size();
@@ -1673,126 +2233,693 @@ void Widget::sendFile(const QString &filePath)
         }
     }
 
-    // 计算分块数量（每块50KB）
-    const qint64 CHUNK_SIZE = 50 * 1024;
-    int totalChunks = std::ceil((double)fileSize / CHUNK_SIZE);
-
     // 生成唯一文件ID
     QString fileId = QString("%1_%2")
                          .arg(QDateTime::currentMSecsSinceEpoch())
                          .arg(QRandomGenerator::global()->generate());
+    // 服务器支持去重时先询问接收方是否已有相同内容，收到 file_offer_result 后再决定是否上传。
+    // 哈希在线程池中计算，算完再发 file_offer；期间重连时由日志续传接手
+    UploadRequest upload{filePath, fileName, targetUser};
+    if (serverDedup) {
+        auto sha256 = std::make_shared<QString>();
+        const quint32 generation = connectGeneration;
+        runInBackground([filePath, sha256]() { *sha256 = BlobCache::hashFile(filePath); },
+                        [this, fileId, upload, fileSize, sha256, generation]() {
+            if (generation != connectGeneration) return;
+            offerUpload(fileId, upload, fileSize, *sha256);
+        });
+    } else if (!beginUpload(fileId, upload)) {
+        QMessageBox::warning(this, "错误", "无法打开文件");
+        return;
+    }
 
-    // 显示上传进度
-    ui->uploadProgressBar->setVisible(true);
-    ui->uploadProgressBar->setRange(0, totalChunks);
-    ui->uploadProgressBar->setValue(0);
-    ui->uploadStatusLabel->setText(QString("上传中: %1 (0/%2)").arg(fileName).arg(totalChunks));
-
-    // 是否为私聊
-    bool isPrivate = currentChatTarget != "所有人" && currentChatTarget != username;
+    // 记录到传输日志，断线后可以续传，接收方缺少分块时可以从原文件补发
+    TransferJournal::Outgoing entry;
+    entry.fileId = fileId;
+    entry.filePath = filePath;
+    entry.fileName = fileName;
+    entry.targetUser = targetUser;
+    entry.fileSize = fileSize;
+    entry.modified = fileInfo.lastModified();
+    entry.totalChunks = int((fileSize + CHUNK_SIZE - 1) / CHUNK_SIZE);
+    journal->putOutgoing(entry);
 
     // 本地先显示文件消息（预览）
     QString savePath = saveBase64File(fileName, QByteArray(), false); // 先保存一个空文件
     if (isImage) {
-        QImage image(filePath);
-        if (!image.isNull()) {
-            appendImageMessage(username, image, fileName, savePath, true);
+        if (ImageSniffer::probe(filePath).isImage()) {
+            appendImageMessage(username, filePath, fileName, savePath, true);
         }
     } else {
         appendFileMessage(username, fileName, fileSize, savePath, true);
     }
 
-    // 发送分块
-    int successfulChunks = 0;
-    for (int chunkIndex = 0; chunkIndex < totalChunks; chunkIndex++) {
-        // 读取块数据
-        qint64 readSize = qMin(CHUNK_SIZE, fileSize - chunkIndex * CHUNK_SIZE);
-        QByteArray chunkData = file.read(readSize);
+    ui->uploadProgressBar->setVisible(true);
+    startUploads();
+    pumpUploads();
+}
 
-        if (chunkData.isEmpty()) {
-            qDebug() << "读取文件块失败";
-            break;
+// 建立上传任务并加入等待队列；chunkIndices 非空时只发送这些分块（续传或补发），
+// resend 为 true 时只发给 targetUser 且不计入发送进度
+bool Widget::queueUpload(const QString &filePath, const QString &fileId, const QString &targetUser,
+                         const QList<int> &chunkIndices, bool resend)
+{
+    QFileInfo fileInfo(filePath);
+    ChunkPipeline *pipeline = new ChunkPipeline(filePath, fileInfo.size(), CHUNK_SIZE, this);
+    if (!pipeline->open()) {
+        delete pipeline;
+        return false;
+    }
+    pipeline->setChunkIndices(chunkIndices);
+
+    FileTransfer *transfer = new FileTransfer;
+    transfer->pipeline = pipeline;
+    transfer->fileName = fileInfo.fileName();
+    transfer->fileId = fileId;
+    transfer->targetUser = targetUser;
+    transfer->fileSize = fileInfo.size();
+    transfer->fileType = getFileType(filePath);
+    transfer->streamId = 0;
+    transfer->binary = false;
+    transfer->channel = outbound;
+    transfer->compressible = isCompressibleFile(filePath);
+    transfer->peerLink = nullptr;
+    transfer->totalChunks = pipeline->fileChunkCount();
+    transfer->nextChunk = 0;
+    transfer->bytesWritten = 0;
+    transfer->bytesTotal = pipeline->byteCount();
+    transfer->isSending = false;
+    transfer->resend = resend;
+    pendingUploads.append(transfer);
+    return true;
+}
+
+// 从等待队列中启动上传，直到达到并发上限
+void Widget::startUploads()
+{
+    while (activeUploads.size() < MAX_CONCURRENT_UPLOADS && !pendingUploads.isEmpty()) {
+        FileTransfer *transfer = pendingUploads.takeFirst();
+        transfer->isSending = true;
+        // 直连的上传走直连；有文件连接时走文件连接（都是二进制帧），否则走聊天连接的批量队列
+        if (transfer->peerLink) {
+            transfer->channel = transfer->peerLink->outbound;
+        } else {
+            transfer->channel = bulkReady ? bulkOutbound : outbound;
+        }
+        transfer->binary = transfer->peerLink || bulkReady || binaryFraming;
+        activeUploads.append(transfer);
+
+        // 二进制帧模式下先发送文件元数据，之后的分块只携带流ID和原始数据
+        if (transfer->binary) {
+            transfer->streamId = nextStreamId++;
+
+            QJsonObject metaJson;
+            metaJson["sender"] = username;
+            metaJson["file_id"] = transfer->fileId;
+            metaJson["file_name"] = transfer->fileName;
+            metaJson["file_size"] = transfer->fileSize;
+            metaJson["total_chunks"] = transfer->totalChunks;
+            metaJson["chunk_size"] = CHUNK_SIZE;
+            if (!transfer->targetUser.isEmpty()) {
+                metaJson["target"] = transfer->targetUser;
+            }
+            if (transfer->resend) {
+                metaJson["resend"] = true;
+                metaJson["resend_chunks"] = transfer->pipeline->chunkCount();
+            } else if (transfer->pipeline->chunkCount() != transfer->totalChunks) {
+                metaJson["chunk_count"] = transfer->pipeline->chunkCount();  // 续传只发剩余的分块
+            }
+            // 元数据和分块走同一条批量队列，保证先于分块发出
+            transfer->channel->enqueue(OutboundScheduler::Bulk,
+                                       FrameEncoder::encode(FileMetaFrame, transfer->streamId,
+                                                            QJsonDocument(metaJson).toJson(QJsonDocument::Compact)));
+            transfer->pipeline->setBinary(transfer->streamId);
+            // 直连的对方是本客户端，总能解压
+            transfer->pipeline->setCompression((chunkCompression || transfer->peerLink)
+                                               && transfer->compressible);
+        } else {
+            // JSON 分块的公共字段，编码线程在此基础上加入分块数据
+            QJsonObject header;
+            header["type"] = "file_chunk";
+            header["sender"] = username;
+            header["file_id"] = transfer->fileId;
+            header["file_name"] = transfer->fileName;
+            header["file_size"] = QString::number(transfer->fileSize);
+            header["total_chunks"] = transfer->totalChunks;
+            // 如果是私聊，添加目标
+            if (!transfer->targetUser.isEmpty()) {
+                header["target"] = transfer->targetUser;
+            }
+            if (transfer->resend) {
+                header["resend"] = true;
+                header["resend_chunks"] = transfer->pipeline->chunkCount();
+            } else if (transfer->pipeline->chunkCount() != transfer->totalChunks) {
+                header["chunk_count"] = transfer->pipeline->chunkCount();
+            }
+            transfer->pipeline->setJsonHeader(header);
         }
 
-        // Base64编码
-        QString base64Data = chunkData.toBase64();
+        if (transfer->pipeline->chunkCount() == 0) {
+            finishUpload(transfer, true);
+            continue;
+        }
 
-        // 清理Base64数据
-        base64Data = base64Data.replace("\n", "").replace("\r", "");
+        connect(transfer->pipeline, &ChunkPipeline::chunkReady, this, &Widget::pumpUploads);
+        connect(transfer->pipeline, &ChunkPipeline::failed, this, [this, transfer](const QString &reason) {
+            qDebug() << "上传失败:" << transfer->fileName << reason;
+            finishUpload(transfer, false);
+        });
+        transfer->pipeline->start();
+    }
+}
 
-        // 构建分块消息
-        QJsonObject chunkJson;
-        chunkJson["type"] = "file_chunk";
-        chunkJson["sender"] = username;
-        chunkJson["file_id"] = fileId;
-        chunkJson["file_name"] = fileName;
-        chunkJson["file_size"] = QString::number(fileSize);
-        chunkJson["total_chunks"] = totalChunks;
-        chunkJson["chunk_index"] = chunkIndex;
-        chunkJson["chunk_data"] = base64Data;
-        chunkJson["chunk_size"] = QString::number(chunkData.size());
+// 在所用连接的批量积压低于 UPLOAD_WINDOW 时，轮流从各个上传中取下一个已编码的分块交给发送调度
+// 不阻塞、不进入事件循环，剩余部分等下一次 flushed 或 chunkReady 再继续
+void Widget::pumpUploads()
+{
+    if (!isConnected) return;
 
-        // 如果是私聊，添加目标
-        if (isPrivate) {
-            chunkJson["target"] = currentChatTarget;
+    while (!activeUploads.isEmpty()) {
+        // 找到下一个已有编码完成分块、且所用连接还有空间的上传
+        FileTransfer *transfer = nullptr;
+        for (int i = 0; i < activeUploads.size(); ++i) {
+            FileTransfer *candidate = activeUploads.at((uploadCursor + i) % activeUploads.size());
+            if (candidate->pipeline->hasNext() && candidate->channel->bulkBacklog() < UPLOAD_WINDOW) {
+                transfer = candidate;
+                uploadCursor = (uploadCursor + i + 1) % activeUploads.size();
+                break;
+            }
         }
+        if (!transfer) break;  // 没有就绪的分块，等待编码或发送完成
 
-        QJsonDocument doc(chunkJson);
-        QByteArray jsonData = doc.toJson(QJsonDocument::Compact) + "\n";
+        writeUploadChunk(transfer);
+    }
+}
 
-        // 发送分块
-        qint64 bytesWritten = tcpSocket->write(jsonData);
-        if (bytesWritten == -1) {
-            qDebug() << "发送文件块失败";
-            break;
-        }
+// 把流水线输出的下一个分块放入批量队列，记录帧 ID 以便发出后确认
+bool Widget::writeUploadChunk(FileTransfer *transfer)
+{
+    ChunkPipeline::EncodedChunk chunk;
+    if (!transfer->pipeline->takeNext(chunk)) return false;
 
-        successfulChunks++;
+    quint64 id;
+    if (transfer->binary) {
+        // 二进制帧：流水线已编码为完整的 FileChunk 帧
+        id = transfer->channel->enqueue(OutboundScheduler::Bulk, chunk.data);
+    } else {
+        // 传输开始后才协商出二进制帧时，writeMessage 会把这一行包成消息帧
+        id = writeMessage(chunk.data, OutboundScheduler::Bulk);
+    }
 
-        // 更新进度
-        ui->uploadProgressBar->setValue(successfulChunks);
-        ui->uploadStatusLabel->setText(QString("上传中: %1 (%2/%3)")
-                                           .arg(fileName)
-                                           .arg(successfulChunks)
-                                           .arg(totalChunks));
+    transfer->nextChunk++;
+    uploadFramesInFlight.insert(id, {transfer, chunk.fileBytes, chunk.index});
+    return true;
+}
 
-        // 确保数据发送
-        if (!tcpSocket->waitForBytesWritten(1000)) {
-            qDebug() << "等待写入超时";
-        }
+// 分块离开套接字缓冲区后确认进度；批量队列按顺序写出，同一上传的分块按序确认
+void Widget::onUploadFrameSent(quint64 id)
+{
+    auto it = uploadFramesInFlight.find(id);
+    if (it == uploadFramesInFlight.end()) return;  // 不是上传分块，或上传已经结束
+    UploadFrame frame = it.value();
+    uploadFramesInFlight.erase(it);
 
-        // 小延迟避免网络拥塞
-        QThread::msleep(5);
-        QCoreApplication::processEvents();
+    FileTransfer *transfer = frame.transfer;
+    transfer->bytesWritten += frame.fileBytes;
+    if (!transfer->resend) {
+        journal->markSent(transfer->fileId, frame.chunkIndex + 1);
+    }
+    if (transfer->nextChunk == transfer->pipeline->chunkCount()
+        && transfer->bytesWritten >= transfer->bytesTotal) {
+        finishUpload(transfer, true);
     }
+}
 
-    file.close();
+void Widget::finishUpload(FileTransfer *transfer, bool success)
+{
+    if (success) {
+        if (!transfer->resend) {
+            journal->markFinished(transfer->fileId);
+        }
 
-    if (successfulChunks == totalChunks) {
         // 显示上传完成
-        ui->uploadStatusLabel->setText(QString("已上传: %1").arg(fileName));
+        QString summary = transfer->pipeline->statsSummary() + "\n" + transfer->channel->statsSummary();
+        qDebug() << "上传完成:" << transfer->fileName << summary;
+        ui->uploadStatusLabel->setText(QString("已上传: %1").arg(transfer->fileName));
+        ui->uploadStatusLabel->setToolTip(summary);
+    } else {
+        ui->uploadStatusLabel->setText(QString("上传失败: %1 (%2/%3)")
+                                           .arg(transfer->fileName)
+                                           .arg(transfer->nextChunk)
+                                           .arg(transfer->pipeline->chunkCount()));
+        appendSystemMessage(QString("文件 %1 上传失败").arg(transfer->fileName));
+    }
+
+    detachUpload(transfer, success);
+    startUploads();
 
+    if (activeUploads.isEmpty() && pendingUploads.isEmpty()) {
         QTimer::singleShot(2000, this, [this]() {
-            ui->uploadProgressBar->setVisible(false);
-            ui->uploadStatusLabel->setText("就绪");
+            if (activeUploads.isEmpty() && pendingUploads.isEmpty()) {
+                ui->uploadProgressBar->setVisible(false);
+                ui->uploadStatusLabel->setText("就绪");
+            }
         });
     } else {
-        ui->uploadStatusLabel->setText(QString("上传失败: %1 (%2/%3)")
-                                           .arg(fileName)
-                                           .arg(successfulChunks)
-                                           .arg(totalChunks));
-        appendSystemMessage(QString("文件 %1 上传失败").arg(fileName));
+        updateUploadProgress(0, 0);
     }
 }
-void Widget::sendMessage(const QString &message)
+
+// 把上传从队列中移除并释放，不提示结果；连接中断时由续传决定最终结果
+void Widget::detachUpload(FileTransfer *transfer, bool graceful)
 {
-    if (!isConnected) {
-        QMessageBox::warning(this, "发送失败", "未连接到服务器");
+    activeUploads.removeOne(transfer);
+    pendingUploads.removeOne(transfer);
+    if (uploadCursor >= activeUploads.size()) uploadCursor = 0;
+
+    // 丢弃这个上传仍在缓冲区中的分块记录
+    for (auto it = uploadFramesInFlight.begin(); it != uploadFramesInFlight.end();) {
+        if (it.value().transfer == transfer) {
+            it = uploadFramesInFlight.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    // 发完后正常关闭直连，接收方收到断开后清理；失败时由调用方决定是否经服务器续传
+    if (transfer->peerLink) {
+        closePeerLink(transfer->peerLink, graceful);
+        transfer->peerLink = nullptr;
+    }
+
+    // 可能正处于流水线自身的信号中，延迟删除
+    transfer->pipeline->cancel();
+    transfer->pipeline->deleteLater();
+    delete transfer;
+}
+
+// 用 login_ack 中的端口和令牌建立文件连接，服务器确认之前上传仍走聊天连接
+void Widget::openBulkChannel(quint16 port, const QString &token)
+{
+    if (port == 0 || token.isEmpty()) return;
+    closeBulkChannel();
+    bulkToken = token;
+    bulkSocket->connectToHost(serverAddress, port);
+}
+
+void Widget::closeBulkChannel()
+{
+    bulkToken.clear();
+    bulkSocket->abort();
+    bulkReady = false;
+    bulkOutbound->clear();
+}
+
+void Widget::onBulkConnected()
+{
+    bulkDecoder.clear();
+    bulkDecoder.setMode(FrameDecoder::BinaryMode);
+    bulkOutbound->clear();
+
+    QJsonObject hello;
+    hello["type"] = "bulk_hello";
+    hello["token"] = bulkToken;
+    bulkOutbound->enqueue(OutboundScheduler::Interactive,
+                          FrameEncoder::encode(MessageFrame, 0, QJsonDocument(hello).toJson(QJsonDocument::Compact)));
+    bulkToken.clear();  // 令牌只能使用一次
+}
+
+// 文件连接断开：正在这条连接上发送的文件从日志记录的位置改走聊天连接，
+// 接收方缺少的分块由 file_resend 补齐
+void Widget::onBulkDisconnected()
+{
+    bool wasReady = bulkReady;
+    bulkReady = false;
+    bulkOutbound->clear();
+    if (wasReady) qDebug() << "文件连接已断开";
+
+    QList<FileTransfer*> interrupted;
+    for (auto transfer : std::as_const(activeUploads)) {
+        if (transfer->channel == bulkOutbound) interrupted.append(transfer);
+    }
+    for (auto transfer : std::as_const(interrupted)) {
+        detachUpload(transfer, false);
+    }
+    startUploads();
+
+    if (!interrupted.isEmpty() && isConnected) {
+        transfersResumed = false;
+        resumeTransfers();
+    }
+}
+
+void Widget::onBulkReadyRead()
+{
+    bulkDecoder.append(bulkSocket->readAll());
+
+    Frame frame;
+    while (bulkDecoder.nextFrame(frame)) {
+        if (frame.type == MessageFrame) {
+            // 文件连接上只有握手确认这一条消息
+            QJsonObject json = QJsonDocument::fromJson(
+                QByteArray::fromRawData(frame.payload.data(), frame.payload.size())).object();
+            if (json["type"].toString() == "bulk_ready" && !bulkReady) {
+                bulkReady = true;
+                qDebug() << "文件连接已建立";
+                startUploads();
+                pumpUploads();
+            }
+            continue;
+        }
+        processFrame(frame);  // 文件元数据和分块与聊天连接上的处理相同
+    }
+    if (bulkDecoder.hasError()) {
+        qWarning() << "文件连接收到无法解析的数据，断开";
+        bulkSocket->abort();  // 触发 onBulkDisconnected，上传改走聊天连接
+    }
+}
+
+// 私聊且服务器会转交直连时先尝试直连，否则加入上传队列经服务器转发；文件无法打开时返回 false
+bool Widget::beginUpload(const QString &fileId, const UploadRequest &upload)
+{
+    if (serverPeerToPeer && !upload.targetUser.isEmpty()) {
+        if (!QFileInfo(upload.filePath).isReadable()) return false;
+        startPeerUpload(fileId, upload);
+        return true;
+    }
+    if (!queueUpload(upload.filePath, fileId, upload.targetUser)) return false;
+    startUploads();
+    pumpUploads();
+    return true;
+}
+
+// 发送方：在临时端口上等待接收方连接，经服务器把端口和令牌交给接收方
+void Widget::startPeerUpload(const QString &fileId, const UploadRequest &upload)
+{
+    PeerLink *link = new PeerLink;
+    link->fileId = fileId;
+    link->peer = upload.targetUser;
+    link->sending = true;
+    link->upload = upload;
+    link->server = new QTcpServer(this);
+    link->socket = nullptr;
+    link->outbound = nullptr;
+    link->streamId = 0;
+    link->timeout = new QTimer(this);
+    link->timeout->setSingleShot(true);
+    peerLinks.insert(fileId, link);
+
+    if (!link->server->listen(QHostAddress::Any, 0)) {
+        fallbackToRelay(link, link->server->errorString());
         return;
     }
 
-    // 检查是否为命令
+    // 令牌防止局域网中的其他人连上这个端口冒充接收方
+    QByteArray token(16, Qt::Uninitialized);
+    QRandomGenerator::system()->fillRange(reinterpret_cast<quint32 *>(token.data()), token.size() / 4);
+    link->token = QString::fromLatin1(token.toHex());
+
+    connect(link->server, &QTcpServer::newConnection, this, [this, link]() { onPeerConnection(link); });
+    connect(link->timeout, &QTimer::timeout, this, [this, link]() { fallbackToRelay(link, "直连超时"); });
+    link->timeout->start(PEER_CONNECT_TIMEOUT);
+
+    // 服务器补上我们的地址后转交给接收方
+    QJsonObject offer;
+    offer["type"] = "p2p_offer";
+    offer["sender"] = username;
+    offer["target"] = upload.targetUser;
+    offer["file_id"] = fileId;
+    offer["file_name"] = upload.fileName;
+    offer["file_size"] = QFileInfo(upload.filePath).size();
+    offer["port"] = link->server->serverPort();
+    offer["token"] = link->token;
+    writeMessage(QJsonDocument(offer).toJson(QJsonDocument::Compact));
+}
+
+// 发送方：只接受第一个连接，等它在 p2p_hello 中回送令牌
+void Widget::onPeerConnection(PeerLink *link)
+{
+    while (QTcpSocket *socket = link->server->nextPendingConnection()) {
+        if (link->socket) {
+            socket->abort();
+            socket->deleteLater();
+            continue;
+        }
+        socket->setParent(this);  // 关闭监听后继续使用
+        link->socket = socket;
+        link->decoder.clear();
+        link->decoder.setMode(FrameDecoder::BinaryMode);
+        connect(socket, &QTcpSocket::readyRead, this, [this, link]() { onPeerReadyRead(link); });
+        connect(socket, &QTcpSocket::disconnected, this, [this, link]() { onPeerDisconnected(link); });
+    }
+}
+
+void Widget::onPeerReadyRead(PeerLink *link)
+{
+    link->decoder.append(link->socket->readAll());
+
+    Frame frame;
+    while (link->decoder.nextFrame(frame)) {
+        if (!link->sending) {
+            // 接收方：文件元数据和分块与服务器转发的处理相同，流ID换成本地分配的
+            if (frame.type == FileMetaFrame || frame.type == FileChunkFrame) {
+                frame.streamId = link->streamId;
+                processFrame(frame);
+            }
+            continue;
+        }
+
+        // 发送方：握手之后接收方不再发送数据
+        if (link->outbound) continue;
+        QJsonObject hello = QJsonDocument::fromJson(
+            QByteArray::fromRawData(frame.payload.data(), frame.payload.size())).object();
+        if (frame.type != MessageFrame || hello["type"].toString() != "p2p_hello"
+            || hello["token"].toString() != link->token) {
+            fallbackToRelay(link, "直连握手失败");
+            return;
+        }
+
+        link->timeout->stop();
+        link->server->close();
+        link->outbound = new OutboundScheduler(link->socket, UPLOAD_WINDOW, this);
+        connect(link->outbound, &OutboundScheduler::frameSent, this, &Widget::onUploadFrameSent);
+        connect(link->outbound, &OutboundScheduler::flushed, this, [this]() {
+            updateUploadProgress(0, 0);
+            pumpUploads();
+        });
+
+        if (!queueUpload(link->upload.filePath, link->fileId, link->upload.targetUser)) {
+            appendSystemMessage(QString("无法打开文件: %1").arg(link->upload.fileName));
+            closePeerLink(link, false);
+            return;
+        }
+        pendingUploads.last()->peerLink = link;
+        qDebug() << "已直连接收方:" << link->peer << link->upload.fileName;
+        startUploads();
+        pumpUploads();
+        return;  // 空文件时 startUploads 已经关闭了直连
+    }
+    if (link->decoder.hasError()) {
+        qWarning() << "直连收到无法解析的数据，断开:" << link->peer;
+        link->socket->abort();  // 触发 onPeerDisconnected
+    }
+}
+
+// 发送方在握手前断开时改由服务器转发，传输中断开时按日志从已发出的位置续传
+void Widget::onPeerDisconnected(PeerLink *link)
+{
+    if (!link->sending) {
+        closePeerLink(link, false);  // 没收完的分块由补发请求经服务器补齐
+        return;
+    }
+    if (!link->outbound) {
+        fallbackToRelay(link, "接收方断开了直连");
+        return;
+    }
+
+    FileTransfer *interrupted = nullptr;
+    for (auto transfer : activeUploads + pendingUploads) {
+        if (transfer->peerLink == link) interrupted = transfer;
+    }
+    if (!interrupted) {
+        closePeerLink(link, false);
+        return;
+    }
+    detachUpload(interrupted, false);  // 同时关闭直连
+    startUploads();
+    if (isConnected) {
+        transfersResumed = false;
+        resumeTransfers();
+    }
+}
+
+// 接收方：连接服务器转交的发送方地址，连不上时通知发送方改由服务器转发
+void Widget::acceptPeerOffer(const QJsonObject &offer)
+{
+    QString fileId = offer["file_id"].toString();
+    if (fileId.isEmpty() || peerLinks.contains(fileId)) return;
+
+    PeerLink *link = new PeerLink;
+    link->fileId = fileId;
+    link->peer = offer["sender"].toString();
+    link->sending = false;
+    link->token = offer["token"].toString();
+    link->server = nullptr;
+    link->socket = new QTcpSocket(this);
+    link->outbound = nullptr;
+    link->decoder.setMode(FrameDecoder::BinaryMode);
+    link->streamId = PEER_STREAM_BIT | nextPeerStreamId++;
+    link->timeout = new QTimer(this);
+    link->timeout->setSingleShot(true);
+    peerLinks.insert(fileId, link);
+
+    connect(link->socket, &QTcpSocket::connected, this, [this, link]() {
+        link->timeout->stop();
+        QJsonObject hello;
+        hello["type"] = "p2p_hello";
+        hello["token"] = link->token;
+        link->socket->write(FrameEncoder::encode(MessageFrame, 0, QJsonDocument(hello).toJson(QJsonDocument::Compact)));
+        qDebug() << "已直连发送方:" << link->peer;
+    });
+    connect(link->socket, &QTcpSocket::readyRead, this, [this, link]() { onPeerReadyRead(link); });
+    connect(link->socket, &QTcpSocket::disconnected, this, [this, link]() { onPeerDisconnected(link); });
+    connect(link->socket, &QTcpSocket::errorOccurred, this, [this, link](QAbstractSocket::SocketError) {
+        // 连接建立之后的错误随后会触发 disconnected
+        if (link->timeout->isActive()) rejectPeerOffer(link, link->socket->errorString());
+    });
+    connect(link->timeout, &QTimer::timeout, this, [this, link]() { rejectPeerOffer(link, "直连超时"); });
+    link->timeout->start(PEER_CONNECT_TIMEOUT);
+
+    // 服务器记录的可能是 IPv4 映射的 IPv6 地址，按 IPv4 连接
+    QHostAddress host(offer["host"].toString());
+    bool isIPv4 = false;
+    quint32 ipv4 = host.toIPv4Address(&isIPv4);
+    if (isIPv4) host = QHostAddress(ipv4);
+    link->socket->connectToHost(host, quint16(offer["port"].toInt()));
+}
+
+void Widget::rejectPeerOffer(PeerLink *link, const QString &reason)
+{
+    qDebug() << "无法直连" << link->peer << ":" << reason;
+    QJsonObject failed;
+    failed["type"] = "p2p_failed";
+    failed["sender"] = username;
+    failed["target"] = link->peer;
+    failed["file_id"] = link->fileId;
+    failed["reason"] = reason;
+    writeMessage(QJsonDocument(failed).toJson(QJsonDocument::Compact));
+    closePeerLink(link, false);
+}
+
+// 发送方：直连没有建立，文件改由服务器转发
+void Widget::fallbackToRelay(PeerLink *link, const QString &reason)
+{
+    QString fileId = link->fileId;
+    UploadRequest upload = link->upload;
+    closePeerLink(link, false);
+    qDebug() << "直连失败，改由服务器转发:" << upload.fileName << reason;
+
+    if (!isConnected) return;  // 重连后按日志续传
+    if (!queueUpload(upload.filePath, fileId, upload.targetUser)) {
+        appendSystemMessage(QString("无法打开文件: %1").arg(upload.fileName));
+        return;
+    }
+    startUploads();
+    pumpUploads();
+}
+
+// 关闭并释放直连；可能正处于它的套接字或定时器的信号中，对象延迟删除
+void Widget::closePeerLink(PeerLink *link, bool graceful)
+{
+    peerLinks.remove(link->fileId);
+    if (!link->sending) incomingStreams.remove(link->streamId);
+    link->timeout->stop();
+    link->timeout->disconnect(this);
+    link->timeout->deleteLater();
+    if (link->server) {
+        link->server->disconnect(this);
+        link->server->close();
+        link->server->deleteLater();
+    }
+    if (link->outbound) {
+        link->outbound->disconnect(this);
+        link->outbound->clear();
+        link->outbound->deleteLater();
+    }
+    if (link->socket) {
+        link->socket->disconnect(this);
+        if (graceful) {
+            link->socket->disconnectFromHost();  // 分块都已离开缓冲区，系统会发完剩余数据
+        } else {
+            link->socket->abort();
+        }
+        link->socket->deleteLater();
+    }
+    delete link;
+}
+
+void Widget::closePeerLinks()
+{
+    const QList<PeerLink*> links = peerLinks.values();
+    for (PeerLink *link : links) {
+        closePeerLink(link, false);
+    }
+}
+
+// 放弃所有上传（连接断开时调用）
+void Widget::cancelUpload()
+{
+    bool hadUploads = !activeUploads.isEmpty() || !pendingUploads.isEmpty();
+    // 先清空等待队列，避免 finishUpload 把它们启动到已断开的连接上
+    for (auto transfer : pendingUploads) {
+        appendSystemMessage(QString("文件 %1 上传失败").arg(transfer->fileName));
+        delete transfer->pipeline;
+        delete transfer;
+    }
+    pendingUploads.clear();
+    uploadFramesInFlight.clear();
+    while (!activeUploads.isEmpty()) {
+        finishUpload(activeUploads.first(), false);
+    }
+    uploadCursor = 0;
+    if (hadUploads) {
+        ui->uploadProgressBar->setVisible(false);
+    }
+}
+
+// 汇总所有上传的进度；参数为 0 时按当前队列重新计算
+void Widget::updateUploadProgress(qint64 bytesWritten, qint64 bytesTotal)
+{
+    int fileCount = activeUploads.size() + pendingUploads.size();
+    if (bytesTotal == 0) {
+        for (auto transfer : activeUploads) {
+            bytesWritten += transfer->bytesWritten;
+            bytesTotal += transfer->bytesTotal;
+        }
+        for (auto transfer : pendingUploads) {
+            bytesTotal += transfer->bytesTotal;
+        }
+    }
+    if (fileCount == 0 || bytesTotal == 0) return;
+
+    int percent = int(bytesWritten * 100 / bytesTotal);
+    ui->uploadProgressBar->setRange(0, 100);
+    ui->uploadProgressBar->setValue(percent);
+    if (fileCount == 1) {
+        FileTransfer *transfer = activeUploads.isEmpty() ? pendingUploads.first() : activeUploads.first();
+        ui->uploadStatusLabel->setText(QString("上传中: %1 (%2%)").arg(transfer->fileName).arg(percent));
+    } else {
+        ui->uploadStatusLabel->setText(QString("上传中: %1 个文件 (%2%)").arg(fileCount).arg(percent));
+    }
+}
+void Widget::sendMessage(const QString &message)
+{
+    // 检查是否为命令（命令不进入发件箱）
     if (message.startsWith("/")) {
+        if (!isConnected) {
+            QMessageBox::warning(this, "发送失败", "未连接到服务器");
+            return;
+        }
         sendCommand(message);
         ui->messageInput->clear();
         return;
@@ -1811,21 +2938,68 @@ void Widget::sendMessage(const QString &message)
     msgJson["sender"] = username;
     msgJson["content"] = message;
     msgJson["timestamp"] = QDateTime::currentDateTime().toString("yyyy-MM-dd hh:mm:ss");
-
-    QJsonDocument doc(msgJson);
-    QString jsonString = doc.toJson(QJsonDocument::Compact);
-    tcpSocket->write(jsonString.toUtf8() + "\n");
+    deliverMessage(msgJson);
 
     appendMessage(username, message, true);
     ui->messageInput->clear();
 }
 
+// 已连接时直接发出，否则放入发件箱，连接后由 flushOutbox() 按顺序发出
+void Widget::deliverMessage(const QJsonObject &message)
+{
+    if (isConnected) {
+        writeMessage(QJsonDocument(message).toJson(QJsonDocument::Compact));
+        return;
+    }
+
+    Outbox::Item item;
+    item.kind = Outbox::Item::Message;
+    item.message = message;
+    item.queued = QDateTime::currentDateTime();
+    if (!outbox->enqueue(item)) {
+        QMessageBox::warning(this, "发送失败", "未连接到服务器，发件箱已满");
+        return;
+    }
+    appendSystemMessage(QString("未连接，消息将在连接后发送（%1 条待发送）").arg(outbox->size()));
+}
+
+// 连接后发出发件箱：相邻的消息合并成一次写入，遇到文件时先写出之前的消息，保持原来的顺序
+void Widget::flushOutbox()
+{
+    if (!isConnected || outbox->isEmpty()) return;
+
+    QList<Outbox::Item> items = outbox->takeAll();
+    QByteArray batch;
+    int messages = 0;
+    for (const Outbox::Item &item : std::as_const(items)) {
+        if (item.kind == Outbox::Item::Message) {
+            QByteArray json = QJsonDocument(item.message).toJson(QJsonDocument::Compact);
+            batch += binaryFraming ? FrameEncoder::encode(MessageFrame, 0, json) : json + "\n";
+            messages++;
+            continue;
+        }
+        if (!batch.isEmpty()) {
+            writeToSocket(batch);
+            batch.clear();
+        }
+        if (QFileInfo::exists(item.filePath)) {
+            sendFile(item.filePath, item.targetUser);
+        } else {
+            appendSystemMessage(QString("文件 %1 已不存在，未发送").arg(item.filePath));
+        }
+    }
+    if (!batch.isEmpty()) writeToSocket(batch);
+
+    appendSystemMessage(QString("已发出离线时的 %1 条消息和 %2 个文件")
+                            .arg(messages).arg(items.size() - messages));
+}
+
 void Widget::sendCommand(const QString &command)
 {
     if (!isConnected) return;
 
     QString cmd = command.mid(1);  // 去掉开头的"/"
-    tcpSocket->write(cmd.toUtf8());
+    writeMessage(cmd.toUtf8());
 
     // 处理本地命令
     if (cmd.startsWith("name ")) {
@@ -1836,7 +3010,24 @@ void Widget::sendCommand(const QString &command)
     }
 }
 
-QString Widget::saveBase64File(const QString &fileName, const QByteArray &fileData, bool isImage)
+// sha256 非空时（调用方已在线程池中算好）保存后加入文件缓存
+QString Widget::saveBase64File(const QString &fileName, const QByteArray &fileData, bool isImage,
+                               const QString &sha256)
+{
+    QString savePath = uniqueSavePath(saveDirectory(isImage), fileName);
+
+    QFile file(savePath);
+    if (file.open(QIODevice::WriteOnly)) {
+        file.write(fileData);
+        file.close();
+        if (!sha256.isEmpty()) blobCache->insert(sha256, savePath);
+        return savePath;
+    }
+
+    return "";
+}
+
+QString Widget::saveDirectory(bool isImage)
 {
     QString saveDir;
 
@@ -1847,9 +3038,16 @@ QString Widget::saveBase64File(const QString &fileName, const QByteArray &fileDa
     }
 
     QDir().mkpath(saveDir);
+    return saveDir;
+}
+
+QString Widget::uniqueSavePath(const QString &saveDir, const QString &fileName)
+{
+    // 只保留文件名部分，防止对端发送带路径的文件名
+    QString baseFileName = QFileInfo(fileName).fileName();
 
     // 如果文件名已存在，添加时间戳
-    QString savePath = saveDir + fileName;
+    QString savePath = saveDir + baseFileName;
     QFileInfo fileInfo(savePath);
     if (fileInfo.exists()) {
         QString timestamp = QDateTime::currentDateTime().toString("yyyyMMdd_hhmmss");
@@ -1857,16 +3055,9 @@ QString Widget::saveBase64File(const QString &fileName, const QByteArray &fileDa
         QString suffix = fileInfo.suffix();
         savePath = saveDir + baseName + "_" + timestamp + "." + suffix;
     }
-
-    QFile file(savePath);
-    if (file.open(QIODevice::WriteOnly)) {
-        file.write(fileData);
-        file.close();
-        return savePath;
-    }
-
-    return "";
+    return savePath;
 }
+
 QString Widget::getTimestamp()
 {
     return QTime::currentTime().toString("hh:mm");
@@ -1882,7 +3073,7 @@ void Widget::updateUserList()
 {
     // 请求用户列表
     if (isConnected) {
-        tcpSocket->write("USERS\n");
+        writeMessage("USERS");
     }
 }
 
@@ -1919,7 +3110,7 @@ void Widget::onUserListItemClicked(QListWidgetItem *item)
 
 void Widget::onClearChatClicked()
 {
-    ui->chatText->clear();
+    chatModel->clear();
     appendSystemMessage("聊天记录已清空");
 }
 
@@ -1942,6 +3133,16 @@ void Widget::onSettingsClicked()
     // 保存聊天记录选项
     QCheckBox *saveHistoryCheck = new QCheckBox("保存聊天记录", &settingsDialog);
 
+    // 心跳间隔，服务器连续 3 个间隔无响应时重连
+    QHBoxLayout *heartbeatLayout = new QHBoxLayout();
+    QSpinBox *heartbeatSpin = new QSpinBox(&settingsDialog);
+    heartbeatSpin->setRange(200, 10000);
+    heartbeatSpin->setSingleStep(100);
+    heartbeatSpin->setSuffix(" 毫秒");
+    heartbeatSpin->setValue(heartbeat->interval());
+    heartbeatLayout->addWidget(new QLabel("心跳间隔", &settingsDialog));
+    heartbeatLayout->addWidget(heartbeatSpin);
+
     // 按钮
     QPushButton *saveButton = new QPushButton("保存", &settingsDialog);
     QPushButton *cancelButton = new QPushButton("取消", &settingsDialog);
@@ -1954,11 +3155,14 @@ void Widget::onSettingsClicked()
     layout->addWidget(autoConnectCheck);
     layout->addWidget(soundCheck);
     layout->addWidget(saveHistoryCheck);
+    layout->addLayout(heartbeatLayout);
     layout->addStretch();
     layout->addLayout(buttonLayout);
 
     connect(saveButton, &QPushButton::clicked, [&]() {
         ui->autoReconnectCheck->setChecked(autoConnectCheck->isChecked());
+        heartbeat->setInterval(heartbeatSpin->value());
+        saveSettings();
         settingsDialog.accept();
     });
 
@@ -1976,6 +3180,7 @@ void Widget::saveSettings()
     settings.setValue("Server/Address", serverAddress);
     settings.setValue("Server/Port", serverPort);
     settings.setValue("User/Username", username);
+    settings.setValue("Network/HeartbeatMs", heartbeat->interval());
     settings.setValue("Window/Geometry", saveGeometry());
     // settings.setValue("Window/State", saveState());
 }
@@ -1987,6 +3192,7 @@ void Widget::loadSettings()
     serverAddress = settings.value("Server/Address", "127.0.0.1").toString();
     serverPort = settings.value("Server/Port", 8888).toUInt();
     username = settings.value("User/Username", username).toString();
+    heartbeat->setInterval(settings.value("Network/HeartbeatMs", Heartbeat::DefaultIntervalMsecs).toInt());
 
     ui->serverAddressInput->setText(serverAddress);
     ui->serverPortInput->setText(QString::number(serverPort));
@@ -3,6 +3,7 @@
 
 #include <QWidget>
 #include <QTcpSocket>
+#include <QTcpServer>
 #include <QListWidgetItem>
 #include <QTimer>
 #include <QFile>
@@ -14,16 +15,30 @@
 #include <QProgressBar>
 #include <QLabel>
 #include <QLineEdit>
-#include <QTextBrowser>
 #include <QCheckBox>
 #include <QGroupBox>
 #include <QListWidget>
+#include <QHash>
+#include <QQueue>
+#include <QThreadPool>
 // 添加JSON相关头文件
 #include <QJsonObject>
 #include <QJsonDocument>
 #include <QJsonParseError>
 #include <QJsonValue>
 #include <QJsonArray>
+#include <functional>
+#include "blobcache.h"
+#include "chattimeline.h"
+#include "chunkpipeline.h"
+#include "framecodec.h"
+#include "heartbeat.h"
+#include "incomingfile.h"
+#include "outbox.h"
+#include "outboundscheduler.h"
+#include "serverdiscovery.h"
+#include "thumbnailloader.h"
+#include "transferjournal.h"
 
 QT_BEGIN_NAMESPACE
 namespace Ui {
@@ -44,7 +59,7 @@ private slots:
     // 连接相关
     void onConnectClicked();
     void onDisconnectClicked();
-    bool isBinaryData(const QByteArray &data);
+    bool isBinaryData(QByteArrayView data);
     // 消息相关
     void onSendClicked();
     void onMessageReturnPressed();
@@ -64,7 +79,8 @@ private slots:
     // 工具函数
     void appendMessage(const QString &sender, const QString &message, bool isSelf = false);
     void appendSystemMessage(const QString &message);
-    void appendImageMessage(const QString &sender, const QImage &image, const QString &fileName,
+    // imagePath: 生成缩略图用的图片文件，filePath: 点击时打开的文件
+    void appendImageMessage(const QString &sender, const QString &imagePath, const QString &fileName,
                             const QString &filePath, bool isSelf = false);
     void appendFileMessage(const QString &sender, const QString &fileName, qint64 fileSize,
                            const QString &filePath, bool isSelf = false);
@@ -74,12 +90,44 @@ private slots:
 
 private:
     Ui::Widget *ui;
+    ChatTimelineModel *chatModel;   // 聊天记录，ui->chatText 只绘制其中可见的行
+    ThumbnailLoader *thumbnails;    // 图片消息的缩略图在后台解码，完成后放回 chatModel
     QTcpSocket *tcpSocket;
+    OutboundScheduler *outbound;    // 所有写入都经过这里，聊天消息优先于文件分块
+    Heartbeat *heartbeat;       // ping/pong 测量往返时间，服务器无响应时断开重连
+    bool heartbeatLost;         // 本次断开是心跳超时引起的，不论是否勾选自动重连都要重连
+
+    // 断线重连：指数退避加随机抖动，服务器重启后大量客户端不会同时重连
+    QTimer *reconnectTimer;
+    int reconnectAttempts;      // 连续失败的重连次数，连上后清零
+    quint32 connectGeneration;  // 每次 connectToServer 加一，丢弃上一次尝试的超时回调
+    bool manualDisconnect;      // 用户主动断开，不重连
+    const int RECONNECT_BASE_DELAY = 1000;
+    const int RECONNECT_MAX_DELAY = 30000;
+
+    // 离线时发出的消息和文件，连接后按顺序一次发出
+    Outbox *outbox;
+    FrameDecoder frameDecoder;  // 接收缓冲区，跨 readyRead 保留不完整的帧
+    bool binaryFraming;         // 服务器已同意二进制帧，发送时使用二进制帧
+    bool chunkCompression;      // 服务器支持 zlib 压缩的文件分块（FrameFlagCompressed）
+    bool chunkDelivery;         // 服务器声明文件只以分块转发一次，不会再发重组的 file_base64
+    quint32 nextStreamId;       // 发送文件时分配的流ID
+
+    // 文件数据专用连接，服务器在 login_ack 中声明 bulk_channel 时建立
+    // 始终使用二进制帧，文件分块的重传不会阻塞聊天连接
+    QTcpSocket *bulkSocket;
+    OutboundScheduler *bulkOutbound;
+    FrameDecoder bulkDecoder;
+    QString bulkToken;          // login_ack 中的一次性令牌，连接后在 bulk_hello 中发送
+    bool bulkReady;             // 服务器已确认，新的上传走这条连接
     QString username;
     QString currentChatTarget;
     bool isConnected;
     QString serverAddress;
     quint16 serverPort;
+    // 每次连接时同时在局域网中查找服务器，保存的地址连不上时改连往返时间最短的一个
+    ServerDiscovery *discovery;
+    QString deferredConnectError;   // 查找期间保存的地址出错，查找没有结果时再提示
     bool isProcessingDownload;
     // 文件上传相关
     enum FileType {
@@ -91,35 +139,113 @@ private:
         Other = 5
     };
 
+    struct PeerLink;
+
+    // 一个上传任务，由 bytesWritten 信号驱动逐块写入套接字
     struct FileTransfer {
-        QFile *file;
+        ChunkPipeline *pipeline;    // 读取和编码分块，按序号交给 pumpUploads()
         QString fileName;
+        QString fileId;
+        QString targetUser;     // 私聊目标，群发时为空
         qint64 fileSize;
         FileType fileType;
-        qint64 bytesWritten;
+        quint32 streamId;       // 二进制帧模式下的流ID
+        bool binary;            // 开始时是否已协商二进制帧，整个传输期间保持不变
+        OutboundScheduler *channel; // 写入的连接：文件连接或聊天连接的批量队列
+        bool compressible;      // 不是已压缩的格式，值得尝试压缩分块
+        PeerLink *peerLink;     // 直连接收方时使用的连接，经服务器转发时为空
+        int totalChunks;
+        int nextChunk;          // 已写入套接字的分块数
+        qint64 bytesWritten;    // 已离开套接字缓冲区的文件字节数
         qint64 bytesTotal;
-        bool isSending;
+        bool isSending;         // 已开始发送（否则在等待队列中）
+        bool resend;            // 只补发接收方缺失的分块
     };
 
-    QList<FileTransfer*> pendingUploads;
-    FileTransfer* currentUpload;
-    QByteArray uploadBuffer;
-    const qint64 CHUNK_SIZE = 64 * 1024; // 64KB chunks
+    // 发送和接收进度的持久记录，用于断线或重启后续传，以及响应 file_resend
+    TransferJournal *journal;
+    bool transfersResumed;                  // 本次连接是否已经恢复过未完成的传输
+    bool loginAcked;                        // 本次连接是否收到了 login_ack，旧服务器不发送
+    const int LOGIN_ACK_TIMEOUT = 1000;     // 等待 login_ack 的时间，超过后按旧服务器处理
+
+    // 按内容寻址的文件缓存：接收方已有相同内容时回答 file_have，不再传输
+    BlobCache *blobCache;
+    bool serverDedup;                       // 服务器支持 file_offer 去重询问
+    struct UploadRequest {
+        QString filePath;
+        QString fileName;
+        QString targetUser;
+    };
+    QHash<QString, UploadRequest> pendingOffers;  // fileId -> 等待 file_offer_result 的发送
+    // 整个文件的哈希在这里计算，不阻塞 GUI 线程
+    QThreadPool hashPool;
+    void runInBackground(std::function<void()> work, std::function<void()> done);
+    // 缓存记录的保存副本仍然完好时回调它的路径，否则回调空字符串
+    void findSavedCopy(const QString &sha256, std::function<void(const QString &)> done);
+
+    // 私聊文件的直连：服务器只转交地址和令牌，文件数据在两个客户端之间直接传输
+    // 发送方监听临时端口并发出 p2p_offer，接收方连上后用 p2p_hello 回送令牌；
+    // 超时或任一方连不上时改由服务器转发
+    struct PeerLink {
+        QString fileId;
+        QString peer;               // 对方用户名
+        bool sending;               // 本端是发送方
+        QString token;              // 发送方生成，接收方在 p2p_hello 中回送
+        UploadRequest upload;       // 发送方：连不上时改走服务器转发的文件
+        QTcpServer *server;         // 发送方：等待接收方连接，连上后关闭
+        QTcpSocket *socket;
+        OutboundScheduler *outbound;    // 发送方：握手完成后创建
+        FrameDecoder decoder;
+        quint32 streamId;           // 接收方：本地分配的流ID，直连上收到的帧改用它处理
+        QTimer *timeout;
+    };
+    bool serverPeerToPeer;                  // 服务器会转交 p2p_offer
+    QHash<QString, PeerLink*> peerLinks;    // fileId -> 直连
+    const int PEER_CONNECT_TIMEOUT = 3000;  // 等待直连建立的时间，超过后改由服务器转发
+    quint32 nextPeerStreamId;               // 直连收到的流ID带 PEER_STREAM_BIT，与服务器分配的区分开
+    static constexpr quint32 PEER_STREAM_BIT = 0x80000000;
+
+    // 已交给发送调度、尚未发出的上传分块
+    struct UploadFrame {
+        FileTransfer *transfer;
+        qint64 fileBytes;
+        int chunkIndex;
+    };
+
+    QList<FileTransfer*> pendingUploads;    // 等待开始的上传
+    QList<FileTransfer*> activeUploads;     // 正在发送的上传，轮流写入分块
+    QHash<quint64, UploadFrame> uploadFramesInFlight;  // 发送调度的帧 ID -> 分块
+    int uploadCursor;                       // 轮转发送时下一个上传的位置
+    const qint64 CHUNK_SIZE = 50 * 1024;                // 分块大小
+    static constexpr qint64 UPLOAD_WINDOW = 1024 * 1024; // 批量队列和套接字中最多积压的字节数
+    const qint64 SEND_BUFFER_SIZE = 256 * 1024;         // 系统发送缓冲区，局域网足够跑满带宽
+    const int MAX_CONCURRENT_UPLOADS = 3;               // 同时发送的文件数
 
     // 文件接收相关
     qint64 totalFileSize;           // 当前接收文件的总大小
     QString receivedFileName;       // 当前接收的文件名
     FileType receivedFileType;      // 当前接收的文件类型
-    struct FileChunk {
+    QHash<QString, IncomingFile*> incomingFiles;  // fileId -> 正在接收的文件（直接写入磁盘）
+    QStringList recentCompletedFiles;             // 最近完成的 fileId，丢弃之后迟到的重复分块和整文件
+    const int MAX_RECENT_COMPLETED = 64;
+    QTimer *transferCheckTimer;                   // 定期检查停滞的接收并请求补发
+    const qint64 RESEND_IDLE_MSECS = 10000;       // 接收停滞多久后请求补发
+    const int MAX_RESEND_REQUESTS = 5;            // 补发请求次数上限，超过后放弃
+
+    // 二进制帧模式下，streamId -> 文件元数据（来自 FileMeta 帧）
+    struct IncomingStream {
+        QString sender;
+        QString fileId;
         QString fileName;
-        QString fileId;  // 唯一文件标识
+        qint64 fileSize;
         int totalChunks;
-        int currentChunk;
-        QByteArray chunkData;
-        QString targetUser;  // 私聊目标
+        qint64 chunkSize;
+        QString targetUser;
+        int expectedChunks;     // 这个流会收到的分块数：补发流为 resend_chunks，续传为 chunk_count，否则为 totalChunks
+        int chunksSeen;
     };
-
-    QMap<QString, FileChunk> fileChunkBuffer;  // fileId -> 正在接收的文件
+    QHash<quint32, IncomingStream> incomingStreams;
+    void dropIncomingStreams(const QString &fileId);
 
     // 私聊相关
     struct PrivateChat {
@@ -141,33 +267,94 @@ private:
     // 网络函数
     void connectToServer();
     void disconnectFromServer();
+    void onServerDiscoveryFinished(const QList<ServerDiscovery::Server> &servers);
+    void reportConnectError(const QString &errorMsg);
+    void onHeartbeatTimedOut(qint64 silentMsecs);
+    void scheduleReconnect();
+    void deliverMessage(const QJsonObject &message);
+    void flushOutbox();
     void sendMessage(const QString &message);
     void sendCommand(const QString &command);
-    void sendFile(const QString &filePath);
+    quint64 writeMessage(const QByteArray &message,
+                         OutboundScheduler::Lane lane = OutboundScheduler::Interactive);
+    quint64 writeToSocket(const QByteArray &data,
+                          OutboundScheduler::Lane lane = OutboundScheduler::Interactive);
+    void sendFile(const QString &filePath, const QString &targetUser);
+    bool queueUpload(const QString &filePath, const QString &fileId, const QString &targetUser,
+                     const QList<int> &chunkIndices = QList<int>(), bool resend = false);
     void cancelUpload();
 
+    // 上传引擎
+    void startUploads();
+    void pumpUploads();
+    bool writeUploadChunk(FileTransfer *transfer);
+    void finishUpload(FileTransfer *transfer, bool success);
+    void detachUpload(FileTransfer *transfer, bool graceful);
+    void onUploadFrameSent(quint64 id);
+
+    // 文件连接
+    void openBulkChannel(quint16 port, const QString &token);
+    void closeBulkChannel();
+    void onBulkConnected();
+    void onBulkDisconnected();
+    void onBulkReadyRead();
+
+    // 文件直连
+    bool beginUpload(const QString &fileId, const UploadRequest &upload);
+    void offerUpload(const QString &fileId, const UploadRequest &upload, qint64 fileSize, const QString &sha256);
+    void startPeerUpload(const QString &fileId, const UploadRequest &upload);
+    void onPeerConnection(PeerLink *link);
+    void onPeerReadyRead(PeerLink *link);
+    void onPeerDisconnected(PeerLink *link);
+    void acceptPeerOffer(const QJsonObject &offer);
+    void rejectPeerOffer(PeerLink *link, const QString &reason);
+    void fallbackToRelay(PeerLink *link, const QString &reason);
+    void closePeerLink(PeerLink *link, bool graceful);
+    void closePeerLinks();
+
     // 消息处理
     void processImageMessage(const QByteArray &data);
     void processTextMessage(const QString &message);
     void saveReceivedFile(const QByteArray &fileData, const QString &fileName, FileType fileType);
     void processJsonMessage(const QJsonObject &jsonObj);
+    void processFrame(const Frame &frame);
+    void handleFileChunk(const QString &sender, const QString &fileId, const QString &fileName,
+                         qint64 fileSize, int totalChunks, qint64 chunkSize, int chunkIndex,
+                         QByteArrayView chunkData, const QString &targetUser);
+    void completeIncomingFile(IncomingFile *incoming);
+    void showReceivedFile(const QString &sender, const QString &fileName, qint64 fileSize,
+                          const QString &savePath);
+    void rememberCompletedFile(const QString &key);
+    void handleFileOffer(const QJsonObject &offer);
+    void answerFileOffer(const QJsonObject &offer, const QString &savePath);
+    void handleFileOfferResult(const QString &fileId, bool needed, int haves);
+    void suspendIncomingFiles();
+    void resumeTransfers();
+    void resumeIncomingFrom(const QString &sender);
+    IncomingFile *restoreIncomingFile(const QString &fileId);
+    void checkIncomingFiles();
+    void requestMissingChunks(IncomingFile *incoming, int limit = -1);
+    void resendFileRanges(const QString &fileId, const QString &requester, const QJsonArray &ranges);
     bool isHandlingDownload;
-    QString saveBase64File(const QString &fileName, const QByteArray &fileData, bool isImage);
+    QString saveBase64File(const QString &fileName, const QByteArray &fileData, bool isImage,
+                           const QString &sha256 = QString());
+    QString saveDirectory(bool isImage);
+    QString uniqueSavePath(const QString &saveDir, const QString &fileName);
 
     // 工具函数
     QString getTimestamp();
     QString formatMessage(const QString &rawMessage);
     QString formatFileSize(qint64 bytes);
     FileType getFileType(const QString &filePath);
+    bool isCompressibleFile(const QString &filePath);
     QString getFileTypeString(FileType type);
     void saveSettings();
     void loadSettings();
     void showNotification(const QString &title, const QString &message);
     void updateUploadProgress(qint64 bytesWritten, qint64 bytesTotal);
-    void cleanTextBrowser();
 private slots:
     void handleDownloadRequest(const QUrl &url);
-    void setupTextBrowserConnections();
+    void setupTimelineConnections();
     // void onPrivateChatRequested(QListWidgetItem *item);
     // void onClosePrivateChat();
     // 用户列表右键菜单
@@ -0,0 +1,109 @@
+// bench/fanout.ts
+// 广播的扇出开销：同一条消息发给 N 个接收方（一半二进制帧，一半行模式），比较
+//   原来 - broadcast 为判断 private 再解析一次 JSON，sendText 为每个二进制接收方复制字符串、
+//          编码 UTF-8、加帧头，行模式接收方写字符串，由套接字在每次 write 里再编码一次
+//   现在 - 路由按信封决定一次，整行编码一次，所有接收方写同一个 Buffer
+// 接收方是丢弃数据的 Writable，经过真实的 OutboundQueue，写字符串时和套接字一样逐次编码。
+// 运行: npm run bench:fanout
+
+import { Writable } from 'stream';
+import type { Socket } from 'net';
+import { OutboundQueue } from '../src/OutboundQueue';
+import { FrameType, encodeFrame } from '../src/FrameCodec';
+import type { FramingMode } from '../src/FrameCodec';
+import { EncodedMessage } from '../src/Fanout';
+
+interface Sink {
+    framing: FramingMode;
+    outbound: OutboundQueue;
+}
+
+function makeSinks(count: number): Sink[] {
+    const sinks: Sink[] = [];
+    for (let i = 0; i < count; i++) {
+        const socket = new Writable({ write(_chunk, _encoding, callback) { callback(); } });
+        sinks.push({
+            framing: i % 2 === 0 ? 'binary' : 'line',
+            outbound: new OutboundQueue(socket as unknown as Socket)
+        });
+    }
+    return sinks;
+}
+
+function legacyBroadcast(envelope: object, sinks: Sink[]): void {
+    const message = JSON.stringify(envelope) + '\n';
+    try {
+        if (JSON.parse(message).type === 'private') return;
+    } catch (error) {
+        // 非JSON消息，正常广播
+    }
+    for (const sink of sinks) {
+        if (sink.framing === 'binary') {
+            const body = message.endsWith('\n') ? message.slice(0, -1) : message;
+            sink.outbound.send(encodeFrame(FrameType.Message, 0, Buffer.from(body, 'utf8')));
+        } else {
+            sink.outbound.send(message);
+        }
+    }
+}
+
+function encodedBroadcast(envelope: object, sinks: Sink[]): void {
+    if ((envelope as any).type === 'private') return;
+    const encoded = EncodedMessage.fromJson(envelope);
+    for (const sink of sinks) {
+        sink.outbound.send(encoded.bytesFor(sink.framing));
+    }
+}
+
+// 返回每条消息的平均耗时（微秒）；每轮之后让出事件循环，释放写回调持有的 Buffer
+async function measure(broadcast: (envelope: object, sinks: Sink[]) => void, envelope: object,
+                       sinks: Sink[], rounds: number): Promise<number> {
+    broadcast(envelope, sinks);  // 预热
+    await new Promise(resolve => setImmediate(resolve));
+    let elapsed = 0n;
+    for (let i = 0; i < rounds; i++) {
+        const start = process.hrtime.bigint();
+        broadcast(envelope, sinks);
+        elapsed += process.hrtime.bigint() - start;
+        await new Promise(resolve => setImmediate(resolve));
+    }
+    return Number(elapsed) / 1000 / rounds;
+}
+
+async function main(): Promise<void> {
+    const chat = {
+        type: 'text',
+        sender: 'bench',
+        content: '今天下午三点开会，别忘了带上周的报表',
+        timestamp: new Date().toLocaleTimeString(),
+        isPrivate: false
+    };
+    const file = {
+        type: 'file_base64',
+        sender: 'bench',
+        filename: 'report.bin',
+        filesize: 50 * 1024,
+        filedata: Buffer.alloc(50 * 1024, 0x5a).toString('base64'),
+        timestamp: new Date().toLocaleTimeString()
+    };
+    const cases: [string, object, number][] = [
+        ['聊天消息', chat, 20000],
+        ['50 KB 文件', file, 2000]
+    ];
+
+    for (const [name, envelope, budget] of cases) {
+        console.log(`${name}（${Buffer.byteLength(JSON.stringify(envelope))} 字节）`);
+        for (const count of [1, 10, 50, 200]) {
+            const sinks = makeSinks(count);
+            const rounds = Math.max(5, Math.floor(budget / count));
+            const legacy = await measure(legacyBroadcast, envelope, sinks, rounds);
+            const encoded = await measure(encodedBroadcast, envelope, sinks, rounds);
+            console.log(`  ${String(count).padStart(3)} 个接收方: ` +
+                        `原来 ${legacy.toFixed(1)} us/条 (${(legacy / count).toFixed(2)} us/接收方), ` +
+                        `现在 ${encoded.toFixed(1)} us/条 (${(encoded / count).toFixed(2)} us/接收方), ` +
+                        `${(legacy / encoded).toFixed(1)}x`);
+        }
+    }
+}
+
+main();
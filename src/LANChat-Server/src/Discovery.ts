@@ -0,0 +1,68 @@
+// src/Discovery.ts
+// 局域网服务发现。客户端连接前向组播地址、广播地址发出一次探测，
+// 每个服务器单播回答自己的聊天端口，客户端选往返时间最短的一个。
+//
+// 协议（UDP，一个数据报一条 JSON）:
+//   客户端 -> DISCOVERY_GROUP / 255.255.255.255 : DISCOVERY_PORT
+//       {"type":"lanchat_discover","nonce":"..."}
+//   服务器 -> 客户端（单播到探测的源地址和端口）
+//       {"type":"lanchat_server","nonce":"...","port":8888,"name":"主机名","users":3}
+import dgram from 'dgram';
+import os from 'os';
+
+export const DISCOVERY_PORT = 8890;
+export const DISCOVERY_GROUP = '239.255.77.88';
+
+// 探测很短，超过这个长度的数据报直接丢弃
+const MAX_PROBE_SIZE = 512;
+
+export class Discovery {
+    private socket: dgram.Socket;
+
+    // chatPort: 回答中声明的聊天端口；userCount: 当前在线人数，只用于显示
+    constructor(private chatPort: number, private userCount: () => number, port: number = DISCOVERY_PORT) {
+        this.socket = dgram.createSocket({ type: 'udp4', reuseAddr: true });
+        this.socket.on('error', (err) => {
+            // 端口不可用时客户端仍然可以用保存的地址连接
+            console.error(`❌ 服务发现启动失败: ${err.message}`);
+            this.socket.close();
+        });
+        this.socket.on('message', this.handleProbe.bind(this));
+        this.socket.bind(port, () => {
+            try {
+                this.socket.addMembership(DISCOVERY_GROUP);
+            } catch (err: any) {
+                console.error(`❌ 无法加入组播组 ${DISCOVERY_GROUP}，只回答广播探测: ${err.message}`);
+            }
+            console.log(`📡 服务发现监听 UDP 端口 ${port}`);
+        });
+    }
+
+    close(): void {
+        try {
+            this.socket.close();
+        } catch (err) {
+            // 已经关闭
+        }
+    }
+
+    private handleProbe(message: Buffer, remote: dgram.RemoteInfo): void {
+        if (message.length > MAX_PROBE_SIZE) return;
+        let probe: any;
+        try {
+            probe = JSON.parse(message.toString('utf8'));
+        } catch (err) {
+            return;
+        }
+        if (!probe || probe.type !== 'lanchat_discover') return;
+
+        const reply = Buffer.from(JSON.stringify({
+            type: 'lanchat_server',
+            nonce: typeof probe.nonce === 'string' ? probe.nonce : '',
+            port: this.chatPort,
+            name: os.hostname(),
+            users: this.userCount()
+        }), 'utf8');
+        this.socket.send(reply, remote.port, remote.address);
+    }
+}
@@ -0,0 +1,44 @@
+// src/Fanout.ts
+// 一条消息发给多个客户端时只编码一次：
+// 行模式的 UTF-8 字节和二进制 Message 帧各在第一次用到时生成，之后所有接收方写同一个 Buffer。
+// 路由（是否广播、发给谁）由调用方在编码之前按消息信封决定，这里不再解析消息内容。
+
+import { FrameType, encodeFrame } from './FrameCodec';
+import type { FramingMode } from './FrameCodec';
+
+export class EncodedMessage {
+    private line: Buffer | null = null;
+    private frame: Buffer | null = null;
+
+    // text: 以 '\n' 结尾的一行（JSON 或纯文本）
+    constructor(private readonly text: string) {}
+
+    static fromJson(envelope: object): EncodedMessage {
+        return new EncodedMessage(JSON.stringify(envelope) + '\n');
+    }
+
+    // 行模式：整行的 UTF-8 字节
+    get lineBytes(): Buffer {
+        return this.line = this.line || Buffer.from(this.text, 'utf8');
+    }
+
+    // 二进制帧：负载是同一段字节去掉末尾的换行，不再复制一次字符串
+    get frameBytes(): Buffer {
+        if (!this.frame) {
+            const line = this.lineBytes;
+            const body = line.length > 0 && line[line.length - 1] === 0x0a ? line.subarray(0, line.length - 1) : line;
+            this.frame = encodeFrame(FrameType.Message, 0, body);
+        }
+        return this.frame;
+    }
+
+    // 按接收方协商的分帧方式取字节
+    bytesFor(framing: FramingMode): Buffer {
+        return framing === 'binary' ? this.frameBytes : this.lineBytes;
+    }
+
+    get length(): number {
+        return this.lineBytes.length;
+    }
+}
+
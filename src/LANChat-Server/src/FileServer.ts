@@ -1,121 +1,171 @@
 // src/FileServer.ts
+// 文件数据专用连接。客户端登录后用 login_ack 中的端口和一次性令牌连接这里，
+// 之后文件元数据和分块都走这条连接，聊天连接不会因为文件数据的重传而队头阻塞。
+//
+// 这条连接上始终使用二进制帧（见 FrameCodec.ts）：
+//   客户端 -> 服务器  Message  {"type":"bulk_hello","token":"..."}
+//   服务器 -> 客户端  Message  {"type":"bulk_ready"}
+//   之后双向都是 FileMeta / FileChunk 帧
 import net, { Server, Socket } from 'net';
 import { EventEmitter } from 'events';
-import { createWriteStream, existsSync, mkdirSync } from 'fs';
-import { join } from 'path';
-
+import { randomBytes } from 'crypto';
+import { FrameReader, FrameType, encodeFrame } from './FrameCodec';
+import type { Frame } from './FrameCodec';
+import { OutboundQueue } from './OutboundQueue';
+
+export const BULK_PORT = 8889;
+
+// 握手必须在这段时间内完成
+const HELLO_TIMEOUT_MS = 10000;
+// 这条连接上只有文件数据，允许套接字缓冲积压更多，交给系统缓冲区跑满带宽
+const BULK_CONNECTION_QUANTUM = 1024 * 1024;
+
+interface BulkConnection {
+    socket: Socket;
+    outbound: OutboundQueue;
+}
+
+// 事件：
+//   'attach' (clientId)         文件连接已认证
+//   'frame'  (clientId, frame)  文件连接上收到的帧
+//   'detach' (clientId)         文件连接已断开
 export class FileServer extends EventEmitter {
     private server: Server;
-    private clients: Map<string, Socket> = new Map();
-    private uploads: Map<string, any> = new Map();
-    private uploadDir: string;
+    private tokens: Map<string, string> = new Map();              // 令牌 -> 聊天连接的 clientId
+    private connections: Map<string, BulkConnection> = new Map(); // clientId -> 文件连接
 
-    constructor(port: number = 8889, uploadDir: string = './uploads') {
+    constructor(port: number = BULK_PORT) {
         super();
-        this.uploadDir = uploadDir;
-        this.ensureUploadDir();
         this.server = net.createServer(this.handleConnection.bind(this));
+        this.server.on('error', (err) => {
+            // 端口不可用时所有文件数据仍然走聊天连接
+            console.error(`❌ 文件服务器启动失败: ${err.message}`);
+        });
         this.server.listen(port, () => {
-            console.log(`文件服务器监听端口 ${port}`);
-            console.log(`上传目录: ${uploadDir}`);
+            console.log(`📁 文件服务器监听端口 ${port}`);
         });
     }
 
-    private ensureUploadDir(): void {
-        if (!existsSync(this.uploadDir)) {
-            mkdirSync(this.uploadDir, { recursive: true });
-        }
+    get listening(): boolean {
+        return this.server.listening;
     }
 
-    private handleConnection(socket: Socket): void {
-        const clientId = `${socket.remoteAddress}:${socket.remotePort}`;
-        this.clients.set(clientId, socket);
-
-        console.log(`客户端连接: ${clientId}`);
-
-        let buffer = Buffer.alloc(0);
-        let currentUpload: any = null;
-
-        socket.on('data', (data: Buffer) => {
-            buffer = Buffer.concat([buffer, data]);
-
-            // 检查文件传输标识
-            if (buffer.includes('FILE_START')) {
-                this.handleFileStart(socket, buffer);
-                buffer = Buffer.alloc(0);
-            } else if (buffer.includes('FILE_DATA') && currentUpload) {
-                this.handleFileData(socket, buffer, currentUpload);
-                buffer = Buffer.alloc(0);
-            } else if (buffer.includes('IMAGE_MSG')) {
-                this.handleImageMessage(socket, buffer);
-                buffer = Buffer.alloc(0);
-            } else {
-                // 处理文本消息
-                const message = buffer.toString().trim();
-                if (message) {
-                    this.broadcastMessage(clientId, message);
-                }
-                buffer = Buffer.alloc(0);
-            }
-        });
-
-        socket.on('end', () => {
-            console.log(`客户端断开: ${clientId}`);
-            this.clients.delete(clientId);
-        });
-
-        socket.on('error', (err) => {
-            console.error(`客户端错误 ${clientId}:`, err);
-            this.clients.delete(clientId);
-        });
+    get port(): number {
+        const address = this.server.address();
+        return address && typeof address === 'object' ? address.port : BULK_PORT;
     }
 
-    private handleFileStart(socket: Socket, data: Buffer): void {
-        const startIndex = data.indexOf('FILE_START') + 10;
-        const fileData = data.slice(startIndex);
+    // 为聊天连接签发令牌，之前签发但未使用的令牌作废
+    issueToken(clientId: string): string {
+        for (const [token, owner] of this.tokens) {
+            if (owner === clientId) this.tokens.delete(token);
+        }
+        const token = randomBytes(16).toString('hex');
+        this.tokens.set(token, clientId);
+        return token;
+    }
 
-        // 解析文件头
-        // 这里需要实现文件头解析逻辑
-        console.log('接收到文件开始标识');
+    has(clientId: string): boolean {
+        return this.connections.has(clientId);
     }
 
-    private handleFileData(socket: Socket, data: Buffer, upload: any): void {
-        const startIndex = data.indexOf('FILE_DATA') + 9;
-        const chunk = data.slice(startIndex);
+    // 通过文件连接发送一帧，没有文件连接时返回 false；
+    // droppable 的分块在连接拥塞时被跳过，仍然返回 true
+    send(clientId: string, frame: Buffer, droppable: boolean = false): boolean {
+        const connection = this.connections.get(clientId);
+        if (!connection) return false;
+        connection.outbound.send(frame, 'bulk', droppable);
+        return true;
+    }
 
-        // 写入文件
-        if (upload.writeStream) {
-            upload.writeStream.write(chunk);
-            upload.bytesReceived += chunk.length;
+    summary(clientId: string): string | null {
+        const connection = this.connections.get(clientId);
+        return connection ? connection.outbound.summary() : null;
+    }
 
-            // 发送进度给客户端
-            const progress = Math.round((upload.bytesReceived / upload.fileSize) * 100);
-            socket.write(`UPLOAD_PROGRESS:${progress}\n`);
+    // 聊天连接断开时关闭对应的文件连接
+    detach(clientId: string): void {
+        for (const [token, owner] of this.tokens) {
+            if (owner === clientId) this.tokens.delete(token);
         }
+        const connection = this.connections.get(clientId);
+        if (connection) connection.socket.destroy();
     }
 
-    private handleImageMessage(socket: Socket, data: Buffer): void {
-        const startIndex = data.indexOf('IMAGE_MSG') + 9;
-        const imageData = data.slice(startIndex);
+    private handleConnection(socket: Socket): void {
+        const remote = `${socket.remoteAddress}:${socket.remotePort}`;
+        let clientId: string | null = null;
+
+        const helloTimer = setTimeout(() => {
+            console.error(`❌ 文件连接握手超时: ${remote}`);
+            socket.destroy();
+        }, HELLO_TIMEOUT_MS);
+
+        const reader = new FrameReader(
+            (frame) => {
+                if (clientId) {
+                    this.emit('frame', clientId, frame);
+                } else {
+                    clientId = this.authenticate(socket, frame);
+                    if (!clientId) {
+                        socket.destroy();
+                        return;
+                    }
+                    clearTimeout(helloTimer);
+                }
+            },
+            (error) => {
+                console.error(`❌ 文件连接数据错误 ${remote}: ${error}`);
+                socket.destroy();
+            });
+        reader.setMode('binary');
 
-        // 广播图片消息给所有客户端
-        this.clients.forEach((client, clientId) => {
-            if (client !== socket) {
-                client.write(data);
-            }
+        socket.on('data', (data: Buffer) => {
+            reader.push(data);
         });
-    }
 
-    private broadcastMessage(senderId: string, message: string): void {
-        this.clients.forEach((client, clientId) => {
-            if (clientId !== senderId) {
-                client.write(`${message}\n`);
+        socket.on('close', () => {
+            clearTimeout(helloTimer);
+            reader.dispose();
+            if (clientId && this.connections.get(clientId)?.socket === socket) {
+                this.connections.get(clientId)!.outbound.clear();
+                this.connections.delete(clientId);
+                this.emit('detach', clientId);
             }
         });
+
+        socket.on('error', (err) => {
+            console.error(`❌ 文件连接错误 ${remote}:`, err.message);
+        });
     }
 
-    public stop(): void {
-        this.server.close();
-        console.log('文件服务器已停止');
+    // 第一帧必须是带有效令牌的 bulk_hello，返回令牌对应的 clientId
+    private authenticate(socket: Socket, frame: Frame): string | null {
+        if (frame.type !== FrameType.Message) return null;
+        let hello: any;
+        try {
+            hello = JSON.parse(frame.payload.toString('utf8'));
+        } catch (error) {
+            return null;
+        }
+        if (hello.type !== 'bulk_hello' || typeof hello.token !== 'string') return null;
+
+        const clientId = this.tokens.get(hello.token);
+        if (!clientId) return null;
+        this.tokens.delete(hello.token);
+
+        // 同一个客户端重新建立文件连接时替换旧的
+        const previous = this.connections.get(clientId);
+        if (previous) {
+            this.connections.delete(clientId);
+            previous.socket.destroy();
+        }
+
+        const outbound = new OutboundQueue(socket, BULK_CONNECTION_QUANTUM);
+        this.connections.set(clientId, { socket, outbound });
+        outbound.send(encodeFrame(FrameType.Message, 0,
+                                  Buffer.from(JSON.stringify({ type: 'bulk_ready' }), 'utf8')));
+        this.emit('attach', clientId);
+        return clientId;
     }
-}
\ No newline at end of file
+}
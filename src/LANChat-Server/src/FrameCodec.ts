@@ -0,0 +1,205 @@
+// src/FrameCodec.ts
+// 连接上的两种分帧方式：
+//   line   - 旧协议，每条消息是一行 JSON 或文本，以 '\n' 结尾
+//   binary - 登录时协商的二进制帧：12 字节定长头 + 原始负载
+//
+// 二进制帧头（网络字节序）:
+//   u8  type      帧类型，见 FrameType
+//   u8  flags     见 FrameFlag
+//   u16 reserved  保留，目前为 0
+//   u32 streamId  文件流 ID，消息帧为 0
+//   u32 length    负载长度
+
+import { inflateSync } from 'zlib';
+
+export const FRAME_HEADER_SIZE = 12;
+export const MAX_FRAME_SIZE = 64 * 1024 * 1024;
+
+export const FrameType = {
+    Message: 1,    // 负载为一条 JSON/文本消息（等价于旧协议的一行）
+    FileMeta: 2,   // 负载为文件元数据 JSON，之后同一 streamId 的分块都属于该文件
+    FileChunk: 3   // 负载为 u32 分块序号 + 原始文件数据
+} as const;
+
+export const FrameFlag = {
+    // FileChunk 帧的数据经过压缩，格式同 Qt 的 qCompress()：u32 原始长度（大端）+ zlib 流
+    Compressed: 0x01
+} as const;
+
+// 服务器能解压、也能原样转发的分块压缩格式
+export const CHUNK_CODECS = ['zlib'];
+
+export type FramingMode = 'line' | 'binary';
+
+export interface Frame {
+    type: number;
+    flags: number;
+    streamId: number;
+    payload: Buffer;
+}
+
+export function encodeFrame(type: number, streamId: number, payload: Buffer, flags: number = 0): Buffer {
+    const frame = Buffer.allocUnsafe(FRAME_HEADER_SIZE + payload.length);
+    frame.writeUInt8(type, 0);
+    frame.writeUInt8(flags, 1);
+    frame.writeUInt16BE(0, 2);
+    frame.writeUInt32BE(streamId >>> 0, 4);
+    frame.writeUInt32BE(payload.length, 8);
+    payload.copy(frame, FRAME_HEADER_SIZE);
+    return frame;
+}
+
+// 文件分块负载：u32 分块序号 + 数据
+export function encodeChunkPayload(chunkIndex: number, data: Buffer): Buffer {
+    const payload = Buffer.allocUnsafe(4 + data.length);
+    payload.writeUInt32BE(chunkIndex >>> 0, 0);
+    data.copy(payload, 4);
+    return payload;
+}
+
+export function decodeChunkPayload(payload: Buffer): { chunkIndex: number; data: Buffer } | null {
+    if (payload.length < 4) return null;
+    return { chunkIndex: payload.readUInt32BE(0), data: payload.subarray(4) };
+}
+
+// 解压 FrameFlag.Compressed 的分块数据，格式错误或长度不符时返回 null
+export function decompressChunk(packed: Buffer, maxSize: number = MAX_FRAME_SIZE): Buffer | null {
+    if (packed.length < 4) return null;
+    const size = packed.readUInt32BE(0);
+    if (size > maxSize) return null;
+    try {
+        const data = inflateSync(packed.subarray(4), { maxOutputLength: Math.max(size, 1) });
+        return data.length === size ? data : null;
+    } catch (error) {
+        return null;
+    }
+}
+
+// 增量帧读取器：保留跨 'data' 事件的不完整帧
+// 行模式下的消息同样以 Frame（type = Message）的形式交给回调
+export class FrameReader {
+    private chunks: Buffer[] = [];
+    private buffered = 0;
+    private mode: FramingMode = 'line';
+    private idleTimer: NodeJS.Timeout | null = null;
+    private needed = 0;  // 二进制模式下当前不完整帧的总长度
+
+    constructor(private onFrame: (frame: Frame) => void,
+                private onError: (message: string) => void = () => {}) {}
+
+    public getMode(): FramingMode {
+        return this.mode;
+    }
+
+    // 切换分帧方式，在回调中调用时对缓冲区中剩余的字节立即生效
+    public setMode(mode: FramingMode): void {
+        this.mode = mode;
+        this.needed = 0;
+    }
+
+    public push(data: Buffer): void {
+        if (this.idleTimer) {
+            clearTimeout(this.idleTimer);
+            this.idleTimer = null;
+        }
+        this.chunks.push(data);
+        this.buffered += data.length;
+
+        // 大帧分多次到达时，在凑齐之前不做拼接，避免反复拷贝
+        if (this.mode === 'binary' && this.buffered < this.needed) return;
+        if (this.mode === 'line' && this.chunks.length > 1 && data.indexOf(0x0a) === -1) {
+            if (this.buffered > MAX_FRAME_SIZE) {
+                this.onError('行消息超过长度上限');
+                this.dispose();
+                return;
+            }
+            this.scheduleIdleFlush();
+            return;
+        }
+        this.drain();
+    }
+
+    public dispose(): void {
+        if (this.idleTimer) clearTimeout(this.idleTimer);
+        this.idleTimer = null;
+        this.chunks = [];
+        this.buffered = 0;
+    }
+
+    private take(): Buffer {
+        const buffer = this.chunks.length === 1 ? this.chunks[0] : Buffer.concat(this.chunks, this.buffered);
+        this.chunks = [];
+        this.buffered = 0;
+        return buffer;
+    }
+
+    private keep(rest: Buffer): void {
+        if (rest.length > 0) {
+            this.chunks = [rest];
+            this.buffered = rest.length;
+        }
+    }
+
+    private drain(): void {
+        const buffer = this.take();
+        let offset = 0;
+        this.needed = 0;
+
+        while (offset < buffer.length) {
+            if (this.mode === 'line') {
+                const newline = buffer.indexOf(0x0a, offset);
+                if (newline === -1) break;
+                const line = buffer.subarray(offset, newline);
+                offset = newline + 1;
+                this.onFrame({ type: FrameType.Message, flags: 0, streamId: 0, payload: line });
+            } else {
+                if (buffer.length - offset < FRAME_HEADER_SIZE) break;
+                const length = buffer.readUInt32BE(offset + 8);
+                if (length > MAX_FRAME_SIZE) {
+                    this.onError(`帧长度 ${length} 超过上限`);
+                    this.dispose();
+                    return;
+                }
+                if (buffer.length - offset < FRAME_HEADER_SIZE + length) {
+                    this.needed = FRAME_HEADER_SIZE + length;
+                    break;
+                }
+                const frame: Frame = {
+                    type: buffer.readUInt8(offset),
+                    flags: buffer.readUInt8(offset + 1),
+                    streamId: buffer.readUInt32BE(offset + 4),
+                    payload: buffer.subarray(offset + FRAME_HEADER_SIZE, offset + FRAME_HEADER_SIZE + length)
+                };
+                offset += FRAME_HEADER_SIZE + length;
+                this.onFrame(frame);
+            }
+        }
+
+        // 剩余的半帧单独拷贝出来，不拖住整个已处理的缓冲区
+        const rest = buffer.subarray(offset);
+        this.keep(offset > 0 ? Buffer.from(rest) : rest);
+
+        if (this.mode === 'line' && rest.length > 0) {
+            if (rest.length > MAX_FRAME_SIZE) {
+                this.onError('行消息超过长度上限');
+                this.dispose();
+                return;
+            }
+            this.scheduleIdleFlush();
+        }
+    }
+
+    // 旧客户端的 LOGIN:/命令不带换行符，短暂空闲后按一条消息处理；
+    // JSON 消息总是以换行结尾，不做这种兜底
+    private scheduleIdleFlush(): void {
+        if (this.buffered === 0 || this.chunks[0][0] === 0x7b /* '{' */) return;
+        this.idleTimer = setTimeout(() => {
+            this.idleTimer = null;
+            if (this.mode !== 'line') return;
+            const pending = this.take();
+            if (pending.length > 0) {
+                this.onFrame({ type: FrameType.Message, flags: 0, streamId: 0, payload: pending });
+            }
+        }, 30);
+    }
+}
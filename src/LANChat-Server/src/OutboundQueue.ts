@@ -0,0 +1,203 @@
+// src/OutboundQueue.ts
+// 每个客户端的发送调度，分两条队列：
+//   interactive - 聊天、系统消息、用户列表等，立即写入套接字
+//   bulk        - 文件元数据和分块，只在套接字缓冲积压低于 bulkQuantum 时写入一帧
+// 这样任何交互消息前面最多只有 bulkQuantum + 一个分块帧的文件数据。
+// 每帧记录从入队到交给系统（write 回调）的时间，按队列统计排队延迟
+//
+// 慢接收方：积压（队列 + 套接字缓冲）超过 HIGH_WATERMARK 后，可丢弃的文件分块不再入队，
+// 接收方之后按缺失的分块请求补发；降到 LOW_WATERMARK 以下恢复。
+// 拥塞期间 STALL_MS 内没有任何数据交给系统，或积压超过 HARD_LIMIT 时断开连接，这是最后手段。
+
+import type { Socket } from 'net';
+
+export type Lane = 'interactive' | 'bulk';
+
+export const BULK_QUANTUM = 64 * 1024;
+export const HIGH_WATERMARK = 8 * 1024 * 1024;
+export const LOW_WATERMARK = 2 * 1024 * 1024;
+export const HARD_LIMIT = 32 * 1024 * 1024;
+export const STALL_MS = 30000;
+
+export interface LaneStats {
+    frames: number;        // 已交给系统的帧数
+    bytes: number;
+    totalDelayMs: number;
+    maxDelayMs: number;
+    queued: number;        // 仍在队列或套接字缓冲中的帧数
+}
+
+interface QueuedFrame {
+    data: Buffer | string;
+    queuedAt: number;
+}
+
+function emptyStats(): LaneStats {
+    return { frames: 0, bytes: 0, totalDelayMs: 0, maxDelayMs: 0, queued: 0 };
+}
+
+export class OutboundQueue {
+    private bulk: QueuedFrame[] = [];
+    private bulkHead = 0;
+    private bulkBytes = 0;
+    private congestedSince: number | null = null;   // 积压超过高水位的时间，降到低水位以下时清除
+    private lastProgressAt = performance.now();     // 最近一次有数据交给系统的时间
+    private stallTimer: ReturnType<typeof setInterval> | null = null;  // 拥塞期间定时检查是否停滞
+    readonly stats: Record<Lane, LaneStats> = { interactive: emptyStats(), bulk: emptyStats() };
+    readonly dropped = { frames: 0, bytes: 0 };    // 拥塞时跳过的文件分块
+
+    // bulkQuantum: 套接字缓冲中允许积压的文件数据，只传文件的连接可以设得更大
+    constructor(private socket: Socket, private bulkQuantum: number = BULK_QUANTUM) {
+        socket.on('drain', () => this.pump());
+        socket.on('close', () => this.setCongested(false));
+    }
+
+    // droppable: 丢了能靠补发找回的文件分块，拥塞时直接跳过并返回 false
+    send(data: Buffer | string, lane: Lane = 'interactive', droppable: boolean = false): boolean {
+        if (droppable && this.congestedSince !== null) {
+            this.dropped.frames++;
+            this.dropped.bytes += byteLength(data);
+            this.checkBacklog();
+            return false;
+        }
+        const frame: QueuedFrame = { data, queuedAt: performance.now() };
+        this.stats[lane].queued++;
+        if (lane === 'interactive') {
+            this.write(frame, lane);
+        } else {
+            this.bulk.push(frame);
+            this.bulkBytes += byteLength(data);
+            this.pump();
+        }
+        this.checkBacklog();
+        return true;
+    }
+
+    // 尚未写入套接字的文件数据加上套接字缓冲中的积压
+    get bulkBacklog(): number {
+        return this.bulkBytes + this.socket.writableLength;
+    }
+
+    get congested(): boolean {
+        return this.congestedSince !== null;
+    }
+
+    // 立即写出批量队列中的全部帧，切换分帧方式之前调用，保证切换前后的字节顺序
+    flushBulk(): void {
+        while (this.bulkHead < this.bulk.length) {
+            this.writeNextBulk();
+        }
+        this.compact();
+    }
+
+    // 连接关闭时丢弃排队的数据
+    clear(): void {
+        this.bulk = [];
+        this.bulkHead = 0;
+        this.bulkBytes = 0;
+        this.stats.interactive.queued = 0;
+        this.stats.bulk.queued = 0;
+        this.setCongested(false);
+    }
+
+    summary(): string {
+        const describe = (name: string, s: LaneStats) => {
+            const avg = s.frames ? s.totalDelayMs / s.frames : 0;
+            return `${name}: ${s.frames} 帧, 平均排队 ${avg.toFixed(2)} ms, ` +
+                   `最长 ${s.maxDelayMs.toFixed(2)} ms, 排队中 ${s.queued}`;
+        };
+        let text = `${describe('聊天', this.stats.interactive)}; ${describe('文件', this.stats.bulk)}`;
+        if (this.dropped.frames) {
+            text += `; 拥塞跳过 ${this.dropped.frames} 个分块 (${(this.dropped.bytes / 1024 / 1024).toFixed(1)} MB)`;
+        }
+        if (this.congested) text += `; 拥塞中，积压 ${(this.bulkBacklog / 1024 / 1024).toFixed(1)} MB`;
+        return text;
+    }
+
+    private pump(): void {
+        while (this.bulkHead < this.bulk.length && this.socket.writableLength < this.bulkQuantum) {
+            if (this.socket.destroyed) return;
+            this.writeNextBulk();
+        }
+        this.compact();
+        this.checkBacklog();
+    }
+
+    // 按水位更新拥塞状态；长时间没有进展或积压过大时断开，由连接的 'close' 处理清理
+    private checkBacklog(): void {
+        if (this.socket.destroyed) return;
+        const backlog = this.bulkBacklog;
+        const now = performance.now();
+        if (this.congestedSince === null) {
+            if (backlog > HIGH_WATERMARK) this.setCongested(true);
+        } else if (backlog <= LOW_WATERMARK) {
+            this.setCongested(false);
+        }
+
+        const stalled = this.congestedSince !== null && now - Math.max(this.lastProgressAt, this.congestedSince) > STALL_MS;
+        if (backlog > HARD_LIMIT || stalled) {
+            const reason = stalled ? `${STALL_MS / 1000} 秒没有进展` : `积压超过 ${HARD_LIMIT / 1024 / 1024} MB`;
+            this.clear();
+            this.socket.destroy(new Error(`接收太慢（${reason}），断开连接`));
+        }
+    }
+
+    // 进入拥塞时开始定时检查：接收方不再读取时既没有 'drain' 也可能没有新的发送，
+    // 只靠 send() 和 pump() 检查的话停滞永远不会被发现
+    private setCongested(congested: boolean): void {
+        if (congested) {
+            if (this.congestedSince === null) this.congestedSince = performance.now();
+            if (!this.stallTimer) {
+                this.stallTimer = setInterval(() => this.checkBacklog(), STALL_MS / 4);
+                this.stallTimer.unref();
+            }
+        } else {
+            this.congestedSince = null;
+            if (this.stallTimer) {
+                clearInterval(this.stallTimer);
+                this.stallTimer = null;
+            }
+        }
+    }
+
+    private writeNextBulk(): void {
+        const frame = this.bulk[this.bulkHead];
+        this.bulk[this.bulkHead++] = undefined as any;
+        this.bulkBytes -= byteLength(frame.data);
+        this.write(frame, 'bulk');
+    }
+
+    private write(frame: QueuedFrame, lane: Lane): void {
+        if (this.socket.destroyed) {
+            this.stats[lane].queued--;
+            return;
+        }
+        const bytes = byteLength(frame.data);
+        this.socket.write(frame.data, (err) => {
+            const stats = this.stats[lane];
+            stats.queued = Math.max(0, stats.queued - 1);
+            if (err) return;
+            this.lastProgressAt = performance.now();
+            const delay = this.lastProgressAt - frame.queuedAt;
+            stats.frames++;
+            stats.bytes += bytes;
+            stats.totalDelayMs += delay;
+            if (delay > stats.maxDelayMs) stats.maxDelayMs = delay;
+        });
+    }
+
+    // 已写出的部分积累到一定数量后再裁剪数组，避免每帧 shift
+    private compact(): void {
+        if (this.bulkHead === this.bulk.length) {
+            this.bulk = [];
+            this.bulkHead = 0;
+        } else if (this.bulkHead > 1024) {
+            this.bulk = this.bulk.slice(this.bulkHead);
+            this.bulkHead = 0;
+        }
+    }
+}
+
+function byteLength(data: Buffer | string): number {
+    return typeof data === 'string' ? Buffer.byteLength(data, 'utf8') : data.length;
+}
@@ -1,7 +1,22 @@
 import net, { Socket } from 'net';
 import readline from 'readline';
-const fileChunkBuffer: Map<string, Map<number, Buffer>> = new Map();
+import { FrameReader, FrameType, FrameFlag, CHUNK_CODECS, encodeFrame, encodeChunkPayload, decodeChunkPayload,
+         decompressChunk } from './FrameCodec';
+import type { Frame, FramingMode } from './FrameCodec';
+import { OutboundQueue } from './OutboundQueue';
+import type { Lane } from './OutboundQueue';
+import { FileServer, BULK_PORT } from './FileServer';
+import { Discovery } from './Discovery';
+import { EncodedMessage } from './Fanout';
 const PORT = 8888;
+// 登录时向客户端声明的能力
+const SERVER_CAPS = ['binary_frames', 'dedup', 'p2p', 'heartbeat'];
+// 文件只以分块转发一次，服务器不再重组出整文件的 file_base64，在 login_ack 中告知客户端
+const FILE_DELIVERY = 'chunks';
+// 客户端按自己声明的间隔发 ping，连续这么多个间隔没有收到任何数据就认为连接已断
+const HEARTBEAT_DEAD_INTERVALS = 3;
+const HEARTBEAT_MIN_MS = 200;
+const HEARTBEAT_MAX_MS = 60000;
 interface ClientInfo {
     socket: Socket;
     username: string;
@@ -9,9 +24,64 @@ interface ClientInfo {
     remotePort: number;
     online: boolean; // 添加在线状态
     lastActive: Date; // 最后活动时间
+    framing: FramingMode; // 发往该客户端的分帧方式
+    reader: FrameReader;  // 该客户端的接收缓冲
+    streams: Map<number, RelayStream>; // 客户端的 streamId -> 正在转发的文件
+    jsonStreams: Set<RelayStream>;     // 客户端以 JSON file_chunk 上传、尚未转发完的文件
+    outbound: OutboundQueue; // 发往该客户端的数据，聊天消息优先于文件分块
+    codecs: Set<string>;     // 客户端能直接接收的分块压缩格式，其余情况由服务器解压后转发
+    caps: Set<string>;       // 客户端在 frame_mode 中声明的能力，如 dedup
+    heartbeatMs: number;     // 客户端 ping 中声明的心跳间隔，0 表示不发心跳（旧客户端）
+}
+
+// 去重询问：发送方先发 file_offer（带内容的 SHA-256），接收方回答 file_have / file_want，
+// 全部回答或超时后服务器告诉发送方是否还需要上传；已有内容的接收方不再收到分块
+interface FileOffer {
+    senderId: string;
+    pending: Set<string>;    // 尚未回答的接收方
+    haves: Set<string>;      // 已有相同内容的接收方
+    wants: number;           // 需要传输的接收方数（包括不支持去重的旧客户端）
+    answered: boolean;       // 已经回复发送方
+    timer: NodeJS.Timeout | null;
+}
+
+// 正在转发的文件，二进制和 JSON 客户端共用一份元数据
+interface RelayStream {
+    streamId: number;          // 服务器分配的 ID，发往二进制客户端时使用
+    meta: any;                 // file_id, file_name, file_size, total_chunks, chunk_size, sender, target
+    metaSentTo: Set<string>;   // 已经收到 FileMeta 帧的连接，见 sendFileFrame()
+    chunksRelayed: number;
 }
 
 const clients: Map<string, ClientInfo> = new Map();
+const relayStreams: Map<string, RelayStream> = new Map();  // file_id -> 转发中的文件
+const fileOffers: Map<string, FileOffer> = new Map();      // file_id -> 去重询问
+const OFFER_TIMEOUT_MS = 5000;           // 接收方回答的等待时间，超时按需要传输处理
+const OFFER_TTL_MS = 10 * 60 * 1000;     // 询问结束后保留 haves 的时间，覆盖整个上传
+let nextRelayStreamId = 1;
+
+// 文件数据专用连接，客户端在 login_ack 之后连接
+const fileServer = new FileServer(BULK_PORT);
+fileServer.on('attach', (clientId: string) => {
+    const client = clients.get(clientId);
+    console.log(`📁 ${client ? client.username : clientId} 建立了文件连接`);
+});
+fileServer.on('detach', (clientId: string) => {
+    const client = clients.get(clientId);
+    console.log(`📁 ${client ? client.username : clientId} 的文件连接已断开`);
+});
+fileServer.on('frame', (clientId: string, frame: Frame) => {
+    const client = clients.get(clientId);
+    if (!client) return;
+    client.lastActive = new Date();
+    // 文件连接上只接受文件帧
+    if (frame.type === FrameType.FileMeta || frame.type === FrameType.FileChunk) {
+        handleFrame(client, frame, clientId);
+    }
+});
+
+// 回答局域网内客户端的服务发现探测
+const discovery = new Discovery(PORT, () => clients.size);
 
 const server = net.createServer((socket) => {
     const clientId = `${socket.remoteAddress}:${socket.remotePort}`;
@@ -23,7 +93,20 @@ const server = net.createServer((socket) => {
         remoteAddress: socket.remoteAddress || 'unknown',
         remotePort: socket.remotePort || 0,
         online: true,
-        lastActive: new Date()
+        lastActive: new Date(),
+        framing: 'line',
+        reader: new FrameReader(
+            (frame) => handleFrame(clientInfo, frame, clientId),
+            (error) => {
+                console.error(`❌ 客户端数据错误 ${clientInfo.username}: ${error}`);
+                socket.destroy();
+            }),
+        streams: new Map(),
+        jsonStreams: new Set(),
+        outbound: new OutboundQueue(socket),
+        codecs: new Set(),
+        caps: new Set(),
+        heartbeatMs: 0
     };
     
     clients.set(clientId, clientInfo);
@@ -35,35 +118,346 @@ const server = net.createServer((socket) => {
     sendUserListToClient(clientId);
 
     // 发送欢迎消息
-    socket.write('[系统] 欢迎使用局域网聊天室！请设置用户名\n');
+    clientInfo.outbound.send('[系统] 欢迎使用局域网聊天室！请设置用户名\n');
     
     socket.on('data', (data: Buffer) => {
-        const message = data.toString().trim();
-        
-        // 尝试解析JSON消息
-        try {
-            const jsonData = JSON.parse(message);
-            handleJsonMessage(clientInfo, jsonData, clientId);
-        } catch (error) {
-            // 不是JSON，按文本处理
-            handleTextMessage(clientInfo, message, clientId);
-        }
+        clientInfo.lastActive = new Date();
+        clientInfo.reader.push(data);
     });
     
-    socket.on('end', () => {
-        console.log(`🔌 客户端断开: ${clientInfo.username} (${clientId})`);
-        clients.delete(clientId);
-        broadcast(`[系统] ${clientInfo.username} 离开了聊天室`, clientId);
-        // 广播用户下线通知
-        broadcastUserStatus(clientId, false);
-    });
+    socket.on('end', () => removeClient(clientId, clientInfo));
+    // 出错、被 destroy()（心跳超时、数据错误）时不会有 'end'
+    socket.on('close', () => removeClient(clientId, clientInfo));
     
     socket.on('error', (err) => {
         console.error(`❌ 客户端错误 ${clientInfo.username}:`, err.message);
-        clients.delete(clientId);
     });
 });
 
+// 客户端断开后的清理，'end' 和 'close' 都会调用，只执行一次
+function removeClient(clientId: string, clientInfo: ClientInfo): void {
+    if (clients.get(clientId) !== clientInfo) return;
+    console.log(`🔌 客户端断开: ${clientInfo.username} (${clientId})`);
+    clientInfo.reader.dispose();
+    clientInfo.outbound.clear();
+    fileServer.detach(clientId);
+    // 发送者断开后，未完成的二进制文件流不会再有分块
+    for (const stream of [...clientInfo.streams.values(), ...clientInfo.jsonStreams]) {
+        const key = relayStreamKey(stream.meta);
+        if (relayStreams.get(key) === stream) relayStreams.delete(key);
+    }
+    // 广播用户下线通知（需要在移除之前，broadcastUserStatus 按 clientId 查找用户名）
+    broadcastUserStatus(clientId, false);
+    clients.delete(clientId);
+    broadcast(`[系统] ${clientInfo.username} 离开了聊天室\n`, clientId);
+}
+
+// 发心跳的客户端连续几个间隔没有任何数据：交换机重启、网线断开等情况下 TCP 要很久才报错，
+// 这里主动断开，让其他人尽快看到它下线
+setInterval(() => {
+    const now = Date.now();
+    for (const [clientId, client] of clients) {
+        if (client.heartbeatMs === 0) continue;
+        const silentMs = now - client.lastActive.getTime();
+        if (silentMs > client.heartbeatMs * HEARTBEAT_DEAD_INTERVALS) {
+            console.log(`💤 ${client.username} ${silentMs}ms 无响应，断开连接`);
+            client.socket.destroy();
+            removeClient(clientId, client);
+        }
+    }
+}, 1000);
+
+// 处理一帧完整的数据（行模式下每行也是一帧）
+function handleFrame(client: ClientInfo, frame: Frame, clientId: string): void {
+    switch (frame.type) {
+        case FrameType.Message: {
+            const message = frame.payload.toString('utf8').trim();
+            if (!message) return;
+            
+            // 尝试解析JSON消息
+            let jsonData: any;
+            try {
+                jsonData = JSON.parse(message);
+            } catch (error) {
+                // 不是JSON，按文本处理
+                handleTextMessage(client, message, clientId);
+                return;
+            }
+            handleJsonMessage(client, jsonData, clientId);
+            break;
+        }
+        case FrameType.FileMeta: {
+            let meta: any;
+            try {
+                meta = JSON.parse(frame.payload.toString('utf8'));
+            } catch (error) {
+                console.error(`❌ 文件元数据格式错误: ${client.username}`);
+                return;
+            }
+            meta.sender = meta.sender || client.username;
+            const stream = openRelayStream(meta, true);
+            // 续传时旧的流ID不会再有分块
+            for (const [streamId, existing] of client.streams) {
+                if (existing === stream) client.streams.delete(streamId);
+            }
+            client.streams.set(frame.streamId, stream);
+            console.log(`📦 开始接收文件 ${meta.file_name} (${formatBytes(Number(meta.file_size) || 0)}, ${meta.total_chunks} 块)`);
+            break;
+        }
+        case FrameType.FileChunk: {
+            const stream = client.streams.get(frame.streamId);
+            const chunk = decodeChunkPayload(frame.payload);
+            if (!stream || !chunk) {
+                console.error(`❌ 未知的文件流 ${frame.streamId}: ${client.username}`);
+                return;
+            }
+            // 压缩的分块原样转发给支持的客户端，其他客户端收到解压后的数据
+            let data = chunk.data;
+            let packed: Buffer | undefined;
+            if (frame.flags & FrameFlag.Compressed) {
+                const unpacked = decompressChunk(chunk.data, Number(stream.meta.chunk_size) || undefined);
+                if (!unpacked) {
+                    console.error(`❌ 分块解压失败 ${stream.meta.file_name}#${chunk.chunkIndex}: ${client.username}`);
+                    return;
+                }
+                packed = chunk.data;
+                data = unpacked;
+            }
+            relayFileChunk(stream, chunk.chunkIndex, data, clientId, undefined, packed);
+            if (stream.chunksRelayed >= streamChunkCount(stream.meta)) {
+                client.streams.delete(frame.streamId);
+            }
+            break;
+        }
+        default:
+            console.log(`❓ 未知帧类型: ${frame.type}`);
+    }
+}
+
+// 按客户端协商的分帧方式发送一条消息（message 以 '\n' 结尾）
+// 已编码的消息直接取对应分帧方式的 Buffer，多个接收方共用
+function sendText(client: ClientInfo, message: string | EncodedMessage, lane: Lane = 'interactive'): void {
+    if (message instanceof EncodedMessage) {
+        client.outbound.send(message.bytesFor(client.framing), lane);
+    } else if (client.framing === 'binary') {
+        const body = message.endsWith('\n') ? message.slice(0, -1) : message;
+        client.outbound.send(encodeFrame(FrameType.Message, 0, Buffer.from(body, 'utf8')), lane);
+    } else {
+        client.outbound.send(message, lane);
+    }
+}
+
+// 补发的分块只发给请求者，与原始传输分开记录
+function relayStreamKey(meta: any): string {
+    return meta.resend ? `${meta.file_id}>${meta.target}` : meta.file_id;
+}
+
+// 这个流一共要转发的分块数：补发只包含缺失的部分，续传只包含上次没发出的部分（chunk_count）
+function streamChunkCount(meta: any): number {
+    if (meta.resend) return Number(meta.resend_chunks) || 0;
+    return Number(meta.chunk_count) || meta.total_chunks;
+}
+
+// restart: 发送方为同一文件重新发出 FileMeta（断线后续传），按新的元数据重新计数
+function openRelayStream(meta: any, restart: boolean = false): RelayStream {
+    const key = relayStreamKey(meta);
+    let stream = relayStreams.get(key);
+    if (stream && restart) {
+        stream.meta = meta;
+        stream.metaSentTo.clear();
+        stream.chunksRelayed = 0;
+    } else if (!stream) {
+        stream = {
+            streamId: nextRelayStreamId++ >>> 0,
+            meta,
+            metaSentTo: new Set(),
+            chunksRelayed: 0
+        };
+        relayStreams.set(key, stream);
+    }
+    return stream;
+}
+
+// 客户端能否接收二进制文件帧：聊天连接已切换到二进制帧，或者有文件连接
+function acceptsFileFrames(client: ClientInfo, clientId: string): boolean {
+    return client.framing === 'binary' || fileServer.has(clientId);
+}
+
+// 发送一个文件帧：有文件连接时走文件连接，否则走聊天连接的批量队列。
+// 传输途中换了连接时要在新连接上重新发送 FileMeta，所以 metaSentTo 按连接记录。
+// 接收方拥塞时分块会被跳过（之后由接收方请求补发），FileMeta 总是发送
+function sendFileFrame(stream: RelayStream, client: ClientInfo, clientId: string,
+                       frame: Buffer, metaFrame: () => Buffer): void {
+    const onBulk = fileServer.has(clientId);
+    const key = onBulk ? `${clientId}#bulk` : clientId;
+    const send = (data: Buffer, droppable: boolean) => {
+        if (!onBulk || !fileServer.send(clientId, data, droppable)) client.outbound.send(data, 'bulk', droppable);
+    };
+    if (!stream.metaSentTo.has(key)) {
+        send(metaFrame(), false);
+        stream.metaSentTo.add(key);
+    }
+    send(frame, true);
+}
+
+function findClientByUsername(username: string): [string, ClientInfo] | null {
+    for (const [id, info] of clients.entries()) {
+        if (info.username === username && info.online) return [id, info];
+    }
+    return null;
+}
+
+// 转发一个文件分块：二进制客户端收到原始数据帧，JSON 客户端收到 base64 的 file_chunk
+function relayFileChunk(stream: RelayStream, chunkIndex: number, data: Buffer, sourceClientId: string,
+                        base64Data?: string, packed?: Buffer): void {
+    const meta = stream.meta;
+    const fileId = meta.file_id;
+    const totalChunks = meta.total_chunks;
+    
+    // 补发只转发给请求者
+    if (meta.resend) {
+        relayResendChunk(stream, chunkIndex, data, base64Data, packed);
+        return;
+    }
+    
+    // 转发分块给其他客户端，两种编码都只在第一次用到时生成
+    let jsonLine: EncodedMessage | null = null;
+    let chunkFrame: Buffer | null = null;
+    let packedFrame: Buffer | null = null;
+    let metaFrame: Buffer | null = null;
+    const getMetaFrame = () => metaFrame = metaFrame || encodeFrame(FrameType.FileMeta, stream.streamId,
+                                                                    Buffer.from(JSON.stringify(meta), 'utf8'));
+    
+    const haves = fileOffers.get(fileId)?.haves;
+    // 私聊文件只转发给目标，不再发给所有人再由客户端丢弃
+    const target = meta.target && meta.target !== '所有人' ? meta.target : null;
+    
+    for (const [clientId, client] of clients.entries()) {
+        if (clientId === sourceClientId) continue;
+        if (target !== null && client.username !== target) continue;
+        if (haves && haves.has(clientId)) continue;  // 已从本地缓存取得
+        try {
+            if (acceptsFileFrames(client, clientId)) {
+                if (packed && client.codecs.has('zlib')) {
+                    packedFrame = packedFrame || encodeFrame(FrameType.FileChunk, stream.streamId,
+                                                             encodeChunkPayload(chunkIndex, packed),
+                                                             FrameFlag.Compressed);
+                    sendFileFrame(stream, client, clientId, packedFrame, getMetaFrame);
+                    continue;
+                }
+                chunkFrame = chunkFrame || encodeFrame(FrameType.FileChunk, stream.streamId,
+                                                       encodeChunkPayload(chunkIndex, data));
+                sendFileFrame(stream, client, clientId, chunkFrame, getMetaFrame);
+            } else {
+                if (jsonLine === null) {
+                    const chunkMessage = {
+                        type: 'file_chunk',
+                        sender: meta.sender,
+                        file_id: fileId,
+                        file_name: meta.file_name,
+                        file_size: meta.file_size,
+                        total_chunks: totalChunks,
+                        chunk_index: chunkIndex,
+                        chunk_data: base64Data !== undefined ? base64Data : data.toString('base64'),
+                        chunk_size: data.length,
+                        timestamp: new Date().toLocaleTimeString()
+                    };
+                    
+                    // 如果是私聊，添加目标
+                    if (meta.target) {
+                        (chunkMessage as any)['target'] = meta.target;
+                    }
+                    jsonLine = EncodedMessage.fromJson(chunkMessage);
+                }
+                // 行模式的接收方是旧客户端，不会请求补发，跳过分块会损坏文件：
+                // 不可跳过，积压过多或长时间没有进展时由 OutboundQueue 断开
+                client.outbound.send(jsonLine.lineBytes, 'bulk');
+            }
+        } catch (err) {
+            console.error(`转发文件分块失败 ${client.username}:`, err);
+        }
+    }
+    
+    stream.chunksRelayed++;
+    if (stream.chunksRelayed >= streamChunkCount(meta)) {
+        console.log(`✅ 文件转发完成: ${meta.file_name}`);
+        relayStreams.delete(fileId);
+        dropFileOffer(fileId);
+    }
+}
+
+// 回复发送方是否还需要上传；没有回答的接收方按需要处理
+function answerFileOffer(fileId: string): void {
+    const offer = fileOffers.get(fileId);
+    if (!offer || offer.answered) return;
+    offer.answered = true;
+    if (offer.timer) clearTimeout(offer.timer);
+    offer.wants += offer.pending.size;
+    offer.pending.clear();
+    
+    const sender = clients.get(offer.senderId);
+    if (sender) {
+        sendText(sender, JSON.stringify({
+            type: 'file_offer_result',
+            file_id: fileId,
+            needed: offer.wants > 0,
+            haves: offer.haves.size
+        }) + '\n');
+    }
+    console.log(`🧩 ${fileId}: ${offer.haves.size} 个接收方已有, ${offer.wants} 个需要传输`);
+    
+    if (offer.wants === 0) {
+        fileOffers.delete(fileId);
+    } else {
+        offer.timer = setTimeout(() => fileOffers.delete(fileId), OFFER_TTL_MS);
+    }
+}
+
+function dropFileOffer(fileId: string): void {
+    const offer = fileOffers.get(fileId);
+    if (!offer) return;
+    if (offer.timer) clearTimeout(offer.timer);
+    fileOffers.delete(fileId);
+}
+
+function relayResendChunk(stream: RelayStream, chunkIndex: number, data: Buffer, base64Data?: string,
+                          packed?: Buffer): void {
+    const meta = stream.meta;
+    stream.chunksRelayed++;
+    if (stream.chunksRelayed >= streamChunkCount(meta)) {
+        relayStreams.delete(relayStreamKey(meta));
+    }
+    
+    const found = findClientByUsername(meta.target);
+    if (!found) return;
+    const [clientId, client] = found;
+    
+    if (acceptsFileFrames(client, clientId)) {
+        const chunkFrame = packed && client.codecs.has('zlib')
+            ? encodeFrame(FrameType.FileChunk, stream.streamId, encodeChunkPayload(chunkIndex, packed),
+                          FrameFlag.Compressed)
+            : encodeFrame(FrameType.FileChunk, stream.streamId, encodeChunkPayload(chunkIndex, data));
+        sendFileFrame(stream, client, clientId, chunkFrame,
+                      () => encodeFrame(FrameType.FileMeta, stream.streamId,
+                                        Buffer.from(JSON.stringify(meta), 'utf8')));
+    } else {
+        client.outbound.send(JSON.stringify({
+            type: 'file_chunk',
+            sender: meta.sender,
+            file_id: meta.file_id,
+            file_name: meta.file_name,
+            file_size: meta.file_size,
+            total_chunks: meta.total_chunks,
+            chunk_index: chunkIndex,
+            chunk_data: base64Data !== undefined ? base64Data : data.toString('base64'),
+            chunk_size: data.length,
+            target: meta.target,
+            resend: true,
+            timestamp: new Date().toLocaleTimeString()
+        }) + '\n', 'bulk');  // 同 relayFileChunk，行模式的接收方不可跳过
+    }
+}
+
 function handleJsonMessage(client: ClientInfo, jsonData: any, clientId: string): void {
     const type = jsonData.type || 'text';
     // 优先使用消息中的sender，如果没有则使用客户端的用户名
@@ -82,13 +476,13 @@ function handleJsonMessage(client: ClientInfo, jsonData: any, clientId: string):
             const time = jsonData.timestamp || new Date().toLocaleTimeString();
             
             console.log(`💬 ${sender}: ${content}`);
-            broadcast(JSON.stringify({
+            broadcast({
                 type: 'text',
                 sender: sender,
                 content: content,
                 timestamp: time,
                 isPrivate: false
-            }), clientId);
+            }, clientId);
             break;
         case 'private':
             // 私聊消息
@@ -102,11 +496,9 @@ function handleJsonMessage(client: ClientInfo, jsonData: any, clientId: string):
 case 'file_chunk': {
     const fileId = jsonData.file_id;
     const fileName = jsonData.file_name;
-    const fileSize = parseInt(jsonData.file_size);
     const totalChunks = jsonData.total_chunks;
     const chunkIndex = jsonData.chunk_index;
     let chunkData = jsonData.chunk_data || '';
-    const chunkSize = parseInt(jsonData.chunk_size);
     
     console.log(`📦 收到文件分块 ${fileName}: ${chunkIndex + 1}/${totalChunks}`);
     
@@ -116,78 +508,20 @@ case 'file_chunk': {
     // 解码块数据
     const decodedChunk = Buffer.from(chunkData, 'base64');
     
-    // 初始化分块缓存
-    if (!fileChunkBuffer.has(fileId)) {
-        fileChunkBuffer.set(fileId, new Map());
-    }
-    
-    const chunkMap = fileChunkBuffer.get(fileId)!;
-    
-    // 存储分块
-    chunkMap.set(chunkIndex, decodedChunk);
-    
-    // 检查是否所有分块都已收到
-    if (chunkMap.size === totalChunks) {
-        console.log(`✅ 文件分块接收完成: ${fileName}`);
-        
-        // 重组文件
-        const chunks: Buffer[] = [];
-        for (let i = 0; i < totalChunks; i++) {
-            const chunk = chunkMap.get(i);
-            if (!chunk) {
-                console.error(`❌ 缺少分块 ${i}`);
-                break;
-            }
-            chunks.push(chunk);
-        }
-        
-        if (chunks.length === totalChunks) {
-            const fullFileData = Buffer.concat(chunks);
-            
-            // 创建完整文件消息
-            const completeMessage = {
-                type: 'file_base64', // 或者 image_base64，根据文件类型判断
-                sender: jsonData.sender || client.username,
-                filename: fileName,
-                filesize: fileSize,
-                filedata: fullFileData.toString('base64'),
-                timestamp: new Date().toLocaleTimeString()
-            };
-            
-            // 如果是私聊，添加目标
-            if ((jsonData as any).target) {
-                (completeMessage as any)['target'] = (jsonData as any).target;
-            }
-            
-            // 广播给所有客户端
-            broadcast(JSON.stringify(completeMessage) + '\n', clientId);
-            console.log(`✅ 文件重组完成并广播: ${fileName} (${formatBytes(fullFileData.length)})`);
-        }
-        
-        // 清理缓存
-        fileChunkBuffer.delete(fileId);
-    }
-    
-    // 转发分块给其他客户端
-    const chunkMessage = {
-        type: 'file_chunk',
-        sender: jsonData.sender || client.username,
+    const stream = openRelayStream({
         file_id: fileId,
         file_name: fileName,
-        file_size: fileSize,
+        file_size: parseInt(jsonData.file_size),
         total_chunks: totalChunks,
-        chunk_index: chunkIndex,
-        chunk_data: chunkData,
-        chunk_size: decodedChunk.length,
-        timestamp: new Date().toLocaleTimeString()
-    };
-    
-    // 如果是私聊，添加目标
-    if ((jsonData as any).target) {
-        (chunkMessage as any)['target'] = (jsonData as any).target;
-    }
-    
-    broadcast(JSON.stringify(chunkMessage) + '\n', clientId);
+        sender: jsonData.sender || client.username,
+        target: jsonData.target,
+        resend: jsonData.resend === true,
+        resend_chunks: jsonData.resend_chunks,
+        chunk_count: jsonData.chunk_count
+    });
+    client.jsonStreams.add(stream);
+    relayFileChunk(stream, chunkIndex, decodedChunk, clientId, chunkData);
+    if (stream.chunksRelayed >= streamChunkCount(stream.meta)) client.jsonStreams.delete(stream);
     break;
 }
         // 在handleJsonMessage函数中，处理file_base64类型时：
@@ -207,7 +541,7 @@ case 'file_chunk': {
                     message: `文件 ${fileName} 数据格式错误`,
                     timestamp: new Date().toLocaleTimeString()
                 });
-                client.socket.write(errorMsg + '\n');
+                sendText(client, errorMsg + '\n');
                 return;
             }
             
@@ -256,23 +590,166 @@ case 'file_chunk': {
                 if ((jsonData as any).target) {
                     (cleanJson as any)['target'] = (jsonData as any).target;
                 }
+                // 保留 file_id，接收方据此丢弃重复的文件
+                if (typeof jsonData.file_id === 'string' && jsonData.file_id) {
+                    (cleanJson as any)['file_id'] = jsonData.file_id;
+                }
                 
-                const jsonString = JSON.stringify(cleanJson) + '\n';
-                
-                // 验证JSON长度（避免过大）
-                if (jsonString.length > 10 * 1024 * 1024) { // 10MB限制
-                    console.error(`❌ JSON太大: ${jsonString.length}字节`);
+                // 验证数据长度（避免过大）
+                if (base64Data.length > 10 * 1024 * 1024) { // 10MB限制
+                    console.error(`❌ JSON太大: ${base64Data.length}字节`);
                     return;
                 }
                 
-                // 广播给所有客户端
-                broadcast(jsonString, clientId);
+                // 广播给所有客户端，私聊文件只发给目标；整个文件走批量队列，不挡住聊天消息
+                broadcast(cleanJson, clientId, 'bulk');
             } catch (err) {
                 console.error(`❌ JSON序列化失败:`, err);
             }
             break;
         }
             
+        case 'file_offer': {
+            // 私聊只问目标，群发问所有其他在线用户；不支持去重的客户端直接算作需要
+            const fileId = String(jsonData.file_id || '');
+            if (!fileId || typeof jsonData.sha256 !== 'string') return;
+            dropFileOffer(fileId);
+            
+            const offer: FileOffer = {
+                senderId: clientId, pending: new Set(), haves: new Set(), wants: 0, answered: false, timer: null
+            };
+            fileOffers.set(fileId, offer);
+            const forward = JSON.stringify({
+                type: 'file_offer',
+                sender,
+                file_id: fileId,
+                file_name: jsonData.file_name,
+                file_size: jsonData.file_size,
+                sha256: jsonData.sha256,
+                target: jsonData.target
+            }) + '\n';
+            for (const [id, info] of clients.entries()) {
+                if (id === clientId || !info.online) continue;
+                if (jsonData.target && info.username !== jsonData.target) continue;
+                if (info.caps.has('dedup')) {
+                    offer.pending.add(id);
+                    sendText(info, forward);
+                } else {
+                    offer.wants++;
+                }
+            }
+            
+            if (offer.pending.size === 0) {
+                answerFileOffer(fileId);
+            } else {
+                offer.timer = setTimeout(() => answerFileOffer(fileId), OFFER_TIMEOUT_MS);
+            }
+            break;
+        }
+            
+        case 'file_have':
+        case 'file_want': {
+            const offer = fileOffers.get(String(jsonData.file_id || ''));
+            if (!offer || offer.answered || !offer.pending.delete(clientId)) return;
+            if (jsonData.type === 'file_have') {
+                offer.haves.add(clientId);
+            } else {
+                offer.wants++;
+            }
+            if (offer.pending.size === 0) answerFileOffer(String(jsonData.file_id));
+            break;
+        }
+            
+        case 'file_resend': {
+            // 接收方缺少分块，只把请求转给原发送方
+            const found = findClientByUsername(jsonData.target);
+            if (!found || !Array.isArray(jsonData.ranges)) {
+                console.log(`❓ 无法转发补发请求: ${sender} -> ${jsonData.target}`);
+                return;
+            }
+            const missing = jsonData.ranges.reduce((sum: number, range: any) => sum + (Number(range[1]) || 0), 0);
+            console.log(`🔁 ${client.username} 请求 ${jsonData.target} 补发 ${jsonData.file_id} 的 ${missing} 个分块`);
+            // 请求者取自连接本身，不用消息中的 sender，发送方据此判断能否补发私聊文件
+            sendText(found[1], JSON.stringify({
+                type: 'file_resend',
+                file_id: jsonData.file_id,
+                requester: client.username,
+                ranges: jsonData.ranges
+            }) + '\n');
+            break;
+        }
+            
+        case 'p2p_offer': {
+            // 私聊文件的直连请求：发送方只知道自己监听的端口，服务器补上它的地址后转给目标；
+            // 目标不支持直连时立即告诉发送方，由它改走服务器转发
+            const found = findClientByUsername(jsonData.target);
+            const fileId = String(jsonData.file_id || '');
+            if (!found || !found[1].caps.has('p2p') || !fileId) {
+                console.log(`↩️ 无法直连: ${sender} -> ${jsonData.target}`);
+                sendText(client, JSON.stringify({
+                    type: 'p2p_failed',
+                    file_id: fileId,
+                    sender: jsonData.target,
+                    reason: 'peer unavailable'
+                }) + '\n');
+                return;
+            }
+            console.log(`🔗 ${sender} 请求直连 ${jsonData.target}: ${jsonData.file_name}`);
+            sendText(found[1], JSON.stringify({
+                type: 'p2p_offer',
+                sender,
+                file_id: fileId,
+                file_name: jsonData.file_name,
+                file_size: jsonData.file_size,
+                host: client.remoteAddress,
+                port: Number(jsonData.port) || 0,
+                token: jsonData.token
+            }) + '\n');
+            break;
+        }
+            
+        case 'p2p_failed': {
+            // 接收方连不上发送方，转给发送方
+            const found = findClientByUsername(jsonData.target);
+            if (!found) return;
+            console.log(`↩️ ${sender} 无法直连 ${jsonData.target}，改由服务器转发`);
+            sendText(found[1], JSON.stringify({
+                type: 'p2p_failed',
+                file_id: jsonData.file_id,
+                sender,
+                reason: jsonData.reason
+            }) + '\n');
+            break;
+        }
+            
+        case 'ping': {
+            // 心跳：立即在交互队列回答，客户端据此测量往返时间
+            const interval = Number(jsonData.interval) || 0;
+            client.heartbeatMs = interval > 0 ? Math.min(Math.max(interval, HEARTBEAT_MIN_MS), HEARTBEAT_MAX_MS) : 0;
+            sendText(client, JSON.stringify({ type: 'pong', seq: jsonData.seq }) + '\n');
+            break;
+        }
+            
+        case 'frame_mode':
+            // 客户端在收到 login_ack 后请求切换分帧方式
+            // 这一行之后客户端发来的数据都是二进制帧；确认行是服务器发出的最后一行
+            if (jsonData.mode === 'binary' && client.framing === 'line') {
+                client.reader.setMode('binary');
+                // 还在排队的行模式数据必须先于确认行写出
+                client.outbound.flushBulk();
+                client.outbound.send(JSON.stringify({ type: 'frame_mode', mode: 'binary' }) + '\n');
+                client.framing = 'binary';
+                // 客户端声明能直接接收的分块压缩格式
+                if (Array.isArray(jsonData.codecs)) {
+                    client.codecs = new Set(jsonData.codecs.filter((c: any) => CHUNK_CODECS.includes(c)));
+                }
+                if (Array.isArray(jsonData.caps)) {
+                    client.caps = new Set(jsonData.caps.filter((c: any) => typeof c === 'string'));
+                }
+                console.log(`🔀 ${client.username} 切换到二进制帧`);
+            }
+            break;
+            
         case 'login':
             // 处理登录
             const username = jsonData.username || client.username;
@@ -317,7 +794,7 @@ function handlePrivateMessage(client: ClientInfo, jsonData: any, clientId: strin
             message: `用户 ${targetUsername} 不在线或不存在`,
             timestamp: new Date().toLocaleTimeString()
         });
-        client.socket.write(errorMsg + '\n');
+        sendText(client, errorMsg + '\n');
         return;
     }
     
@@ -328,7 +805,7 @@ function handlePrivateMessage(client: ClientInfo, jsonData: any, clientId: strin
             message: '不能给自己发送私聊消息',
             timestamp: new Date().toLocaleTimeString()
         });
-        client.socket.write(errorMsg + '\n');
+        sendText(client, errorMsg + '\n');
         return;
     }
     
@@ -343,10 +820,10 @@ function handlePrivateMessage(client: ClientInfo, jsonData: any, clientId: strin
     });
     
     // 发送给目标用户
-    targetClient.socket.write(privateMessage + '\n');
+    sendText(targetClient, privateMessage + '\n');
     
     // 同时发送给发送者（显示在自己聊天窗口）
-    client.socket.write(privateMessage + '\n');
+    sendText(client, privateMessage + '\n');
     
     console.log(`💌 私聊 ${sender} -> ${targetUsername}: ${content}`);
 }
@@ -371,7 +848,21 @@ function handleTextMessage(client: ClientInfo, message: string, clientId: string
         client.username = username || client.username;
         
         console.log(`👤 用户登录: ${client.username} (${clientId})`);
-        client.socket.write(`[系统] 欢迎 ${client.username}！\n`);
+        sendText(client, `[系统] 欢迎 ${client.username}！\n`);
+        // 声明服务器支持的能力，客户端据此决定是否切换到二进制帧、是否建立文件连接
+        const loginAck: any = {
+            type: 'login_ack',
+            username: client.username,
+            caps: SERVER_CAPS,
+            codecs: CHUNK_CODECS,
+            file_delivery: FILE_DELIVERY
+        };
+        if (fileServer.listening) {
+            loginAck.caps = [...SERVER_CAPS, 'bulk_channel'];
+            loginAck.bulk_port = fileServer.port;
+            loginAck.bulk_token = fileServer.issueToken(clientId);
+        }
+        sendText(client, JSON.stringify(loginAck) + '\n');
         broadcast(`[系统] ${oldUsername} 加入了聊天室\n`, clientId);
         
         // 发送在线用户列表给所有客户端
@@ -426,7 +917,7 @@ function sendUserListToClient(clientId: string): void {
         }));
     
     try {
-        client.socket.write(JSON.stringify({
+        sendText(client, JSON.stringify({
             type: 'user_list',
             users: userList,
             timestamp: new Date().toLocaleTimeString()
@@ -436,24 +927,28 @@ function sendUserListToClient(clientId: string): void {
     }
 }
 
-function broadcast(message: string, excludeClientId?: string): void {
-    try {
-        const jsonData = JSON.parse(message);
-        // 如果是私聊消息，不广播
-        if (jsonData.type === 'private') {
-            return;
-        }
-    } catch (error) {
-        // 非JSON消息，正常广播
+// 广播一条消息。JSON 消息传信封对象，路由只按信封决定一次：private 不广播，
+// 带 target 的只发给目标用户；纯文本行（系统提示）传字符串。
+// 消息只编码一次，所有接收方写同一个 Buffer
+function broadcast(message: string | object, excludeClientId?: string, lane: Lane = 'interactive'): void {
+    let target: string | null = null;
+    let encoded: EncodedMessage;
+    if (typeof message === 'string') {
+        encoded = new EncodedMessage(message);
+    } else {
+        const envelope = message as any;
+        if (envelope.type === 'private') return;
+        if (envelope.target && envelope.target !== '所有人') target = envelope.target;
+        encoded = EncodedMessage.fromJson(envelope);
     }
     
     for (const [clientId, client] of clients.entries()) {
-        if (clientId !== excludeClientId) {
-            try {
-                client.socket.write(message);
-            } catch (err) {
-                console.error(`广播消息失败 ${client.username}:`, err);
-            }
+        if (clientId === excludeClientId) continue;
+        if (target !== null && client.username !== target) continue;
+        try {
+            sendText(client, encoded, lane);
+        } catch (err) {
+            console.error(`广播消息失败 ${client.username}:`, err);
         }
     }
 }
@@ -477,12 +972,12 @@ function broadcastUserStatus(clientId: string, isOnline: boolean): void {
     const client = clients.get(clientId);
     if (!client) return;
     
-    const statusMessage = JSON.stringify({
+    const statusMessage = {
         type: 'user_status',
         username: client.username,
         online: isOnline,
         timestamp: new Date().toLocaleTimeString()
-    });
+    };
     
     broadcast(statusMessage, clientId);
 }
@@ -506,12 +1001,20 @@ rl.on('line', (input) => {
         clients.forEach((client, id) => {
             console.log(`  ${client.username} (${id})`);
         });
+    } else if (command === '/stats') {
+        // 每个客户端两条发送队列的排队延迟
+        clients.forEach((client, id) => {
+            console.log(`  ${client.username}: ${client.outbound.summary()}`);
+            const bulk = fileServer.summary(id);
+            if (bulk) console.log(`    文件连接: ${bulk}`);
+        });
     } else if (command === '/stop') {
         console.log('🛑 正在关闭服务器...');
         broadcast('[系统] 服务器即将关闭\n');
         
         setTimeout(() => {
             server.close();
+            discovery.close();
             clients.forEach(client => client.socket.destroy());
             rl.close();
             process.exit(0);
@@ -521,6 +1024,6 @@ rl.on('line', (input) => {
         broadcast(`[服务器公告] ${message}\n`);
         console.log(`📢 服务器公告: ${message}`);
     } else {
-        console.log('❓ 未知命令。可用命令: /users, /stop, /say <消息>');
+        console.log('❓ 未知命令。可用命令: /users, /stats, /stop, /say <消息>');
     }
 });
\ No newline at end of file